@@ -0,0 +1,98 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <string>
+#include <vector>
+#include "./analyzer.h"
+#include "./perfect-hash.h"
+
+using std::vector;
+using std::string;
+
+class AnalyzerTest : public ::testing::Test {
+ public:
+  void SetUp() {
+  }
+
+  void TearDown() {
+  }
+
+  // Returns the normalized terms of given text.
+  static vector<string> Terms(const Analyzer& analyzer, const string& text) {
+    vector<Analyzer::Term> terms;
+    string buffer;
+    analyzer.Analyze(text.data(), text.size(), &terms, &buffer);
+    vector<string> words;
+    for (const Analyzer::Term& term: terms) {
+      const string word = buffer.substr(term.term_pos, term.term_size);
+      EXPECT_EQ(PerfectHash::Hash(word.data(), word.size()), term.hash);
+      words.push_back(word);
+    }
+    return words;
+  }
+};
+
+TEST_F(AnalyzerTest, FoldCase) {
+  const string s = "\xc3\x84PFEL, Birnen \xd0\x96\xd0\xb8\xd0\xb7\xd0\xbd"
+                   "\xd1\x8c \xc3\x9f \xe2\x80\x94 \xc3";
+  string folded(s.size(), ' ');
+  Analyzer::FoldCase(s.data(), s.size(), &folded[0]);
+  EXPECT_EQ("\xc3\xa4pfel, birnen \xd0\xb6\xd0\xb8\xd0\xb7\xd0\xbd"
+            "\xd1\x8c \xc3\x9f \xe2\x80\x94 \xc3", folded);
+}
+
+TEST_F(AnalyzerTest, Stem) {
+  const vector<std::pair<string, string> > words = {
+    {"queries", "query"}, {"cities", "city"}, {"aies", "aie"},
+    {"horses", "horse"}, {"toes", "toe"}, {"cats", "cat"}, {"bus", "bus"},
+    {"virus", "virus"}, {"glass", "glass"}, {"tesla", "tesla"}, {"is", "is"},
+    {"gas", "gas"}
+  };
+  for (const auto& word: words) {
+    string stem = word.first;
+    stem.resize(Analyzer::Stem(&stem[0], stem.size()));
+    EXPECT_EQ(word.second, stem);
+  }
+}
+
+TEST_F(AnalyzerTest, Analyze) {
+  Analyzer analyzer;
+  EXPECT_FALSE(analyzer.Stemming());
+  EXPECT_EQ(0, analyzer.NumStopwords());
+  const string text = "The \xc3\x84pfel\xe2\x80\x94" "Birnen of Nikola Tesla's "
+                      "cities, a 2nd \xd0\x9c\xd0\x98\xd0\xa0!";
+  vector<Analyzer::Term> terms;
+  string buffer;
+  analyzer.Analyze(text.data(), text.size(), &terms, &buffer);
+  ASSERT_EQ(9, terms.size());
+  EXPECT_EQ("\xc3\x84pfel", text.substr(terms[1].pos, terms[1].size));
+  EXPECT_EQ("Tesla", text.substr(terms[5].pos, terms[5].size));
+  EXPECT_EQ(vector<string>({"the", "\xc3\xa4pfel", "birnen", "of", "nikola",
+                            "tesla", "cities", "2nd",
+                            "\xd0\xbc\xd0\xb8\xd1\x80"}),
+            Terms(analyzer, text));
+
+  analyzer.SetStemming(true);
+  analyzer.SetStopwords({"The", "OF", "a"});
+  EXPECT_TRUE(analyzer.Stemming());
+  EXPECT_EQ(3, analyzer.NumStopwords());
+  EXPECT_EQ(vector<string>({"\xc3\xa4pfel", "birnen", "nikola", "tesla",
+                            "city", "2nd", "\xd0\xbc\xd0\xb8\xd1\x80"}),
+            Terms(analyzer, text));
+  EXPECT_EQ(vector<string>(), Terms(analyzer, ""));
+}
+
+TEST_F(AnalyzerTest, Normalize) {
+  Analyzer analyzer;
+  analyzer.SetStemming(true);
+  string term;
+  analyzer.Normalize("Queries", 7u, &term);
+  EXPECT_EQ("query", term);
+  analyzer.Normalize("", 0u, &term);
+  EXPECT_EQ("", term);
+  analyzer.SetStopwords({"Cities"});
+  analyzer.Normalize("CITY", 4u, &term);
+  EXPECT_TRUE(analyzer.IsStopword(term.data(), term.size(),
+                                  PerfectHash::Hash(term.data(),
+                                                    term.size())));
+}
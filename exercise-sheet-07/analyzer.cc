@@ -0,0 +1,146 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include "./analyzer.h"
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "./perfect-hash.h"
+#include "./tokenizer.h"
+#include "./utf8.h"
+
+using std::string;
+using std::vector;
+
+// Returns whether the word of given size ends with the suffix.
+static inline bool EndsWith(const char* word, const size_t size,
+                            const char* suffix, const size_t suffix_size) {
+  return size >= suffix_size &&
+         std::memcmp(word + size - suffix_size, suffix, suffix_size) == 0;
+}
+
+// Folds the case of given string and returns whether it contains non-ASCII
+// bytes.
+static inline bool Fold(const char* s, const size_t size, char* dst) {
+  bool non_ascii = false;
+  size_t pos = 0u;
+  while (pos < size) {
+    const uint8_t c = s[pos];
+    if (c < 0x80u) {
+      dst[pos] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+      ++pos;
+      continue;
+    }
+    non_ascii = true;
+    size_t seq_size = 0u;
+    const uint32_t code_point = Utf8::Decode(s + pos, size - pos, &seq_size);
+    if (code_point == Utf8::kInvalid) {
+      // Keep invalid bytes.
+      dst[pos] = c;
+    } else {
+      Utf8::Encode(Utf8::Fold(code_point), dst + pos);
+    }
+    pos += seq_size;
+  }
+  return non_ascii;
+}
+
+void Analyzer::FoldCase(const char* s, const size_t size, char* dst) {
+  Fold(s, size, dst);
+}
+
+size_t Analyzer::Stem(char* word, const size_t size) {
+  // Keep short words.
+  if (size <= 3u) {
+    return size;
+  }
+  if (EndsWith(word, size, "ies", 3u) && !EndsWith(word, size, "eies", 4u) &&
+      !EndsWith(word, size, "aies", 4u)) {
+    word[size - 3u] = 'y';
+    return size - 2u;
+  }
+  if (EndsWith(word, size, "es", 2u) && !EndsWith(word, size, "aes", 3u) &&
+      !EndsWith(word, size, "ees", 3u) && !EndsWith(word, size, "oes", 3u)) {
+    return size - 1u;
+  }
+  if (EndsWith(word, size, "s", 1u) && !EndsWith(word, size, "us", 2u) &&
+      !EndsWith(word, size, "ss", 2u)) {
+    return size - 1u;
+  }
+  return size;
+}
+
+Analyzer::Analyzer(const size_t min_token_size)
+    : min_token_size_(min_token_size),
+      stemming_(false) {}
+
+void Analyzer::SetStemming(const bool stemming) {
+  stemming_ = stemming;
+}
+
+bool Analyzer::Stemming() const {
+  return stemming_;
+}
+
+void Analyzer::SetStopwords(const vector<string>& stopwords) {
+  stopwords_.clear();
+  string term;
+  for (const string& word: stopwords) {
+    Normalize(word.data(), word.size(), &term);
+    const uint64_t hash = PerfectHash::Hash(term.data(), term.size());
+    assert(stopwords_.count(hash) == 0 || stopwords_[hash] == term);
+    stopwords_[hash] = term;
+  }
+}
+
+size_t Analyzer::NumStopwords() const {
+  return stopwords_.size();
+}
+
+void Analyzer::Analyze(const char* s, const size_t size, vector<Term>* terms,
+                       string* buffer) const {
+  static thread_local vector<Tokenizer::Token> _tokens;
+
+  assert(terms && buffer);
+  Tokenizer::TokenizeUtf8(s, size, min_token_size_, &_tokens);
+  terms->clear();
+  size_t buffer_size = 0u;
+  for (const Tokenizer::Token& token: _tokens) {
+    buffer_size += token.size;
+  }
+  buffer->resize(buffer_size);
+  size_t term_pos = 0u;
+  for (const Tokenizer::Token& token: _tokens) {
+    char* term = &(*buffer)[term_pos];
+    const bool non_ascii = Fold(s + token.pos, token.size, term);
+    const size_t term_size = stemming_ ? Stem(term, token.size) : token.size;
+    // The token hash is case-insensitive for ASCII tokens.
+    const uint64_t hash = non_ascii || term_size != token.size ?
+                          PerfectHash::Hash(term, term_size) : token.hash;
+    if (stopwords_.size() && IsStopword(term, term_size, hash)) {
+      continue;
+    }
+    terms->push_back({token.pos, token.size, term_pos, term_size, hash});
+    term_pos += term_size;
+  }
+  buffer->resize(term_pos);
+}
+
+void Analyzer::Normalize(const char* word, const size_t size,
+                         string* term) const {
+  assert(term);
+  term->resize(size);
+  if (size == 0u) {
+    return;
+  }
+  Fold(word, size, &(*term)[0]);
+  if (stemming_) {
+    term->resize(Stem(&(*term)[0], size));
+  }
+}
+
+bool Analyzer::IsStopword(const char* term, const size_t size,
+                          const uint64_t hash) const {
+  auto const it = stopwords_.find(hash);
+  return it != stopwords_.end() && it->second.size() == size &&
+         std::memcmp(it->second.data(), term, size) == 0;
+}
@@ -0,0 +1,73 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#ifndef EXERCISE_SHEET_07_ANALYZER_H_
+#define EXERCISE_SHEET_07_ANALYZER_H_
+
+#include <cstdint>
+#include <unordered_map>
+#include <string>
+#include <vector>
+
+// Text analysis pipeline shared by indexing and query processing. The text is
+// split into Unicode-aware tokens, which are case folded, optionally stemmed
+// and filtered by a stopword list. The resulting terms are the keywords of the
+// index.
+class Analyzer {
+ public:
+  // A term given by the position and size of its token within the text and
+  // the position and size of its normalized form within the terms buffer.
+  // The hash equals PerfectHash::Hash of the normalized form.
+  struct Term {
+    size_t pos;
+    size_t size;
+    size_t term_pos;
+    size_t term_size;
+    uint64_t hash;
+  };
+
+  // Writes the case-folded version of given UTF-8 string to the destination.
+  // Folding keeps the size and positions of the string.
+  static void FoldCase(const char* s, const size_t size, char* dst);
+
+  // Strips the English plural suffix of given case-folded word following the
+  // S-stemmer by Harman (1991). Returns the new size of the word.
+  static size_t Stem(char* word, const size_t size);
+
+  // Initializes the analyzer with given minimum token size and without
+  // stemming and stopwords.
+  explicit Analyzer(const size_t min_token_size = 2u);
+
+  // Enables or disables stemming.
+  void SetStemming(const bool stemming);
+
+  // Returns whether stemming is enabled.
+  bool Stemming() const;
+
+  // Sets the words filtered from the terms. The stopwords are normalized
+  // using the current stemming setting.
+  void SetStopwords(const std::vector<std::string>& stopwords);
+
+  // Returns the number of stopwords.
+  size_t NumStopwords() const;
+
+  // Writes the terms of given text to the terms list and their normalized
+  // forms to the buffer, replacing the previous contents of both. Uses
+  // thread-local scratch space, there are no heap allocations given reused
+  // lists in steady state.
+  void Analyze(const char* s, const size_t size, std::vector<Term>* terms,
+               std::string* buffer) const;
+
+  // Writes the normalized form of given word to the term, i.e. the word is
+  // case folded and stemmed if enabled. The word is not tokenized.
+  void Normalize(const char* word, const size_t size, std::string* term) const;
+
+  // Returns whether the normalized term with given hash is a stopword.
+  bool IsStopword(const char* term, const size_t size,
+                  const uint64_t hash) const;
+
+ private:
+  size_t min_token_size_;
+  bool stemming_;
+  std::unordered_map<uint64_t, std::string> stopwords_;
+};
+
+#endif  // EXERCISE_SHEET_07_ANALYZER_H_
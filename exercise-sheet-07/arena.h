@@ -0,0 +1,128 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#ifndef EXERCISE_SHEET_07_ARENA_H_
+#define EXERCISE_SHEET_07_ARENA_H_
+
+#include <new>
+#include <cstdlib>
+#include <cassert>
+#include <vector>
+
+// Bump allocator handing out memory from large blocks. Deallocation is a
+// no-op, all memory is released at once by Reset, which keeps the blocks for
+// reuse. After a warm-up phase with peak usage no more heap allocations are
+// needed. Not thread-safe, use one arena per thread.
+class Arena {
+ public:
+  // The default block size in bytes.
+  static const size_t kDefBlockSize = 64u * 1024u;
+
+  // Initializes the arena, the first block is allocated on demand.
+  explicit Arena(const size_t block_size = kDefBlockSize)
+      : block_size_(block_size),
+        pos_(0u),
+        used_(0u) {}
+
+  ~Arena() {
+    for (char* block: blocks_) {
+      std::free(block);
+    }
+  }
+
+  // Returns a pointer to size bytes of memory with given alignment.
+  void* Allocate(const size_t size, const size_t align) {
+    assert(align && (align & (align - 1u)) == 0);
+    pos_ = (pos_ + align - 1u) & ~(align - 1u);
+    if (blocks_.empty() || pos_ + size > block_sizes_.back()) {
+      // The current block is exhausted, add a new one.
+      NewBlock(size);
+      pos_ = 0u;
+    }
+    void* mem = blocks_.back() + pos_;
+    pos_ += size;
+    used_ += size;
+    return mem;
+  }
+
+  // Releases all allocated memory. Multiple blocks are merged into a single
+  // one, which is large enough for the peak usage seen so far.
+  void Reset() {
+    if (blocks_.size() > 1u) {
+      size_t total_size = 0u;
+      for (size_t i = 0; i < blocks_.size(); ++i) {
+        total_size += block_sizes_[i];
+        std::free(blocks_[i]);
+      }
+      blocks_.clear();
+      block_sizes_.clear();
+      NewBlock(total_size);
+    }
+    pos_ = 0u;
+    used_ = 0u;
+  }
+
+  // Returns the number of bytes allocated since the last reset.
+  size_t Used() const {
+    return used_;
+  }
+
+ private:
+  // Appends a block of at least given size.
+  void NewBlock(const size_t min_size) {
+    const size_t size = min_size > block_size_ ? min_size : block_size_;
+    char* block = static_cast<char*>(std::malloc(size));
+    if (!block) {
+      throw std::bad_alloc();
+    }
+    blocks_.push_back(block);
+    block_sizes_.push_back(size);
+  }
+
+  std::vector<char*> blocks_;
+  std::vector<size_t> block_sizes_;
+  size_t block_size_;
+  size_t pos_;
+  size_t used_;
+};
+
+// STL allocator adapter for the arena, used for scratch containers.
+template<typename T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+
+  explicit ArenaAllocator(Arena* arena)
+      : arena_(arena) {}
+
+  template<typename U>
+  ArenaAllocator(const ArenaAllocator<U>& rhs)  // NOLINT
+      : arena_(rhs.arena()) {}
+
+  T* allocate(const size_t n) {
+    return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T*, size_t) {}
+
+  template<typename U>
+  bool operator==(const ArenaAllocator<U>& rhs) const {
+    return arena_ == rhs.arena();
+  }
+
+  template<typename U>
+  bool operator!=(const ArenaAllocator<U>& rhs) const {
+    return arena_ != rhs.arena();
+  }
+
+  Arena* arena() const {
+    return arena_;
+  }
+
+ private:
+  Arena* arena_;
+};
+
+// Vector type with arena-backed storage.
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+#endif  // EXERCISE_SHEET_07_ARENA_H_
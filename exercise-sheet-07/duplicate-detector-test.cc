@@ -0,0 +1,127 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <vector>
+#include "./duplicate-detector.h"
+
+using std::vector;
+
+class DuplicateDetectorTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    for (uint64_t i = 0; i < 200u; ++i) {
+      hashes_.push_back((i + 1u) * 0x9e3779b97f4a7c15ull);
+    }
+  }
+
+  void TearDown() {
+  }
+
+  // Returns the signature of the term hashes [beg, end).
+  vector<uint32_t> Sketch(const size_t beg, const size_t end) const {
+    vector<uint32_t> signature;
+    DuplicateDetector::Sketch(hashes_.data() + beg, end - beg, &signature);
+    return signature;
+  }
+
+  vector<uint64_t> hashes_;
+};
+
+TEST_F(DuplicateDetectorTest, Sketch) {
+  const vector<uint32_t> signature = Sketch(0u, 100u);
+  ASSERT_EQ(DuplicateDetector::kNumHashes, signature.size());
+  EXPECT_EQ(signature, Sketch(0u, 100u));
+  EXPECT_EQ(1.0f, DuplicateDetector::Similarity(&signature[0], &signature[0]));
+  // The term order matters within the shingles.
+  vector<uint64_t> reversed(hashes_.rbegin() + 100u, hashes_.rend());
+  vector<uint32_t> reversed_signature;
+  DuplicateDetector::Sketch(reversed.data(), reversed.size(),
+                            &reversed_signature);
+  EXPECT_GT(0.2f, DuplicateDetector::Similarity(&signature[0],
+                                                &reversed_signature[0]));
+  // Records shorter than a shingle are sketched as well.
+  EXPECT_NE(Sketch(0u, 1u), Sketch(1u, 2u));
+  EXPECT_EQ(Sketch(0u, 2u), Sketch(0u, 2u));
+}
+
+TEST_F(DuplicateDetectorTest, Similarity) {
+  // The shingle sets of [0, 100) and [s, 100 + s) share 98 - s of 98 + s
+  // shingles.
+  const vector<uint32_t> signature = Sketch(0u, 100u);
+  for (const size_t shift: {2u, 10u, 30u, 60u}) {
+    const vector<uint32_t> shifted = Sketch(shift, 100u + shift);
+    const float jaccard = (98.0f - shift) / (98.0f + shift);
+    EXPECT_NEAR(jaccard, DuplicateDetector::Similarity(&signature[0],
+                                                       &shifted[0]), 0.15f);
+  }
+  // Disjoint records.
+  const vector<uint32_t> other = Sketch(100u, 200u);
+  EXPECT_GT(0.1f, DuplicateDetector::Similarity(&signature[0], &other[0]));
+}
+
+TEST_F(DuplicateDetectorTest, Add) {
+  DuplicateDetector detector(0.8f);
+  EXPECT_EQ(8u, detector.NumBands());
+  EXPECT_EQ(DuplicateDetector::kInvalidId, detector.Add(10, Sketch(0u, 100u)));
+  EXPECT_EQ(DuplicateDetector::kInvalidId,
+            detector.Add(11, Sketch(100u, 200u)));
+  // Exact and near duplicates refer to the earliest original.
+  EXPECT_EQ(10, detector.Add(12, Sketch(0u, 100u)));
+  EXPECT_EQ(10, detector.Add(13, Sketch(1u, 100u)));
+  EXPECT_EQ(11, detector.Add(14, Sketch(100u, 199u)));
+  EXPECT_EQ(DuplicateDetector::kInvalidId,
+            detector.Add(15, Sketch(50u, 150u)));
+  // Duplicates are not added.
+  EXPECT_EQ(3u, detector.NumRecords());
+  // Only equal signatures match the threshold 1.
+  DuplicateDetector exact(1.0f);
+  EXPECT_EQ(1u, exact.NumBands());
+  EXPECT_EQ(DuplicateDetector::kInvalidId, exact.Add(0, Sketch(0u, 100u)));
+  EXPECT_EQ(DuplicateDetector::kInvalidId, exact.Add(1, Sketch(10u, 100u)));
+  EXPECT_EQ(0, exact.Add(2, Sketch(0u, 100u)));
+}
+
+TEST_F(DuplicateDetectorTest, BandCollision) {
+  // The first two rows have equal band hashes, each band is a single row.
+  DuplicateDetector detector(0.1f);
+  ASSERT_EQ(64u, detector.NumBands());
+  vector<uint32_t> signature(DuplicateDetector::kNumHashes);
+  for (size_t i = 0; i < signature.size(); ++i) {
+    signature[i] = i;
+  }
+  signature[0] = 3668305845u;
+  signature[1] = 3056009664u;
+  EXPECT_EQ(DuplicateDetector::kInvalidId, detector.Add(0, signature));
+  // Shares the second band only, the band chains are traversed.
+  vector<uint32_t> other(DuplicateDetector::kNumHashes);
+  for (size_t i = 0; i < other.size(); ++i) {
+    other[i] = 100u + i;
+  }
+  other[1] = signature[1];
+  EXPECT_EQ(DuplicateDetector::kInvalidId, detector.Add(1, other));
+  EXPECT_EQ(0, detector.Add(2, signature));
+  EXPECT_EQ(1, detector.Add(3, other));
+  EXPECT_EQ(2u, detector.NumRecords());
+}
+
+TEST_F(DuplicateDetectorTest, ManyRecords) {
+  // The band table grows, all originals remain retrievable.
+  DuplicateDetector detector(0.9f);
+  vector<uint64_t> hashes(20u);
+  vector<uint32_t> signature;
+  for (int r = 0; r < 2000; ++r) {
+    for (size_t i = 0; i < hashes.size(); ++i) {
+      hashes[i] = (r * hashes.size() + i + 1u) * 0xc4ceb9fe1a85ec53ull;
+    }
+    DuplicateDetector::Sketch(hashes.data(), hashes.size(), &signature);
+    ASSERT_EQ(DuplicateDetector::kInvalidId, detector.Add(r, signature));
+  }
+  for (int r = 0; r < 2000; r += 100) {
+    for (size_t i = 0; i < hashes.size(); ++i) {
+      hashes[i] = (r * hashes.size() + i + 1u) * 0xc4ceb9fe1a85ec53ull;
+    }
+    DuplicateDetector::Sketch(hashes.data(), hashes.size(), &signature);
+    EXPECT_EQ(r, detector.Add(2000 + r, signature));
+  }
+  EXPECT_EQ(2000u, detector.NumRecords());
+}
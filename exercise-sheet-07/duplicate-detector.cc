@@ -0,0 +1,187 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include "./duplicate-detector.h"
+#include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+using std::vector;
+
+const int DuplicateDetector::kInvalidId = -1;
+const size_t DuplicateDetector::kNumHashes = 64u;
+const size_t DuplicateDetector::kShingleSize = 3u;
+
+static const uint64_t kMul = 0x9e3779b97f4a7c15ull;
+
+// Added per bin of distance to the values borrowed by empty bins, so that
+// records with different empty bins are unlikely to match.
+static const uint32_t kDensifyOffset = 0x9e3779b9u;
+
+// Mixes the given hash using the Murmur3 finalizer.
+static inline uint64_t Mix(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// The initial number of slots of the band table, a power of two.
+static const size_t kInitialNumSlots = 1024u;
+
+// Returns the hash of the given rows of the band with given index.
+static inline uint32_t BandHash(const size_t band, const uint32_t* rows,
+                                const size_t num_rows) {
+  uint64_t hash = (band + 1u) * kMul;
+  for (size_t r = 0; r < num_rows; ++r) {
+    hash = (hash ^ rows[r]) * kMul;
+    hash ^= hash >> 32;
+  }
+  return hash >> 32;
+}
+
+void DuplicateDetector::Sketch(const uint64_t* hashes, const size_t size,
+                               vector<uint32_t>* signature) {
+  static const uint32_t kEmpty = std::numeric_limits<uint32_t>::max();
+
+  assert(signature);
+  // Bins keeping the maximum value count as empty, which is harmless.
+  signature->assign(kNumHashes, kEmpty);
+  uint32_t* const bins = &(*signature)[0];
+  const size_t shingle_size = std::min(size, kShingleSize);
+  for (size_t i = 0; i + shingle_size <= size && shingle_size; ++i) {
+    // The shingle hash depends on the order of its terms.
+    uint64_t hash = hashes[i];
+    for (size_t j = 1; j < shingle_size; ++j) {
+      hash = hash * kMul + hashes[i + j];
+    }
+    hash = Mix(hash);
+    // The upper half selects the bin, the lower half is the value.
+    const size_t bin = ((hash >> 32) * kNumHashes) >> 32;
+    bins[bin] = std::min(bins[bin], static_cast<uint32_t>(hash));
+  }
+  // Each empty bin borrows the value of the next non-empty bin to the right,
+  // circularly, i.e. the first one is the successor of the last bin.
+  size_t next = 0u;
+  while (next < kNumHashes && bins[next] == kEmpty) {
+    ++next;
+  }
+  if (next == kNumHashes) {
+    return;
+  }
+  next += kNumHashes;
+  for (size_t bin = kNumHashes; bin-- > 0u;) {
+    if (bins[bin] != kEmpty) {
+      next = bin;
+    } else {
+      const size_t next_bin = next < kNumHashes ? next : next - kNumHashes;
+      bins[bin] = bins[next_bin] + (next - bin) * kDensifyOffset;
+    }
+  }
+}
+
+float DuplicateDetector::Similarity(const uint32_t* signature1,
+                                    const uint32_t* signature2) {
+  size_t num_equal = 0u;
+  for (size_t i = 0; i < kNumHashes; ++i) {
+    num_equal += signature1[i] == signature2[i];
+  }
+  return static_cast<float>(num_equal) / kNumHashes;
+}
+
+DuplicateDetector::DuplicateDetector(const float threshold)
+    : threshold_(threshold),
+      num_rows_(1u),
+      slots_(kInitialNumSlots, Slot()),
+      num_slots_used_(0u) {
+  assert(threshold > 0.0f && threshold <= 1.0f);
+  // Records of similarity s collide with probability 1 - (1 - s^r)^b for b
+  // bands of r rows, which rises steepest at about (1 / b)^(1 / r). Use the
+  // most rows with the rise below the threshold.
+  for (size_t num_rows = 1u; num_rows <= kNumHashes; num_rows *= 2u) {
+    const float num_bands = kNumHashes / num_rows;
+    if (std::pow(1.0f / num_bands, 1.0f / num_rows) <= threshold) {
+      num_rows_ = num_rows;
+    }
+  }
+  num_bands_ = kNumHashes / num_rows_;
+}
+
+int DuplicateDetector::Add(const int id, const vector<uint32_t>& signature) {
+  static thread_local vector<uint32_t> _hashes;
+  static thread_local vector<Slot*> _slots;
+
+  assert(signature.size() == kNumHashes);
+  // Make room for all bands, so that the slots remain valid.
+  while (2u * (num_slots_used_ + num_bands_) > slots_.size()) {
+    Grow();
+  }
+  _hashes.resize(num_bands_);
+  _slots.resize(num_bands_);
+  // The positions are in the order of addition, keep the first match.
+  uint32_t best = ids_.size();
+  for (size_t b = 0; b < num_bands_; ++b) {
+    _hashes[b] = BandHash(b, &signature[b * num_rows_], num_rows_);
+    _slots[b] = &FindSlot(b, _hashes[b]);
+    for (uint32_t next = _slots[b]->head; next;
+         next = next_[(next - 1u) * num_bands_ + b]) {
+      const uint32_t pos = next - 1u;
+      if (pos < best &&
+          Similarity(&signatures_[pos * kNumHashes], &signature[0]) >=
+          threshold_) {
+        best = pos;
+      }
+    }
+  }
+  if (best < ids_.size()) {
+    return ids_[best];
+  }
+  const uint32_t pos = ids_.size();
+  ids_.push_back(id);
+  signatures_.insert(signatures_.end(), signature.begin(), signature.end());
+  for (size_t b = 0; b < num_bands_; ++b) {
+    Slot& slot = *_slots[b];
+    if (slot.head == 0u) {
+      slot.hash = _hashes[b];
+      slot.band = b;
+      ++num_slots_used_;
+    }
+    next_.push_back(slot.head);
+    slot.head = pos + 1u;
+  }
+  return kInvalidId;
+}
+
+auto DuplicateDetector::FindSlot(const size_t band, const uint32_t hash)
+    -> Slot& {
+  const size_t mask = slots_.size() - 1u;
+  size_t i = hash & mask;
+  while (slots_[i].head && (slots_[i].hash != hash || slots_[i].band != band)) {
+    i = (i + 1u) & mask;
+  }
+  return slots_[i];
+}
+
+void DuplicateDetector::Grow() {
+  vector<Slot> slots(2u * slots_.size(), Slot());
+  slots.swap(slots_);
+  for (const Slot& slot: slots) {
+    if (slot.head) {
+      FindSlot(slot.band, slot.hash) = slot;
+    }
+  }
+}
+
+float DuplicateDetector::Threshold() const {
+  return threshold_;
+}
+
+size_t DuplicateDetector::NumBands() const {
+  return num_bands_;
+}
+
+size_t DuplicateDetector::NumRecords() const {
+  return ids_.size();
+}
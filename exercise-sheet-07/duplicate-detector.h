@@ -0,0 +1,93 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#ifndef EXERCISE_SHEET_07_DUPLICATE_DETECTOR_H_
+#define EXERCISE_SHEET_07_DUPLICATE_DETECTOR_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Streaming near-duplicate detection for records given by their term hashes.
+// A record is represented by the set of its shingles, i.e. runs of
+// kShingleSize consecutive terms, and sketched by one permutation MinHash
+// following Li et al. (2012): each shingle hash is mapped to one of
+// kNumHashes bins, which keeps the minimum, empty bins borrow the value of the
+// next non-empty bin following Shrivastava and Li (2014). The fraction of
+// equal bins of two signatures estimates the Jaccard similarity of the
+// shingle sets. Sketching takes a single hash per shingle.
+//
+// Candidates are found by LSH banding: the signatures are split into bands of
+// rows and records sharing all rows of any band collide. The number of rows is
+// chosen such that the collision probability of records with the threshold
+// similarity is high, the candidates are verified by their signatures.
+class DuplicateDetector {
+ public:
+  // Invalid id value, returned for records without duplicate.
+  static const int kInvalidId;
+
+  // The number of MinHash bins per signature.
+  static const size_t kNumHashes;
+
+  // The number of consecutive terms per shingle.
+  static const size_t kShingleSize;
+
+  // Writes the signature of kNumHashes values for given term hashes, see
+  // Analyzer::Term. Records with fewer terms than the shingle size form a
+  // single shingle.
+  static void Sketch(const uint64_t* hashes, const size_t size,
+                     std::vector<uint32_t>* signature);
+
+  // Returns the estimated Jaccard similarity of the given signatures.
+  static float Similarity(const uint32_t* signature1,
+                          const uint32_t* signature2);
+
+  // Initializes the detector for given Jaccard similarity threshold in
+  // (0, 1], a threshold of 1 only detects records with equal signatures.
+  explicit DuplicateDetector(const float threshold = 1.0f);
+
+  // Returns the id of the earliest added record with at least the threshold
+  // similarity to the given signature. Otherwise, adds the record with given
+  // id and returns kInvalidId, i.e. duplicates are not added and later records
+  // are only compared with the originals.
+  int Add(const int id, const std::vector<uint32_t>& signature);
+
+  // Returns the similarity threshold.
+  float Threshold() const;
+
+  // Returns the number of bands of the signatures.
+  size_t NumBands() const;
+
+  // Returns the number of records added.
+  size_t NumRecords() const;
+
+ private:
+  // A slot of the band table, holding a band, its hash and the last added
+  // record position with that hash in the band plus one, 0 for empty slots.
+  // Records of colliding band hashes share the slot, the candidates are
+  // verified anyway, but the bands never share slots.
+  struct Slot {
+    uint32_t hash;
+    uint32_t band;
+    uint32_t head;
+  };
+
+  // Returns the slot of given band and hash, which is empty if it is new.
+  Slot& FindSlot(const size_t band, const uint32_t hash);
+
+  // Doubles the band table size and reinserts all slots.
+  void Grow();
+
+  float threshold_;
+  size_t num_rows_;
+  size_t num_bands_;
+  // The ids and the consecutive signatures of the added records.
+  std::vector<int> ids_;
+  std::vector<uint32_t> signatures_;
+  // The open addressing table of the band hashes of all bands with linear
+  // probing. The earlier records with equal band hash are chained, the next
+  // position plus one is stored per record and band.
+  std::vector<Slot> slots_;
+  size_t num_slots_used_;
+  std::vector<uint32_t> next_;
+};
+
+#endif  // EXERCISE_SHEET_07_DUPLICATE_DETECTOR_H_
@@ -135,6 +135,299 @@ TEST_F(IndexTest, GoogleItems) {
             items);
 }
 
+TEST_F(IndexTest, Prefix) {
+  index_.BuildPrefixIndex(1u, 3u);
+  const vector<int> ids = index_.PrefixKeywordIds("Hon");
+  ASSERT_EQ(2, ids.size());
+  EXPECT_EQ("honors", index_.KeywordName(ids[0]));
+  EXPECT_EQ("honoured", index_.KeywordName(ids[1]));
+  EXPECT_EQ(0, index_.PrefixKeywordIds("honx").size());
+  EXPECT_EQ(3, index_.PrefixKeywordIds("ho").size());
+  EXPECT_EQ(vector<Index::Item>({ {1, {11}, 6, 0.0f}, {2, {11}, 6, 0.0f},
+                                  {2, {25}, 8, 0.0f} }),
+            index_.PrefixItems("hon"));
+  EXPECT_EQ(vector<Index::Item>({ {2, {116}, 4, 0.0f}, {2, {11}, 6, 0.0f},
+                                  {2, {25}, 8, 0.0f} }),
+            index_.TopPrefixItems("Ho"));
+  EXPECT_EQ(vector<Index::Item>({ {2, {11}, 6, 0.0f}, {2, {25}, 8, 0.0f} }),
+            index_.TopPrefixItems("hon"));
+  EXPECT_EQ(0, index_.TopPrefixItems("hom").size());
+  EXPECT_EQ(0, index_.TopPrefixItems("honx").size());
+}
+
+TEST_F(IndexTest, PrefixWithoutTopItems) {
+  // Without top records, only the sorted keywords are built.
+  index_.BuildPrefixIndex(0u, 1u);
+  EXPECT_EQ(3, index_.PrefixKeywordIds("ho").size());
+  EXPECT_EQ(3, index_.PrefixItems("hon").size());
+  EXPECT_EQ(0, index_.TopPrefixItems("Ho").size());
+  EXPECT_EQ(0, index_.TopPrefixItems("hon").size());
+  // Updates keep the keywords sorted.
+  index_.UpdateRecord(4, "Thomas_Edison1", "Edison invented the phonograph.");
+  EXPECT_EQ(vector<int>({index_.KeywordId("phonograph")}),
+            index_.PrefixKeywordIds("phon"));
+  EXPECT_EQ(0, index_.TopPrefixItems("phon").size());
+}
+
+TEST_F(IndexTest, FrozenKeywords) {
+  const size_t num_keywords = index_.NumKeywords();
+  vector<int> ids;
+  for (size_t id = 0; id < num_keywords; ++id) {
+    ids.push_back(index_.KeywordId(index_.KeywordName(id)));
+  }
+  const vector<Index::Item> items = index_.Items("tesla");
+  index_.FreezeKeywords();
+  ASSERT_TRUE(index_.KeywordsFrozen());
+  for (size_t id = 0; id < num_keywords; ++id) {
+    EXPECT_EQ(ids[id], index_.KeywordId(index_.KeywordName(id)));
+  }
+  EXPECT_EQ(items, index_.Items("tesla"));
+  EXPECT_EQ(items, index_.Items("TeSLA"));
+  EXPECT_EQ(Index::kInvalidId, index_.KeywordId("teslas"));
+  EXPECT_EQ(Index::kInvalidId, index_.KeywordId("tesl"));
+  EXPECT_EQ(Index::kInvalidId, index_.KeywordId("Nebuchad"));
+  EXPECT_EQ(Index::kInvalidId, index_.KeywordId(""));
+  EXPECT_EQ(0, index_.Items("2009").size());
+  // Updates may add keywords to the frozen dictionary.
+  const int record_id = index_.UpdateRecord(4, "Thomas_Edison1",
+                                            "Edison invented the Phonograph.");
+  const int keyword_id = index_.KeywordId("phonograph");
+  ASSERT_NE(Index::kInvalidId, keyword_id);
+  EXPECT_LE(num_keywords, keyword_id);
+  EXPECT_EQ("phonograph", index_.KeywordName(keyword_id));
+  EXPECT_EQ(vector<Index::Item>({ {record_id, {20}, 10, 0.0f} }),
+            index_.Items("PHONOGRAPH"));
+  EXPECT_EQ(3, index_.Items("edison").size());
+  for (size_t id = 0; id < num_keywords; ++id) {
+    EXPECT_EQ(ids[id], index_.KeywordId(index_.KeywordName(id)));
+  }
+}
+
+TEST_F(IndexTest, FrozenCollisions) {
+  // Distinct keywords remain distinct, even if their base hashes are equal.
+  const vector<string> keywords = {"straße", "straÿe", "一二", "丠二"};
+  const vector<size_t> positions = {0u, 8u, 16u, 23u};
+  Index index;
+  index.AddRecordAndItems("Collisions", "straße straÿe 一二 丠二 tesla");
+  index.FreezeKeywords();
+  for (size_t i = 0; i < keywords.size(); ++i) {
+    ASSERT_EQ(1, index.Items(keywords[i]).size()) << keywords[i];
+    EXPECT_EQ(vector<size_t>({positions[i]}),
+              index.Items(keywords[i])[0].positions);
+  }
+  EXPECT_EQ(1, index.Items("tesla").size());
+  EXPECT_EQ(Index::kInvalidId, index.KeywordId("strasse"));
+}
+
+TEST_F(IndexTest, TokenSizes) {
+  Analyzer analyzer;
+  analyzer.SetStemming(true);
+  Index index;
+  index.SetAnalyzer(analyzer);
+  const string content = "Induction MOTORS and a motor";
+  index.AddRecordAndItems("Motors", content);
+  const vector<Index::Item>& items = index.Items("motor");
+  ASSERT_EQ(1, items.size());
+  EXPECT_EQ(vector<size_t>({10u, 23u}), items[0].positions);
+  EXPECT_EQ(5u, items[0].size);
+  // The matches are highlighted by their source tokens.
+  vector<Index::PosSize> matches = { {0u, 9u}, {10u, 5u}, {23u, 5u} };
+  index.SetTokenSizes(content, &matches);
+  EXPECT_EQ(9u, matches[0].size);
+  EXPECT_EQ(6u, matches[1].size);
+  EXPECT_EQ(5u, matches[2].size);
+}
+
+TEST_F(IndexTest, DeleteRecord) {
+  const size_t total_size = index_.TotalSize();
+  const size_t num_items = index_.NumItems();
+  const size_t record_size = index_.RecordSize(4);
+  EXPECT_FALSE(index_.IsDeleted(4));
+  EXPECT_TRUE(index_.DeleteRecord(4));
+  EXPECT_FALSE(index_.DeleteRecord(4));
+  EXPECT_TRUE(index_.IsDeleted(4));
+  EXPECT_FALSE(index_.IsDeleted(3));
+  EXPECT_FALSE(index_.IsDeleted(5));
+  EXPECT_EQ(1, index_.NumDeletedRecords());
+  EXPECT_EQ(urls_.size() - 1, index_.NumRecords());
+  EXPECT_EQ(total_size - record_size, index_.TotalSize());
+  // The items are only purged by the compaction.
+  EXPECT_EQ(2, index_.Items("Edison").size());
+  index_.Compact();
+  EXPECT_EQ(vector<Index::Item>({ {5, {77}, 6, 0.0f} }),
+            index_.Items("Edison"));
+  EXPECT_EQ(5, index_.Items("tesla").size());
+  EXPECT_EQ(0, index_.Items("haystack").size());
+  EXPECT_GT(num_items, index_.NumItems());
+  EXPECT_EQ(total_size - record_size, index_.TotalSize());
+  EXPECT_TRUE(index_.IsDeleted(4));
+  EXPECT_EQ("", index_.RecordById(4).url);
+  EXPECT_EQ(0, index_.RecordSize(4));
+  string content;
+  index_.RecordContent(5, &content);
+  EXPECT_EQ(0, content.find("The details of what happened"));
+}
+
+TEST_F(IndexTest, UpdateRecord) {
+  index_.BuildPrefixIndex(1u, 1u);
+  EXPECT_EQ(1, index_.TopPrefixItems("edi").size());
+  const int record_id = index_.UpdateRecord(4, "Thomas_Edison1",
+                                            "Edison invented the phonograph.");
+  EXPECT_EQ(urls_.size() - 1, record_id);
+  EXPECT_TRUE(index_.IsDeleted(4));
+  EXPECT_EQ(urls_.size(), index_.NumRecords());
+  EXPECT_EQ(vector<Index::Item>({ {4, {24}, 6, 0.0f}, {5, {77}, 6, 0.0f},
+                                  {record_id, {0}, 6, 0.0f} }),
+            index_.Items("Edison"));
+  // The prefix index lists the updated record before the compaction, ties
+  // are won by the later record.
+  ASSERT_EQ(1, index_.TopPrefixItems("edi").size());
+  EXPECT_EQ(record_id, index_.TopPrefixItems("edi")[0].record_id);
+  ASSERT_EQ(1, index_.TopPrefixItems("phon").size());
+  EXPECT_EQ(record_id, index_.TopPrefixItems("phon")[0].record_id);
+  EXPECT_EQ(vector<int>({index_.KeywordId("phonograph")}),
+            index_.PrefixKeywordIds("phon"));
+  EXPECT_EQ(vector<Index::Item>({ {record_id, {20}, 10, 0.0f} }),
+            index_.PrefixItems("phon"));
+  index_.Compact();
+  EXPECT_EQ(vector<Index::Item>({ {5, {77}, 6, 0.0f},
+                                  {record_id, {0}, 6, 0.0f} }),
+            index_.Items("Edison"));
+  ASSERT_EQ(1, index_.TopPrefixItems("edi").size());
+  EXPECT_EQ(record_id, index_.TopPrefixItems("edi")[0].record_id);
+  EXPECT_EQ(1, index_.Items("phonograph").size());
+}
+
+TEST_F(IndexTest, UpdatedScores) {
+  // The scores of an updated record equal its scores in a rebuilt index.
+  // The CSV contents keep the line breaks.
+  const string content = "Edison invented the phonograph and a tesla coil.\n";
+  Index index;
+  Index::AddRecordsFromCsv(sentences_, &index);
+  index.ComputeScores(0.75f, 1.75f);
+  const int record_id = index.UpdateRecord(4, "Thomas_Edison1", content);
+  string sentences;
+  size_t pos = 0;
+  for (size_t i = 0; i < urls_.size(); ++i) {
+    const size_t end = sentences_.find('\n', pos) + 1u;
+    if (i != 4) {
+      sentences += sentences_.substr(pos, end - pos);
+    }
+    pos = end;
+  }
+  sentences += "Thomas_Edison1\t" + content;
+  Index expected_index;
+  Index::AddRecordsFromCsv(sentences, &expected_index);
+  expected_index.ComputeScores(0.75f, 1.75f);
+  const int expected_id = expected_index.NumRecords() - 1;
+  EXPECT_EQ(expected_index.TotalSize(), index.TotalSize());
+  for (const string keyword: {"edison", "phonograph", "tesla", "coil"}) {
+    const vector<Index::Item>& expected = expected_index.Items(keyword);
+    const vector<Index::Item>& items = index.Items(keyword);
+    ASSERT_TRUE(expected.size() && items.size()) << keyword;
+    ASSERT_EQ(expected_id, expected.back().record_id);
+    ASSERT_EQ(record_id, items.back().record_id);
+    EXPECT_FLOAT_EQ(expected.back().score, items.back().score) << keyword;
+  }
+  // The compaction adjusts the scores of the other records.
+  index.Compact();
+  const vector<Index::Item>& expected = expected_index.Items("tesla");
+  const vector<Index::Item>& items = index.Items("tesla");
+  ASSERT_EQ(expected.size(), items.size());
+  for (size_t i = 0; i < items.size(); ++i) {
+    EXPECT_FLOAT_EQ(expected[i].score, items[i].score);
+  }
+}
+
+TEST_F(IndexTest, Duplicates) {
+  // The detection keeps the index of distinct records unchanged.
+  Index index;
+  index.SetDuplicateDetection(0.8f, false);
+  Index::AddRecordsFromCsv(sentences_, &index);
+  EXPECT_EQ(0, index.NumDuplicates());
+  ASSERT_EQ(index_.NumKeywords(), index.NumKeywords());
+  for (size_t k = 0; k < index_.NumKeywords(); ++k) {
+    EXPECT_EQ(index_.KeywordById(k).items, index.KeywordById(k).items);
+  }
+  // An exact duplicate, a near duplicate differing in the last word and a
+  // single-line duplicate of the multi-line record.
+  const string duplicates =
+      "Copy\tTesla once said that if Edison had to find a needle in a "
+      "haystack he would take apart the haystack one straw at a time.\n"
+      "Near\tThe details of what happened are not known but Tesla who had "
+      "once worked for Edison quit when he was promised a large bonus for "
+      "solving a problem and then after being successful was told the "
+      "promise was a prank.\n"
+      "Weird2\tME73 37signals Roogla!44 mac\n";
+  Index::AddRecordsFromCsv(duplicates, &index);
+  EXPECT_EQ(3, index.NumDuplicates());
+  EXPECT_EQ(4, index.DuplicateOf(7));
+  EXPECT_EQ(5, index.DuplicateOf(8));
+  EXPECT_EQ(6, index.DuplicateOf(9));
+  EXPECT_EQ(Index::kInvalidId, index.DuplicateOf(4));
+  // Flagged duplicates are indexed.
+  EXPECT_EQ(2, index.Items("haystack").size());
+  // Collapsed duplicates are deleted without items.
+  Index collapsed;
+  collapsed.SetDuplicateDetection(0.8f, true);
+  Index::AddRecordsFromCsv(sentences_ + duplicates, &collapsed);
+  EXPECT_EQ(3, collapsed.NumDuplicates());
+  EXPECT_EQ(3, collapsed.NumDeletedRecords());
+  EXPECT_TRUE(collapsed.IsDeleted(8));
+  EXPECT_EQ(5, collapsed.DuplicateOf(8));
+  EXPECT_EQ(1, collapsed.Items("haystack").size());
+  EXPECT_EQ(index_.NumItems(), collapsed.NumItems());
+}
+
+TEST_F(IndexTest, DeletedTopPrefixItems) {
+  index_.ComputeScores(0.75f, 1.75f);
+  index_.BuildPrefixIndex(1u, 1u);
+  ASSERT_EQ(1, index_.TopPrefixItems("edi").size());
+  const int record_id = index_.TopPrefixItems("edi")[0].record_id;
+  const int other_id = record_id == 4 ? 5 : 4;
+  // The top records are recomputed without the deleted record.
+  index_.DeleteRecord(record_id);
+  ASSERT_EQ(1, index_.TopPrefixItems("edi").size());
+  EXPECT_EQ(other_id, index_.TopPrefixItems("edi")[0].record_id);
+  index_.DeleteRecord(other_id);
+  EXPECT_EQ(0, index_.TopPrefixItems("edi").size());
+}
+
+TEST_F(IndexTest, DeletedScores) {
+  // The scores after a deletion equal the scores of an index, which never
+  // contained the deleted record.
+  Index index;
+  Index::AddRecordsFromCsv(sentences_, &index);
+  index.DeleteRecord(2);
+  index.ComputeScores(0.75f, 1.75f);
+  string sentences;
+  size_t pos = 0;
+  for (size_t i = 0; i < urls_.size(); ++i) {
+    const size_t end = sentences_.find('\n', pos) + 1u;
+    if (i != 2) {
+      sentences += sentences_.substr(pos, end - pos);
+    }
+    pos = end;
+  }
+  Index expected_index;
+  Index::AddRecordsFromCsv(sentences, &expected_index);
+  expected_index.ComputeScores(0.75f, 1.75f);
+  EXPECT_EQ(expected_index.TotalSize(), index.TotalSize());
+  for (const string keyword: {"tesla", "legacy", "honors", "edison"}) {
+    const vector<Index::Item>& expected = expected_index.Items(keyword);
+    vector<Index::Item> items;
+    for (const Index::Item& item: index.Items(keyword)) {
+      if (!index.IsDeleted(item.record_id)) {
+        items.push_back(item);
+      }
+    }
+    ASSERT_EQ(expected.size(), items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+      EXPECT_FLOAT_EQ(expected[i].score, items[i].score) << keyword;
+    }
+  }
+}
+
 TEST_F(IndexTest, NGrams) {
   EXPECT_EQ(vector<string>({}), Index::NGrams("", 2));
   EXPECT_EQ(vector<string>({}), Index::NGrams("", 3));
@@ -2,6 +2,7 @@
 #include "./index.h"
 #include <unordered_map>
 #include <cassert>
+#include <cstring>
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -9,6 +10,11 @@
 #include <algorithm>
 #include <cmath>
 #include <queue>
+#include <functional>
+#include <utility>
+#include "./analyzer.h"
+#include "./tokenizer.h"
+#include "./utf8.h"
 
 using std::unordered_map;
 using std::string;
@@ -17,16 +23,46 @@ using std::vector;
 const int Index::kInvalidId = -1;
 const char* Index::kWhitespace = "\n\r\t ";
 
+// Returns the case-folded version of given string. The thread-local buffer
+// avoids an allocation per call and is valid until the next call.
+static const string& FoldedCase(const char* s, const size_t size) {
+  static thread_local string _folded;
+  _folded.resize(size);
+  if (size) {
+    Analyzer::FoldCase(s, size, &_folded[0]);
+  }
+  return _folded;
+}
+
+// Compares the given strings bytewise like std::string::compare.
+static inline int CompareNames(const char* lhs, const size_t lhs_size,
+                               const char* rhs, const size_t rhs_size) {
+  const int result = std::memcmp(lhs, rhs, std::min(lhs_size, rhs_size));
+  if (result) {
+    return result;
+  }
+  return lhs_size < rhs_size ? -1 : lhs_size > rhs_size;
+}
+
 size_t Index::kMinKeywordSize = 2;
+const size_t Index::kMinCachedPrefixItems = 1024u;
 uint8_t Index::kUtf8RepairReplace = '_';
 
+float Index::Bm25(const float freq, const float record_size,
+                  const float inv_avg_record_size, const float inv_record_freq,
+                  const float b, const float k) {
+  return freq * (k + 1.0f) /
+         (k * (1.0f - b + b * record_size * inv_avg_record_size) + freq) *
+         inv_record_freq;
+}
+
 int Index::RepairUtf8(string* s) {
   const uint8_t* end = reinterpret_cast<uint8_t*>(&(*s)[s->size()]);
   int num_repaired = 0;
 
   // Merges overlong sequences. Returns pointer to the next byte to be checked.
   auto Merge = [end, &num_repaired](uint8_t* seq_beg) -> uint8_t* {
-    static const vector<uint8_t> _len_map =
+    static const uint8_t _len_map[16] =
       {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 3, 4};
     uint8_t* c = seq_beg;
     // Number of leading 1s encode the sequence length.
@@ -64,20 +100,27 @@ int Index::RepairUtf8(string* s) {
 
   uint8_t* c = reinterpret_cast<uint8_t*>(&(*s)[0]);
   while (c < end) {
-    if (*c < 128) {
-      // ASCII, move on.
-      ++c;
-      continue;
-    }
-    uint8_t* next = Merge(c);
-    if (next == c) {
-      // Invalid sequence begin.
-      *c = kUtf8RepairReplace;
-      ++num_repaired;
-      ++next;
+    // Skip the blocks known to be valid, which is most of the content.
+    c += Utf8::ValidPrefix(reinterpret_cast<char*>(c), end - c);
+    // Check the next block byte-wise.
+    const uint8_t* block_end = end - c > static_cast<int>(Utf8::kBlockSize) ?
+                               c + Utf8::kBlockSize : end;
+    while (c < block_end) {
+      if (*c < 128) {
+        // ASCII, move on.
+        ++c;
+        continue;
+      }
+      uint8_t* next = Merge(c);
+      if (next == c) {
+        // Invalid sequence begin.
+        *c = kUtf8RepairReplace;
+        ++num_repaired;
+        ++next;
+      }
+      assert(next - c <= 4);
+      c = next;
     }
-    assert(next - c < 4);
-    c = next;
   }
   return num_repaired;
 }
@@ -101,40 +144,15 @@ vector<string> Index::Split(const string& content, const string& delims) {
 
 auto Index::ExtractKeywords(const string& content, const size_t beg,
                             const size_t end) -> vector<PosSize> {
-  using std::isalnum;
-
-  // Keyword density approximation.
-  static float _density = 1.0f / kMinKeywordSize;
-
-  const size_t content_size = content.size();
-  assert(beg < end && end <= content_size);
+  assert(beg < end && end <= content.size());
+  vector<Tokenizer::Token> tokens;
+  Tokenizer::TokenizeUtf8(content.data() + beg, end - beg, kMinKeywordSize,
+                          &tokens);
   vector<PosSize> keywords;
-  keywords.reserve(content_size * _density * 1.5f);
-  size_t pos = beg;
-  while (pos < end) {
-    // Found beginning of the next keyword (any alphanumeric character).
-    if (isalnum(content[pos])) {
-      bool valid = isalpha(content[pos]);
-      const size_t key_beg = pos;
-      ++pos;
-      while (pos < end && isalnum(content[pos])) {
-        valid = valid || isalpha(content[pos]);
-        ++pos;
-      }
-      // Found end of keyword.
-      const size_t keyword_size = pos - key_beg;
-      // Valid keyword need at least one alphabetic character and a certain
-      // minimum size.
-      if (valid && keyword_size >= kMinKeywordSize) {
-        keywords.push_back({key_beg, keyword_size});
-      }
-    }
-    ++pos;
+  keywords.reserve(tokens.size());
+  for (const Tokenizer::Token& token: tokens) {
+    keywords.push_back({beg + token.pos, token.size});
   }
-  // Update density approximation.
-  _density = (_density * 3.0f +
-             keywords.size() / static_cast<float>(content_size))
-            * 0.25f;
   return keywords;
 }
 
@@ -142,6 +160,7 @@ void Index::AddRecordsFromCsv(const string& file_content, Index* index) {
   const size_t content_size = file_content.size();
   string prev_url;
   int record_id = kInvalidId;
+  const bool detect = index->detect_duplicates_;
   size_t pos = 0;
   while (pos < content_size) {
     // Skip to second column after first tab.
@@ -159,29 +178,29 @@ void Index::AddRecordsFromCsv(const string& file_content, Index* index) {
     if (url != prev_url) {
       // New record found in file contents.
       assert(url.size());
+      if (detect && record_id != kInvalidId) {
+        index->AddBufferedItems(record_id);
+      }
       record_id = index->AddRecord(url, content);
       prev_url = url;
     } else {
       // Known record, add the content.
       offset = index->ExtendRecord(record_id, content);
     }
-    // Extract the keyword positions.
-    const vector<PosSize> keywords = ExtractKeywords(content, 0,
-                                                     content.size());
-    // Add each keyword from the content to the index.
-    for (auto it = keywords.cbegin(), end = keywords.cend();
-         it != end; ++it) {
-      // Extract the keyword string and add it to the index.
-      const string keyword = content.substr(it->pos, it->size);
-      int keyword_id = index->KeywordId(keyword);
-      if (keyword_id == kInvalidId) {
-        // New keyword.
-        keyword_id = index->AddKeyword(keyword);
-      }
-      index->AddItem(keyword_id, record_id, it->pos + offset);
+    // Extract the keywords directly from the file content. With duplicate
+    // detection, the items are added once the record is complete.
+    const char* record_content = file_content.data() + content_beg + 1;
+    if (detect) {
+      index->BufferContentTerms(record_content, content.size(), offset);
+    } else {
+      index->AddContentItems(record_id, record_content, content.size(),
+                             offset);
     }
     pos = content_end + 1;
   }
+  if (detect && record_id != kInvalidId) {
+    index->AddBufferedItems(record_id);
+  }
   // TODO(esawin): Should we call CalculateScores? This would degrade this
   // function to a constructor.
 }
@@ -320,10 +339,23 @@ vector<int> Index::Union(const vector<const vector<int>*>& lists,
 }
 
 Index::Index()
-    : num_items_(0u),
+    : analyzer_(kMinKeywordSize),
+      keyword_offsets_(1, 0u),
+      keywords_frozen_(false),
+      prefix_top_k_(0u),
+      prefix_min_items_(0u),
+      num_items_(0u),
       total_size_(0u),
+      scored_(false),
+      bm25_b_(0.0f),
+      bm25_k_(0.0f),
       ngram_n_(0),
-      last_ed_avg_duration_(0) {}
+      last_ed_avg_duration_(0),
+      num_deleted_(0u),
+      deleted_size_(0u),
+      detect_duplicates_(false),
+      collapse_duplicates_(false),
+      num_duplicates_(0u) {}
 
 vector<string> Index::ApproximateMatches(const std::string& query,
                                          const int max_ed) const {
@@ -350,7 +382,7 @@ vector<string> Index::ApproximateMatches(const std::string& query,
   size_t num_ed_calls = 0u;
   const Clock beg;
   for (size_t i = 0, num_keywords = keyword_ids.size(); i < num_keywords; ++i) {
-    const string& keyword = KeywordById(keyword_ids[i]);
+    const string keyword = KeywordName(keyword_ids[i]);
     // TODO(esawin): How to handle queries with wildcards?
     if (keyword_freqs[i] >= std::max(static_cast<int>(keyword.size()),
                                      query_size) - max_ed_n) {
@@ -365,19 +397,30 @@ vector<string> Index::ApproximateMatches(const std::string& query,
 }
 
 void Index::ComputeScores(const float b, const float k) {
-  const float num_records = NumRecords();
+  scored_ = true;
+  bm25_b_ = b;
+  bm25_k_ = k;
+  // The statistics only consider live records, the term frequency is given by
+  // the positions, so scores can be recomputed after deletions.
+  const float num_records = NumRecords() - num_deleted_;
   const float inv_avg_record_size = num_records / TotalSize();
   for (auto it = keywords_.begin(), end = keywords_.end(); it != end; ++it) {
     vector<Item>& items = it->items;
-    const float record_freq = items.size();
-    assert(record_freq >= 1.0f);
+    size_t num_live_items = items.size();
+    if (num_deleted_) {
+      for (const Item& item: items) {
+        num_live_items -= IsDeleted(item.record_id);
+      }
+    }
+    if (num_live_items == 0u) {
+      continue;
+    }
+    const float record_freq = num_live_items;
     const float inv_record_freq = std::log2(num_records / record_freq);
     for (auto it2 = items.begin(), end2 = items.end(); it2 != end2; ++it2) {
       Item& item = *it2;
-      const float record_size  = RecordById(item.record_id).content.size();
-      item.score = item.score * (k + 1.0f) /
-                   (k * (1.0f - b + b * record_size * inv_avg_record_size) +
-                    item.score) * inv_record_freq;
+      item.score = Bm25(item.positions.size(), RecordSize(item.record_id),
+                        inv_avg_record_size, inv_record_freq, b, k);
     }
   }
 }
@@ -388,27 +431,236 @@ void Index::BuildNGrams(const int ngram_n) {
 
   const size_t num_keywords = keywords_.size();
   for (size_t keyword_id = 0; keyword_id < num_keywords; ++keyword_id) {
-    const Keyword& keyword = KeywordById(keyword_id);
-    vector<string> ngrams = NGrams(keyword, ngram_n_);
+    vector<string> ngrams = NGrams(KeywordName(keyword_id), ngram_n_);
     for (const string& ngram: ngrams) {
       AddNGram(keyword_id, ngram);
     }
   }
 }
 
+void Index::BuildPrefixIndex(const size_t top_k, const size_t min_items) {
+  prefix_top_k_ = top_k;
+  prefix_min_items_ = min_items;
+  const size_t num_keywords = keywords_.size();
+  prefix_ids_.resize(num_keywords);
+  for (size_t i = 0; i < num_keywords; ++i) {
+    prefix_ids_[i] = i;
+  }
+  std::sort(prefix_ids_.begin(), prefix_ids_.end(),
+      [this](const int lhs, const int rhs) {
+    return CompareNames(KeywordNameData(lhs), KeywordNameSize(lhs),
+                        KeywordNameData(rhs), KeywordNameSize(rhs)) < 0;
+  });
+  // Cumulative item counts allow for constant time range item counting.
+  prefix_num_items_.assign(num_keywords + 1, 0u);
+  for (size_t i = 0; i < num_keywords; ++i) {
+    prefix_num_items_[i + 1] = prefix_num_items_[i] +
+                               keywords_[prefix_ids_[i]].items.size();
+  }
+
+  prefix_top_items_.clear();
+  if (top_k == 0u) {
+    return;
+  }
+  vector<float> record_scores(records_.size(), 0.0f);
+  vector<bool> record_touched(records_.size(), false);
+  const char* prev_name = 0;
+  size_t prev_name_size = 0u;
+  for (size_t i = 0; i < num_keywords; ++i) {
+    const char* name = KeywordNameData(prefix_ids_[i]);
+    const size_t name_size = KeywordNameSize(prefix_ids_[i]);
+    // Only prefixes longer than the common prefix with the previous keyword
+    // are new, the shorter ones have been visited already.
+    size_t common_size = 0u;
+    while (common_size < prev_name_size && common_size < name_size &&
+           prev_name[common_size] == name[common_size]) {
+      ++common_size;
+    }
+    prev_name = name;
+    prev_name_size = name_size;
+    for (size_t size = common_size + 1; size <= name_size; ++size) {
+      const string prefix(name, size);
+      const std::pair<size_t, size_t> range = PrefixRange(prefix);
+      if (prefix_num_items_[range.second] - prefix_num_items_[range.first] <
+          min_items) {
+        // Longer prefixes match even less items.
+        break;
+      }
+      ComputeTopPrefixItems(range, &record_scores, &record_touched,
+                            &prefix_top_items_[prefix]);
+    }
+  }
+}
+
+void Index::ComputeTopPrefixItems(const std::pair<size_t, size_t>& range,
+                                  vector<float>* record_scores,
+                                  vector<bool>* record_touched,
+                                  vector<Item>* top_items) const {
+  typedef std::pair<float, int> ScoreRecordPair;
+
+  // Accumulate the scores per record over all matching keywords.
+  vector<int> touched;
+  for (size_t p = range.first; p < range.second; ++p) {
+    for (const Item& item: keywords_[prefix_ids_[p]].items) {
+      if (IsDeleted(item.record_id)) {
+        continue;
+      }
+      if (!(*record_touched)[item.record_id]) {
+        (*record_touched)[item.record_id] = true;
+        touched.push_back(item.record_id);
+      }
+      (*record_scores)[item.record_id] += item.score;
+    }
+  }
+  vector<ScoreRecordPair> pairs;
+  pairs.reserve(touched.size());
+  for (const int record_id: touched) {
+    pairs.push_back({(*record_scores)[record_id], record_id});
+    (*record_scores)[record_id] = 0.0f;
+    (*record_touched)[record_id] = false;
+  }
+  const size_t num_top = std::min(prefix_top_k_, pairs.size());
+  std::partial_sort(pairs.begin(), pairs.begin() + num_top, pairs.end(),
+                    std::greater<ScoreRecordPair>());
+  // Collect the items of the top records, sorted by record id.
+  vector<int> top_records;
+  top_records.reserve(num_top);
+  for (size_t t = 0; t < num_top; ++t) {
+    top_records.push_back(pairs[t].second);
+  }
+  std::sort(top_records.begin(), top_records.end());
+  top_items->clear();
+  for (const int record_id: top_records) {
+    for (size_t p = range.first; p < range.second; ++p) {
+      const vector<Item>& items = keywords_[prefix_ids_[p]].items;
+      auto it = std::lower_bound(items.begin(), items.end(), record_id,
+          [](const Item& item, const int id) {
+        return item.record_id < id;
+      });
+      if (it != items.end() && it->record_id == record_id) {
+        top_items->push_back(*it);
+      }
+    }
+  }
+}
+
+std::pair<size_t, size_t> Index::PrefixRange(const string& prefix) const {
+  return PrefixRange(prefix.data(), prefix.size());
+}
+
+std::pair<size_t, size_t> Index::PrefixRange(const char* prefix,
+                                             const size_t size) const {
+  const string& low = FoldedCase(prefix, size);
+  const size_t prefix_size = low.size();
+  auto beg = std::lower_bound(prefix_ids_.begin(), prefix_ids_.end(), low,
+      [this](const int id, const string& p) {
+    return CompareNames(KeywordNameData(id), KeywordNameSize(id),
+                        p.data(), p.size()) < 0;
+  });
+  auto end = std::upper_bound(beg, prefix_ids_.end(), low,
+      [this, prefix_size](const string& p, const int id) {
+    return CompareNames(KeywordNameData(id),
+                        std::min(KeywordNameSize(id), prefix_size),
+                        p.data(), p.size()) > 0;
+  });
+  return std::make_pair(beg - prefix_ids_.begin(), end - prefix_ids_.begin());
+}
+
+vector<int> Index::PrefixKeywordIds(const string& prefix) const {
+  const std::pair<size_t, size_t> range = PrefixRange(prefix);
+  return vector<int>(prefix_ids_.begin() + range.first,
+                     prefix_ids_.begin() + range.second);
+}
+
+auto Index::PrefixItems(const string& prefix) const -> vector<Item> {
+  const std::pair<size_t, size_t> range = PrefixRange(prefix);
+  vector<Item> items;
+  items.reserve(prefix_num_items_[range.second] -
+                prefix_num_items_[range.first]);
+  for (size_t p = range.first; p < range.second; ++p) {
+    const vector<Item>& keyword_items = keywords_[prefix_ids_[p]].items;
+    items.insert(items.end(), keyword_items.begin(), keyword_items.end());
+  }
+  std::stable_sort(items.begin(), items.end(),
+      [](const Item& lhs, const Item& rhs) {
+    return lhs.record_id < rhs.record_id;
+  });
+  return items;
+}
+
+int Index::SortedKeywordId(const size_t pos) const {
+  assert(pos < prefix_ids_.size());
+  return prefix_ids_[pos];
+}
+
+auto Index::TopPrefixItems(const string& prefix) const -> const vector<Item>& {
+  return TopPrefixItems(prefix.data(), prefix.size());
+}
+
+auto Index::TopPrefixItems(const char* prefix, const size_t size) const
+    -> const vector<Item>& {
+  static const vector<Item> _kEmptyList;
+
+  auto it = prefix_top_items_.find(FoldedCase(prefix, size));
+  if (it == prefix_top_items_.end()) {
+    return _kEmptyList;
+  }
+  return it->second;
+}
+
+size_t Index::PrefixTopK() const {
+  return prefix_top_k_;
+}
+
 const Index::Record& Index::RecordById(const int record_id) const {
   assert(record_id >= 0 && record_id < static_cast<int>(records_.size()));
   return records_[record_id];
 }
 
+void Index::RecordContent(const int record_id, string* content) const {
+  record_store_.Content(record_id, content);
+}
+
+void Index::SetTokenSizes(const string& content,
+                          vector<PosSize>* matches) const {
+  static thread_local vector<Analyzer::Term> _terms;
+  static thread_local string _buffer;
+
+  assert(matches);
+  analyzer_.Analyze(content.data(), content.size(), &_terms, &_buffer);
+  auto term = _terms.cbegin();
+  for (PosSize& match: *matches) {
+    term = std::lower_bound(term, _terms.cend(), match.pos,
+        [](const Analyzer::Term& t, const size_t pos) {
+      return t.pos < pos;
+    });
+    if (term != _terms.cend() && term->pos == match.pos) {
+      match.size = term->size;
+    }
+  }
+}
+
+size_t Index::RecordSize(const int record_id) const {
+  return record_store_.ContentSize(record_id);
+}
+
+const RecordStore& Index::Records() const {
+  return record_store_;
+}
+
 Index::Record& Index::recordById(const int record_id) {
   assert(record_id >= 0 && record_id < static_cast<int>(records_.size()));
   return records_[record_id];
 }
 
 auto Index::Items(const string& keyword) const -> const vector<Item>& {
+  return Items(keyword.data(), keyword.size());
+}
+
+auto Index::Items(const char* keyword, const size_t size) const
+    -> const vector<Item>& {
   static const vector<Item> _kEmptyList;
-  const int id = KeywordId(keyword);
+  const int id = KeywordId(keyword, size);
   if (id == kInvalidId) {
     return _kEmptyList;
   }
@@ -416,9 +668,57 @@ auto Index::Items(const string& keyword) const -> const vector<Item>& {
 }
 
 int Index::KeywordId(const string& keyword) const {
-  string low = keyword;
-  std::transform(keyword.cbegin(), keyword.cend(), low.begin(), ::tolower);
-  auto const it = keyword_index_.find(low);
+  return KeywordId(keyword.data(), keyword.size());
+}
+
+int Index::KeywordId(const char* keyword, const size_t size) const {
+  const string& folded = FoldedCase(keyword, size);
+  if (keywords_frozen_) {
+    return FrozenKeywordId(folded.data(), folded.size(),
+                           PerfectHash::Hash(folded.data(), folded.size()));
+  }
+  auto const it = keyword_index_.find(folded);
+  if (it == keyword_index_.end()) {
+    return kInvalidId;
+  }
+  return it->second;
+}
+
+int Index::KeywordId(const char* keyword, const size_t size,
+                     const uint64_t hash) const {
+  static thread_local string _term;
+
+  if (keywords_frozen_) {
+    return FrozenKeywordId(keyword, size, hash);
+  }
+  // The term is normalized already.
+  _term.assign(keyword, size);
+  auto const it = keyword_index_.find(_term);
+  if (it == keyword_index_.end()) {
+    return kInvalidId;
+  }
+  return it->second;
+}
+
+int Index::FrozenKeywordId(const char* term, const size_t size,
+                           const uint64_t hash) const {
+  static thread_local string _term;
+
+  if (keyword_slots_.size()) {
+    const int id = keyword_slots_[keyword_hash_.Slot(hash)];
+    // The perfect hash maps unknown keywords to arbitrary slots, verify the
+    // match against the pool.
+    if (KeywordNameSize(id) == size &&
+        std::memcmp(KeywordNameData(id), term, size) == 0) {
+      return id;
+    }
+  }
+  if (keyword_index_.empty()) {
+    return kInvalidId;
+  }
+  // The keywords not covered by the perfect hash.
+  _term.assign(term, size);
+  auto const it = keyword_index_.find(_term);
   if (it == keyword_index_.end()) {
     return kInvalidId;
   }
@@ -426,16 +726,260 @@ int Index::KeywordId(const string& keyword) const {
 }
 
 int Index::AddRecord(const string& url, const string& content) {
-  // TODO(esawin): Check for duplicates.
-  records_.push_back({url, content});
+  records_.push_back({url});
+  record_store_.Add(content);
   total_size_ += content.size();
   return records_.size() - 1;
 }
 
+int Index::AddRecordAndItems(const string& url, const string& content) {
+  const int record_id = AddRecord(url, content);
+  AddContentItems(record_id, content.data(), content.size(), 0u);
+  return record_id;
+}
+
+void Index::AddContentItems(const int record_id, const char* content,
+                            const size_t size, const size_t offset) {
+  static thread_local vector<Analyzer::Term> _terms;
+  static thread_local string _buffer;
+
+  analyzer_.Analyze(content, size, &_terms, &_buffer);
+  AddTermItems(record_id, _terms, _buffer, offset);
+}
+
+void Index::AddTermItems(const int record_id,
+                         const vector<Analyzer::Term>& terms,
+                         const string& buffer, const size_t offset) {
+  // Add each keyword from the content to the index.
+  for (const Analyzer::Term& term: terms) {
+    const char* keyword = buffer.data() + term.term_pos;
+    int keyword_id = KeywordId(keyword, term.term_size, term.hash);
+    if (keyword_id == kInvalidId) {
+      // New keyword.
+      keyword_id = AddKeyword(string(keyword, term.term_size));
+    }
+    AddItem(keyword_id, record_id, term.pos + offset);
+  }
+}
+
+void Index::BufferContentTerms(const char* content, const size_t size,
+                               const size_t offset) {
+  static thread_local vector<Analyzer::Term> _terms;
+  static thread_local string _buffer;
+
+  if (buffered_terms_.empty() && offset == 0u) {
+    // The first content of the record, there is nothing to shift.
+    analyzer_.Analyze(content, size, &buffered_terms_, &buffered_buffer_);
+    return;
+  }
+  analyzer_.Analyze(content, size, &_terms, &_buffer);
+  const size_t buffer_offset = buffered_buffer_.size();
+  for (Analyzer::Term term: _terms) {
+    term.pos += offset;
+    term.term_pos += buffer_offset;
+    buffered_terms_.push_back(term);
+  }
+  buffered_buffer_ += _buffer;
+}
+
+void Index::AddBufferedItems(const int record_id) {
+  static thread_local vector<uint64_t> _hashes;
+  static thread_local vector<uint32_t> _signature;
+
+  // Records without terms are never duplicates.
+  if (buffered_terms_.size()) {
+    _hashes.clear();
+    for (const Analyzer::Term& term: buffered_terms_) {
+      _hashes.push_back(term.hash);
+    }
+    DuplicateDetector::Sketch(_hashes.data(), _hashes.size(), &_signature);
+    const int original_id = duplicate_detector_.Add(record_id, _signature);
+    if (original_id != kInvalidId) {
+      duplicate_of_.resize(record_id + 1u, kInvalidId);
+      duplicate_of_[record_id] = original_id;
+      ++num_duplicates_;
+    }
+    if (original_id != kInvalidId && collapse_duplicates_) {
+      DeleteRecord(record_id);
+      buffered_terms_.clear();
+    }
+  }
+  AddTermItems(record_id, buffered_terms_, buffered_buffer_, 0u);
+  buffered_terms_.clear();
+  buffered_buffer_.clear();
+}
+
+bool Index::DeleteRecord(const int record_id) {
+  assert(record_id >= 0 && static_cast<size_t>(record_id) < records_.size());
+  if (IsDeleted(record_id)) {
+    return false;
+  }
+  const size_t word = static_cast<size_t>(record_id) >> 6;
+  if (word >= deleted_.size()) {
+    deleted_.resize(word + 1u, 0u);
+  }
+  deleted_[word] |= uint64_t(1u) << (record_id & 63);
+  ++num_deleted_;
+  deleted_size_ += RecordSize(record_id);
+  // Recompute the precomputed top records of the prefixes listing the record,
+  // so that they remain the best live records.
+  vector<float> record_scores;
+  vector<bool> record_touched;
+  for (auto& entry: prefix_top_items_) {
+    vector<Item>& top_items = entry.second;
+    auto it = std::lower_bound(top_items.begin(), top_items.end(), record_id,
+        [](const Item& item, const int id) {
+      return item.record_id < id;
+    });
+    if (it == top_items.end() || it->record_id != record_id) {
+      continue;
+    }
+    if (record_scores.empty()) {
+      record_scores.assign(records_.size(), 0.0f);
+      record_touched.assign(records_.size(), false);
+    }
+    ComputeTopPrefixItems(PrefixRange(entry.first), &record_scores,
+                          &record_touched, &top_items);
+  }
+  return true;
+}
+
+int Index::UpdateRecord(const int record_id, const string& url,
+                        const string& content) {
+  static thread_local vector<Analyzer::Term> _terms;
+  static thread_local string _buffer;
+
+  DeleteRecord(record_id);
+  const size_t num_keywords = keywords_.size();
+  const int new_id = AddRecord(url, content);
+  analyzer_.Analyze(content.data(), content.size(), &_terms, &_buffer);
+  AddTermItems(new_id, _terms, _buffer, 0u);
+  if (!scored_ && prefix_ids_.empty()) {
+    return new_id;
+  }
+  vector<int> keyword_ids;
+  keyword_ids.reserve(_terms.size());
+  for (const Analyzer::Term& term: _terms) {
+    keyword_ids.push_back(KeywordId(_buffer.data() + term.term_pos,
+                                    term.term_size, term.hash));
+  }
+  std::sort(keyword_ids.begin(), keyword_ids.end());
+  keyword_ids.erase(std::unique(keyword_ids.begin(), keyword_ids.end()),
+                    keyword_ids.end());
+  if (scored_) {
+    ScoreRecordItems(new_id, keyword_ids);
+  }
+  if (prefix_ids_.size()) {
+    UpdatePrefixIndex(keyword_ids, num_keywords);
+  }
+  return new_id;
+}
+
+void Index::ScoreRecordItems(const int record_id,
+                             const vector<int>& keyword_ids) {
+  // Same statistics as ComputeScores, the record is the last one listed.
+  const float num_records = NumRecords() - num_deleted_;
+  const float inv_avg_record_size = num_records / TotalSize();
+  const float record_size = RecordSize(record_id);
+  for (const int keyword_id: keyword_ids) {
+    vector<Item>& items = keywordById(keyword_id).items;
+    assert(items.size() && items.back().record_id == record_id);
+    size_t num_live_items = items.size();
+    for (const Item& item: items) {
+      num_live_items -= IsDeleted(item.record_id);
+    }
+    const float record_freq = num_live_items;
+    const float inv_record_freq = std::log2(num_records / record_freq);
+    Item& item = items.back();
+    item.score = Bm25(item.positions.size(), record_size, inv_avg_record_size,
+                      inv_record_freq, bm25_b_, bm25_k_);
+  }
+}
+
+void Index::UpdatePrefixIndex(const vector<int>& keyword_ids,
+                              const size_t num_prefix_keywords) {
+  const size_t num_keywords = keywords_.size();
+  for (size_t id = num_prefix_keywords; id < num_keywords; ++id) {
+    auto const it = std::upper_bound(prefix_ids_.begin(), prefix_ids_.end(),
+                                     static_cast<int>(id),
+        [this](const int lhs, const int rhs) {
+      return CompareNames(KeywordNameData(lhs), KeywordNameSize(lhs),
+                          KeywordNameData(rhs), KeywordNameSize(rhs)) < 0;
+    });
+    prefix_ids_.insert(it, id);
+  }
+  prefix_num_items_.resize(num_keywords + 1);
+  for (size_t i = 0; i < num_keywords; ++i) {
+    prefix_num_items_[i + 1] = prefix_num_items_[i] +
+                               keywords_[prefix_ids_[i]].items.size();
+  }
+  if (prefix_top_k_ == 0u) {
+    return;
+  }
+  // Only the prefixes of the record keywords gained items, recompute their
+  // top records as BuildPrefixIndex would.
+  vector<string> prefixes;
+  for (const int keyword_id: keyword_ids) {
+    const char* name = KeywordNameData(keyword_id);
+    for (size_t size = 1; size <= KeywordNameSize(keyword_id); ++size) {
+      prefixes.push_back(string(name, size));
+    }
+  }
+  std::sort(prefixes.begin(), prefixes.end());
+  prefixes.erase(std::unique(prefixes.begin(), prefixes.end()),
+                 prefixes.end());
+  vector<float> record_scores(records_.size(), 0.0f);
+  vector<bool> record_touched(records_.size(), false);
+  for (const string& prefix: prefixes) {
+    const std::pair<size_t, size_t> range = PrefixRange(prefix);
+    if (prefix_num_items_[range.second] - prefix_num_items_[range.first] <
+        prefix_min_items_) {
+      continue;
+    }
+    ComputeTopPrefixItems(range, &record_scores, &record_touched,
+                          &prefix_top_items_[prefix]);
+  }
+}
+
+void Index::Compact() {
+  if (num_deleted_ == 0u) {
+    return;
+  }
+  for (Keyword& keyword: keywords_) {
+    vector<Item>& items = keyword.items;
+    auto const end = std::remove_if(items.begin(), items.end(),
+        [this](const Item& item) {
+      return IsDeleted(item.record_id);
+    });
+    for (auto it = end; it != items.end(); ++it) {
+      num_items_ -= it->positions.size();
+    }
+    items.erase(end, items.end());
+  }
+  vector<int> deleted_ids;
+  deleted_ids.reserve(num_deleted_);
+  for (size_t r = 0; r < records_.size(); ++r) {
+    if (IsDeleted(r)) {
+      deleted_ids.push_back(r);
+      string().swap(records_[r].url);
+    }
+  }
+  record_store_.Purge(deleted_ids);
+  total_size_ -= deleted_size_;
+  deleted_size_ = 0u;
+  if (scored_) {
+    ComputeScores(bm25_b_, bm25_k_);
+  }
+  if (prefix_ids_.size()) {
+    BuildPrefixIndex(prefix_top_k_, prefix_min_items_);
+  }
+}
+
 size_t Index::ExtendRecord(const int record_id, const string& content) {
-  Record& record = recordById(record_id);
-  const size_t size = record.content.size();
-  record.content += content;
+  // Only the last record added can be extended.
+  assert(record_id + 1u == records_.size());
+  const size_t size = RecordSize(record_id);
+  record_store_.Extend(content);
   total_size_ += content.size();
   return size;
 }
@@ -450,7 +994,8 @@ int Index::AddItem(const int keyword_id, const int record_id,
     keyword.items.back().score += 1.0f;
   } else {
     // Keyword occurs in a new record.
-    keyword.items.push_back(Item(record_id, {pos}, keyword.name.size(), 1.0f));
+    keyword.items.push_back(Item(record_id, {pos}, KeywordNameSize(keyword_id),
+                                 1.0f));
   }
   return ++num_items_;
 }
@@ -477,19 +1022,107 @@ const vector<int>& Index::NGramItems(const string& ngram) const {
 }
 
 int Index::AddKeyword(const string& keyword) {
-  string low = keyword;
-  std::transform(keyword.cbegin(), keyword.cend(), low.begin(), ::tolower);
+  // After freezing, new keywords are only found via the hash map.
+  const string low = FoldedCase(keyword.data(), keyword.size());
   int id = keywords_.size();
-  keywords_.push_back(Keyword(low));
+  keywords_.push_back(Keyword());
+  keyword_pool_ += low;
+  keyword_offsets_.push_back(keyword_pool_.size());
   keyword_index_.insert(std::make_pair(low, id));
   return id;
 }
 
+void Index::FreezeKeywords() {
+  const size_t num_keywords = keywords_.size();
+  keyword_pool_.shrink_to_fit();
+  keyword_offsets_.shrink_to_fit();
+  vector<std::pair<uint64_t, int> > hashes;
+  hashes.reserve(num_keywords);
+  for (size_t id = 0; id < num_keywords; ++id) {
+    hashes.push_back(std::make_pair(PerfectHash::Hash(KeywordNameData(id),
+                                                      KeywordNameSize(id)),
+                                    id));
+  }
+  // Keywords of equal base hashes can not be separated by the perfect hash,
+  // they remain in the hash map.
+  std::sort(hashes.begin(), hashes.end());
+  std::unordered_map<string, int> colliding;
+  vector<uint64_t> unique_hashes;
+  vector<int> unique_ids;
+  unique_hashes.reserve(num_keywords);
+  unique_ids.reserve(num_keywords);
+  for (size_t i = 0; i < num_keywords; ++i) {
+    const uint64_t hash = hashes[i].first;
+    const int id = hashes[i].second;
+    if ((i > 0u && hashes[i - 1u].first == hash) ||
+        (i + 1u < num_keywords && hashes[i + 1u].first == hash)) {
+      colliding.insert(std::make_pair(KeywordName(id), id));
+    } else {
+      unique_hashes.push_back(hash);
+      unique_ids.push_back(id);
+    }
+  }
+  // The remaining base hashes are distinct, so the build succeeds.
+  vector<uint32_t> slots;
+  keyword_hash_.Build(unique_hashes, &slots);
+  keyword_slots_.assign(unique_ids.size(), kInvalidId);
+  for (size_t i = 0; i < unique_ids.size(); ++i) {
+    keyword_slots_[slots[i]] = unique_ids[i];
+  }
+  // Release the hash map.
+  keyword_index_.swap(colliding);
+  keywords_frozen_ = true;
+}
+
+void Index::SetAnalyzer(const Analyzer& analyzer) {
+  assert(keywords_.empty());
+  analyzer_ = analyzer;
+}
+
+const Analyzer& Index::TermAnalyzer() const {
+  return analyzer_;
+}
+
+void Index::SetDuplicateDetection(const float threshold, const bool collapse) {
+  detect_duplicates_ = threshold > 0.0f;
+  collapse_duplicates_ = collapse;
+  duplicate_detector_ = detect_duplicates_ ? DuplicateDetector(threshold) :
+                                             DuplicateDetector();
+}
+
+int Index::DuplicateOf(const int record_id) const {
+  assert(record_id >= 0 && static_cast<size_t>(record_id) < records_.size());
+  return static_cast<size_t>(record_id) < duplicate_of_.size() ?
+         duplicate_of_[record_id] : kInvalidId;
+}
+
+size_t Index::NumDuplicates() const {
+  return num_duplicates_;
+}
+
+bool Index::KeywordsFrozen() const {
+  return keywords_frozen_;
+}
+
 const Index::Keyword& Index::KeywordById(const int id) const {
   assert(id >= 0 && id < static_cast<int>(keywords_.size()));
   return keywords_[id];
 }
 
+string Index::KeywordName(const int id) const {
+  return string(KeywordNameData(id), KeywordNameSize(id));
+}
+
+const char* Index::KeywordNameData(const int id) const {
+  assert(id >= 0 && id < static_cast<int>(keywords_.size()));
+  return keyword_pool_.data() + keyword_offsets_[id];
+}
+
+size_t Index::KeywordNameSize(const int id) const {
+  assert(id >= 0 && id < static_cast<int>(keywords_.size()));
+  return keyword_offsets_[id + 1] - keyword_offsets_[id];
+}
+
 Index::Keyword& Index::keywordById(const int id) {
   assert(id >= 0 && id < static_cast<int>(keywords_.size()));
   return keywords_[id];
@@ -500,13 +1133,17 @@ void Index::ReserveRecords(const size_t num) {
 }
 
 size_t Index::TotalSize() const {
-  return total_size_;
+  return total_size_ - deleted_size_;
 }
 
 size_t Index::NumRecords() const {
   return records_.size();
 }
 
+size_t Index::NumDeletedRecords() const {
+  return num_deleted_;
+}
+
 size_t Index::NumItems() const {
   return num_items_;
 }
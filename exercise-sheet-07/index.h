@@ -5,15 +5,20 @@
 #include <unordered_map>
 #include <string>
 #include <vector>
+#include <utility>
+#include "./analyzer.h"
+#include "./duplicate-detector.h"
+#include "./record-store.h"
+#include "./perfect-hash.h"
 #include "./clock.h"
 
 // The inverted index holding a mapping from keywords (prefixes) to records.
 class Index {
  public:
-  // A record consists of its url and the content text.
+  // A record consists of its url, the content text is kept compressed in the
+  // record store.
   struct Record {
     std::string url;
-    std::string content;
   };
 
   // Intermediate keyword position structure used during extraction.
@@ -36,18 +41,15 @@ class Index {
     }
 
     int record_id;
+    // The size of the keyword, see SetTokenSizes for the source tokens.
     size_t size;
     float score;
     std::vector<size_t> positions;
   };
 
-  // A keyword consists of its name and its items, i.e. occurrences in records.
+  // A keyword consists of its items, i.e. occurrences in records. The names
+  // are stored in the keyword pool, see KeywordName.
   struct Keyword {
-    explicit Keyword(const std::string& name) : name(name) {}
-    operator const std::string&() const {
-      return name;
-    }
-    std::string name;
     std::vector<Item> items;
   };
 
@@ -60,9 +62,21 @@ class Index {
   // The minimum size for a valid keyword.
   static size_t kMinKeywordSize;
 
+  // The minimum number of items matched by a prefix for its top records to be
+  // precomputed in the prefix index.
+  static const size_t kMinCachedPrefixItems;
+
   // Replacement character for invalid UTF-8 bytes.
   static uint8_t kUtf8RepairReplace;
 
+  // Returns the BM25 score of an item with given term frequency in a record of
+  // given size. The inverse record frequency is the log2 of the number of
+  // records by the number of records containing the keyword.
+  static float Bm25(const float freq, const float record_size,
+                    const float inv_avg_record_size,
+                    const float inv_record_freq, const float bm25_b,
+                    const float bm25_k);
+
   // Repairs invalid byte sequences in given string, making it valid UTF8.
   // Returns the number of bytes repaired.
   static int RepairUtf8(std::string* s);
@@ -71,15 +85,18 @@ class Index {
   static std::vector<std::string> Split(const std::string& content,
                                         const std::string& delims);
 
-  // Finds all valid keywords within given content string and returns their
-  // position and sizes. A keyword must contain at least one alphabetic
-  // character and have at least the minimum size.
+  // Finds all valid keywords within given UTF-8 content string and returns
+  // their position and sizes. A keyword is a run of letters and digits, which
+  // contains at least one letter and has at least the minimum size in code
+  // points, see Tokenizer.
   static std::vector<PosSize>
     ExtractKeywords(const std::string& content, const size_t beg,
                     const size_t end);
 
   // Adds all records and items from given CSV content, if the file format is:
   // <url>\t<content>\n
+  // The keywords are the terms of the content given by the index analyzer.
+  // Duplicates are detected while streaming, see SetDuplicateDetection.
   static void AddRecordsFromCsv(const std::string& file_content, Index* index);
 
   // Adds all keywords from given content, if the file format is:
@@ -116,24 +133,102 @@ class Index {
   std::vector<std::string> ApproximateMatches(const std::string& keyword,
                                               const int max_ed) const;
 
-  // Computes BM25 scores, replacing the term frequency based defaults.
+  // Computes BM25 scores, replacing the term frequency based defaults. The
+  // parameters are kept for scoring updated records, see UpdateRecord.
   void ComputeScores(const float bm25_b, const float bm25_k);
 
   // Builds the n-gram index with given parameter.
   void BuildNGrams(const int ngram_n);
 
+  // Builds the prefix index over the lexicographically sorted keywords and
+  // precomputes the top-k records for each prefix matching at least the given
+  // number of items. Should be called after the scores are computed. A top-k
+  // of 0 only builds the sorted keywords.
+  void BuildPrefixIndex(const size_t top_k,
+                        const size_t min_items = kMinCachedPrefixItems);
+
+  // Returns the range [first, second) of positions within the sorted keywords
+  // matching given prefix. Requires the prefix index.
+  std::pair<size_t, size_t> PrefixRange(const std::string& prefix) const;
+  std::pair<size_t, size_t> PrefixRange(const char* prefix,
+                                        const size_t size) const;
+
+  // Returns the keyword id at given position within the sorted keywords.
+  int SortedKeywordId(const size_t pos) const;
+
+  // Returns the ids of all keywords starting with given prefix in
+  // lexicographical order. Requires the prefix index.
+  std::vector<int> PrefixKeywordIds(const std::string& prefix) const;
+
+  // Returns the items of all keywords starting with given prefix, sorted by
+  // record id. There is one item per record for each keyword matched.
+  std::vector<Item> PrefixItems(const std::string& prefix) const;
+
+  // Returns the precomputed items of the top-k records for given prefix,
+  // sorted by record id. Returns an empty list if the prefix is not cached.
+  // Deleting a listed record or updating a record recomputes the list, records
+  // added otherwise after the computation are not considered.
+  const std::vector<Item>& TopPrefixItems(const std::string& prefix) const;
+  const std::vector<Item>& TopPrefixItems(const char* prefix,
+                                          const size_t size) const;
+
+  // Returns the number of top records precomputed per cached prefix.
+  size_t PrefixTopK() const;
+
   // Returns a const reference to the record of given id.
   const Record& RecordById(const int record_id) const;
 
+  // Writes the content of the record with given id to the given string.
+  void RecordContent(const int record_id, std::string* content) const;
+
+  // Sets the sizes of given matches, i.e. item positions within given record
+  // content sorted by position, to the sizes of the source tokens. These may
+  // differ from the keyword sizes due to the normalization, e.g. stemming.
+  void SetTokenSizes(const std::string& content,
+                     std::vector<PosSize>* matches) const;
+
+  // Returns the content size (in char) of the record with given id.
+  size_t RecordSize(const int record_id) const;
+
+  // Returns the record store holding the compressed record contents.
+  const RecordStore& Records() const;
+
   // Returns a const reference to the items list for given keyword.
   const std::vector<Item>& Items(const std::string& keyword) const;
+  const std::vector<Item>& Items(const char* keyword, const size_t size) const;
 
   // Adds the record to the index.
   // Returns the new record id.
   int AddRecord(const std::string& url, const std::string& content);
 
-  // Extends the content of a record with given id.
-  // Returns the old size of the record content.
+  // Adds the record and the items of all keywords within its content, given
+  // by the index analyzer. Returns the new record id.
+  int AddRecordAndItems(const std::string& url, const std::string& content);
+
+  // Marks the record with given id as deleted. Queries ignore deleted records,
+  // their items and contents are purged by Compact. The precomputed top
+  // records of the prefixes listing the record are recomputed. Returns false,
+  // if the record was deleted already.
+  bool DeleteRecord(const int record_id);
+
+  // Replaces the record with given id by a new record with given url and
+  // content, i.e. deletes it and adds the new record and its items. On a
+  // scored index, the new items are scored by the current live statistics,
+  // the other scores are only adjusted by ComputeScores or Compact. The prefix
+  // index, if built, is updated. Returns the new record id.
+  int UpdateRecord(const int record_id, const std::string& url,
+                   const std::string& content);
+
+  // Returns whether the record with given id is deleted.
+  bool IsDeleted(const int record_id) const;
+
+  // Purges the items and contents of all deleted records, recomputes the
+  // scores, if computed, and rebuilds the prefix index, if built. The record
+  // ids are kept, deleted records have empty urls and contents.
+  void Compact();
+
+  // Extends the content of a record with given id, which needs to be the
+  // last record added. Returns the old size of the record content.
   size_t ExtendRecord(const int record_id, const std::string& content);
 
   // Adds the item with given keyword, record id and its position within the
@@ -148,22 +243,73 @@ class Index {
   // Returns aht keyword ids for given n-gram.
   const std::vector<int>& NGramItems(const std::string& ngram) const;
 
+  // Returns the id for given keyword, the lookup is case-insensitive (see
+  // Analyzer::FoldCase) and does not allocate memory. Returns kInvalidId for
+  // unknown keywords.
   int KeywordId(const std::string& keyword) const;
+  int KeywordId(const char* keyword, const size_t size) const;
+  // Same as above for a normalized term given its hash, see Analyzer::Term.
+  // The hash is only used by the frozen dictionary.
+  int KeywordId(const char* keyword, const size_t size,
+                const uint64_t hash) const;
   const Keyword& KeywordById(const int id) const;
 
+  // Returns the name of the keyword with given id.
+  std::string KeywordName(const int id) const;
+  // Returns the pointer to the name of the keyword with given id in the pool,
+  // which is valid until the next keyword is added.
+  const char* KeywordNameData(const int id) const;
+  // Returns the size of the name of the keyword with given id.
+  size_t KeywordNameSize(const int id) const;
+
   // Adds the keyword and creates all its n-grams.
   // Returns the id for the inserted keyword.
   int AddKeyword(const std::string& keyword);
 
+  // Freezes the keyword dictionary: the keyword names are looked up in the
+  // keyword pool via a minimal perfect hash function, which replaces the
+  // keyword hash map. Only keywords of equal base hashes remain in the hash
+  // map, which also takes the keywords added afterwards, e.g. by updates.
+  void FreezeKeywords();
+
+  // Returns whether the keyword dictionary is frozen.
+  bool KeywordsFrozen() const;
+
+  // Sets the analyzer used to extract the keywords from the records and the
+  // query terms. Needs to be set before any keywords are added.
+  void SetAnalyzer(const Analyzer& analyzer);
+
+  // Returns the analyzer of the index.
+  const Analyzer& TermAnalyzer() const;
+
+  // Enables the near-duplicate detection of AddRecordsFromCsv for given
+  // Jaccard similarity threshold of the term shingles, see DuplicateDetector.
+  // The terms of each record are sketched as they are analyzed, a record is a
+  // duplicate of the earliest previous record with at least the threshold
+  // similarity. Collapsed duplicates are deleted without adding their items,
+  // otherwise they are indexed and only flagged, see DuplicateOf. A threshold
+  // of 0 disables the detection, which is the default.
+  void SetDuplicateDetection(const float threshold, const bool collapse);
+
+  // Returns the id of the record duplicated by the record with given id,
+  // kInvalidId if it is not a duplicate.
+  int DuplicateOf(const int record_id) const;
+
+  // Returns the number of duplicates detected.
+  size_t NumDuplicates() const;
+
   // Reserves space for given number of records.
   void ReserveRecords(const size_t num);
 
-  // Returns the total size (in char) of all indexed records.
+  // Returns the total size (in char) of all live records.
   size_t TotalSize() const;
 
-  // Returns the number of records indexed.
+  // Returns the number of records indexed, including deleted records.
   size_t NumRecords() const;
 
+  // Returns the number of deleted records.
+  size_t NumDeletedRecords() const;
+
   // Returns the total number of items (keyword occurences) indexed.
   size_t NumItems() const;
 
@@ -178,15 +324,87 @@ class Index {
   // Returns a reference to the record of given id.
   Record& recordById(const int record_id);
   Keyword& keywordById(const int id);
+  // Adds the items of all keywords within given content of the record, which
+  // starts at given offset within the record content.
+  void AddContentItems(const int record_id, const char* content,
+                       const size_t size, const size_t offset);
+  // Adds the items of given terms of the record, see Analyzer::Analyze.
+  void AddTermItems(const int record_id,
+                    const std::vector<Analyzer::Term>& terms,
+                    const std::string& buffer, const size_t offset);
+  // Analyzes given content of the record, which starts at given offset within
+  // the record content, and buffers its terms until AddBufferedItems.
+  void BufferContentTerms(const char* content, const size_t size,
+                          const size_t offset);
+  // Checks the record with given id for duplicates based on the buffered
+  // terms and adds their items, unless the record is collapsed.
+  void AddBufferedItems(const int record_id);
+  // Writes the items of the top-k live records for the keywords within given
+  // sorted range to the list. The scratch scores and flags need an entry per
+  // record, they are left zeroed.
+  void ComputeTopPrefixItems(const std::pair<size_t, size_t>& range,
+                             std::vector<float>* record_scores,
+                             std::vector<bool>* record_touched,
+                             std::vector<Item>* top_items) const;
+  // Scores the items of the record with given id for given keywords, using
+  // the BM25 parameters of the last ComputeScores and the live statistics.
+  void ScoreRecordItems(const int record_id,
+                        const std::vector<int>& keyword_ids);
+  // Inserts the keywords added since the prefix index has been built, given
+  // the number of keywords before, into the sorted order and recomputes the
+  // top records of the prefixes of given keywords.
+  void UpdatePrefixIndex(const std::vector<int>& keyword_ids,
+                         const size_t num_prefix_keywords);
+  // Returns the id for given normalized term using the frozen dictionary.
+  int FrozenKeywordId(const char* term, const size_t size,
+                      const uint64_t hash) const;
+
+  Analyzer analyzer_;
 
   std::vector<Record> records_;
+  RecordStore record_store_;
   std::unordered_map<std::string, int> keyword_index_;
+  // The frozen keyword dictionary.
+  PerfectHash keyword_hash_;
+  std::vector<int> keyword_slots_;
+  // The concatenated keyword names and their offsets plus the end offset.
+  std::string keyword_pool_;
+  std::vector<uint32_t> keyword_offsets_;
+  bool keywords_frozen_;
   std::unordered_map<std::string, std::vector<int> > ngram_index_;
   std::vector<Keyword> keywords_;
+  std::vector<int> prefix_ids_;
+  std::vector<size_t> prefix_num_items_;
+  std::unordered_map<std::string, std::vector<Item> > prefix_top_items_;
+  size_t prefix_top_k_;
+  size_t prefix_min_items_;
   size_t num_items_;
   size_t total_size_;
+  // The BM25 parameters of the last ComputeScores.
+  bool scored_;
+  float bm25_b_;
+  float bm25_k_;
   int ngram_n_;
   mutable Clock::Diff last_ed_avg_duration_;
+  // The tombstone bitmap of deleted records.
+  std::vector<uint64_t> deleted_;
+  size_t num_deleted_;
+  size_t deleted_size_;
+  // The duplicate detection state and the duplicated record ids, sized up to
+  // the last duplicate.
+  DuplicateDetector duplicate_detector_;
+  bool detect_duplicates_;
+  bool collapse_duplicates_;
+  std::vector<int> duplicate_of_;
+  size_t num_duplicates_;
+  // The terms of the record being added by AddRecordsFromCsv.
+  std::vector<Analyzer::Term> buffered_terms_;
+  std::string buffered_buffer_;
 };
 
+inline bool Index::IsDeleted(const int record_id) const {
+  const size_t word = static_cast<size_t>(record_id) >> 6;
+  return word < deleted_.size() && (deleted_[word] >> (record_id & 63)) & 1u;
+}
+
 #endif  // EXERCISE_SHEET_07_INDEX_H_
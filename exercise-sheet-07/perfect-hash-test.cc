@@ -0,0 +1,89 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "./perfect-hash.h"
+
+using std::vector;
+using std::string;
+
+class PerfectHashTest : public ::testing::Test {
+ public:
+  void SetUp() {
+  }
+
+  void TearDown() {
+  }
+};
+
+TEST_F(PerfectHashTest, Hash) {
+  EXPECT_EQ(PerfectHash::Hash("tesla", 5), PerfectHash::Hash("Tesla", 5));
+  EXPECT_EQ(PerfectHash::Hash("tesla", 5), PerfectHash::Hash("TESLA", 5));
+  EXPECT_NE(PerfectHash::Hash("tesla", 5), PerfectHash::Hash("tesl", 4));
+  EXPECT_NE(PerfectHash::Hash("tesla", 5), PerfectHash::Hash("edison", 6));
+  EXPECT_EQ(PerfectHash::Hash("nikola tesla", 12),
+            PerfectHash::Hash("NIKOLA TESLA", 12));
+  // Only ASCII letters are lowered, other bytes differing in the 0x20 bit
+  // remain distinct.
+  const vector<std::pair<string, string> > distinct = {
+    {"一", "丠"}, {"straße", "straÿe"}, {"ÄÖÜ", "äöü"}, {"@[", "`{"},
+    {"一一一一", "一一丠一"}
+  };
+  for (const std::pair<string, string>& keys: distinct) {
+    EXPECT_NE(PerfectHash::Hash(keys.first.data(), keys.first.size()),
+              PerfectHash::Hash(keys.second.data(), keys.second.size()))
+        << keys.first << " " << keys.second;
+  }
+  // Each byte in the word loop and in the tail.
+  for (const string& prefix: {string(), string("keyword")}) {
+    std::set<uint64_t> hashes;
+    for (int c = 0; c < 256; ++c) {
+      const string key = prefix + static_cast<char>(c);
+      const uint64_t hash = PerfectHash::Hash(key.data(), key.size());
+      if (c >= 'A' && c <= 'Z') {
+        const string low = prefix + static_cast<char>(c + 'a' - 'A');
+        EXPECT_EQ(PerfectHash::Hash(low.data(), low.size()), hash);
+      } else {
+        hashes.insert(hash);
+      }
+    }
+    EXPECT_EQ(256u - 26u, hashes.size());
+  }
+}
+
+TEST_F(PerfectHashTest, Build) {
+  for (const size_t num_keys: {1u, 2u, 3u, 7u, 100u, 10000u}) {
+    vector<uint64_t> hashes;
+    for (size_t i = 0; i < num_keys; ++i) {
+      const string key = "keyword" + std::to_string(i);
+      hashes.push_back(PerfectHash::Hash(key.data(), key.size()));
+    }
+    PerfectHash hash;
+    vector<uint32_t> slots;
+    ASSERT_TRUE(hash.Build(hashes, &slots));
+    ASSERT_EQ(num_keys, hash.Size());
+    ASSERT_EQ(num_keys, slots.size());
+    // The function is a bijection onto the slots.
+    vector<bool> taken(num_keys, false);
+    for (size_t i = 0; i < num_keys; ++i) {
+      ASSERT_LT(slots[i], num_keys);
+      EXPECT_FALSE(taken[slots[i]]);
+      taken[slots[i]] = true;
+      EXPECT_EQ(slots[i], hash.Slot(hashes[i]));
+    }
+  }
+}
+
+TEST_F(PerfectHashTest, DuplicateHashes) {
+  // Equal base hashes can not be separated, the build fails instead.
+  PerfectHash hash;
+  vector<uint32_t> slots;
+  EXPECT_FALSE(hash.Build({1u, 2u, 3u, 2u}, &slots));
+  EXPECT_EQ(0u, hash.Size());
+  EXPECT_TRUE(slots.empty());
+  EXPECT_TRUE(hash.Build({1u, 2u, 3u}, &slots));
+  EXPECT_EQ(3u, hash.Size());
+}
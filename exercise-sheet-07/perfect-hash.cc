@@ -0,0 +1,148 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include "./perfect-hash.h"
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+using std::vector;
+
+const size_t PerfectHash::kBucketSize = 4u;
+
+// Mixes the base hash with given seed, using the Murmur3 finalizer.
+static inline uint64_t Mix(uint64_t hash, const uint32_t seed) {
+  hash ^= (seed + 1u) * 0x9e3779b97f4a7c15ull;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// Reads 8 and 4 bytes without alignment requirements.
+static inline uint64_t Read64(const char* s) {
+  uint64_t value;
+  std::memcpy(&value, s, sizeof(value));
+  return value;
+}
+
+static inline uint64_t Read32(const char* s) {
+  uint32_t value;
+  std::memcpy(&value, s, sizeof(value));
+  return value;
+}
+
+// Lowers the ASCII capital letters of given 8 bytes. A byte is a capital
+// letter if it is at least 'A' and not more than 'Z', both comparisons are
+// done by adding to the low 7 bits of all bytes at once and looking at the
+// high bits. Bytes with the high bit set, i.e. of multibyte UTF-8 sequences,
+// are kept.
+static inline uint64_t LowerAscii(const uint64_t word) {
+  static const uint64_t kHigh = 0x8080808080808080ull;
+  static const uint64_t kLow = 0x7f7f7f7f7f7f7f7full;
+  static const uint64_t kOnes = 0x0101010101010101ull;
+  const uint64_t low = word & kLow;
+  const uint64_t ge_a = low + (0x80u - 'A') * kOnes;
+  const uint64_t gt_z = low + (0x80u - 'Z' - 1u) * kOnes;
+  const uint64_t upper = ge_a & ~gt_z & ~word & kHigh;
+  return word | (upper >> 2);
+}
+
+uint64_t PerfectHash::Hash(const char* s, const size_t size) {
+  static const uint64_t kMul = 0x9e3779b97f4a7c15ull;
+  uint64_t hash = size * kMul;
+  size_t i = 0;
+  for (; i + 8u <= size; i += 8u) {
+    hash = (hash ^ LowerAscii(Read64(s + i))) * kMul;
+    hash ^= hash >> 32;
+  }
+  const size_t rest = size - i;
+  if (rest) {
+    // Reads the last bytes with overlapping loads instead of a byte loop.
+    uint64_t word;
+    if (rest >= 4u) {
+      word = (Read32(s + i) << 32) | Read32(s + size - 4u);
+    } else {
+      word = (static_cast<uint64_t>(static_cast<uint8_t>(s[i])) << 16) |
+             (static_cast<uint64_t>(static_cast<uint8_t>(s[i + rest / 2])) <<
+              8) | static_cast<uint8_t>(s[size - 1u]);
+    }
+    hash = (hash ^ LowerAscii(word)) * kMul;
+  }
+  return Mix(hash, 0u);
+}
+
+PerfectHash::PerfectHash()
+    : size_(0u) {}
+
+bool PerfectHash::Build(const vector<uint64_t>& hashes,
+                        vector<uint32_t>* slots) {
+  assert(slots);
+  seeds_.clear();
+  size_ = 0u;
+  slots->clear();
+  vector<uint64_t> sorted(hashes);
+  std::sort(sorted.begin(), sorted.end());
+  if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+    return false;
+  }
+  size_ = hashes.size();
+  const size_t num_buckets = std::max<size_t>(1u, size_ / kBucketSize);
+  seeds_.assign(num_buckets, 0u);
+  // Group the keys by bucket.
+  vector<vector<uint32_t> > buckets(num_buckets);
+  for (size_t i = 0; i < size_; ++i) {
+    buckets[hashes[i] % num_buckets].push_back(i);
+  }
+  vector<uint32_t> order(num_buckets);
+  for (size_t b = 0; b < num_buckets; ++b) {
+    order[b] = b;
+  }
+  // Place the largest buckets first, while most slots are free.
+  std::stable_sort(order.begin(), order.end(),
+      [&buckets](const uint32_t lhs, const uint32_t rhs) {
+    return buckets[lhs].size() > buckets[rhs].size();
+  });
+  slots->assign(size_, 0u);
+  vector<bool> taken(size_, false);
+  vector<uint32_t> bucket_slots;
+  for (const uint32_t b: order) {
+    const vector<uint32_t>& keys = buckets[b];
+    if (keys.empty()) {
+      break;
+    }
+    // Find the first seed displacing all keys of the bucket to free slots.
+    uint32_t seed = 0u;
+    bool placed = false;
+    while (!placed) {
+      bucket_slots.clear();
+      placed = true;
+      for (const uint32_t key: keys) {
+        const uint32_t slot = Mix(hashes[key], seed) % size_;
+        if (taken[slot] || std::find(bucket_slots.begin(), bucket_slots.end(),
+                                     slot) != bucket_slots.end()) {
+          placed = false;
+          break;
+        }
+        bucket_slots.push_back(slot);
+      }
+      seed += !placed;
+    }
+    seeds_[b] = seed;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      taken[bucket_slots[i]] = true;
+      (*slots)[keys[i]] = bucket_slots[i];
+    }
+  }
+  return true;
+}
+
+uint32_t PerfectHash::Slot(const uint64_t hash) const {
+  assert(size_);
+  return Mix(hash, seeds_[hash % seeds_.size()]) % size_;
+}
+
+size_t PerfectHash::Size() const {
+  return size_;
+}
@@ -0,0 +1,45 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#ifndef EXERCISE_SHEET_07_PERFECT_HASH_H_
+#define EXERCISE_SHEET_07_PERFECT_HASH_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Minimal perfect hash function following the CHD (compress, hash and
+// displace) scheme. The keys are represented by their 64-bit base hashes,
+// which are grouped into buckets. Each bucket stores a displacement seed,
+// which maps all of its keys to distinct free slots. Requires about 1 byte
+// per key.
+class PerfectHash {
+ public:
+  // The average number of keys per bucket.
+  static const size_t kBucketSize;
+
+  // Returns the ASCII case-insensitive base hash of given string. The string
+  // is hashed a word at a time.
+  static uint64_t Hash(const char* s, const size_t size);
+
+  // Initializes an empty function.
+  PerfectHash();
+
+  // Builds the function for given distinct base hashes, the i-th hash is
+  // mapped to the i-th slot written to the vector. Returns false and leaves
+  // the function empty if any base hashes are equal, since their keys can not
+  // be separated.
+  bool Build(const std::vector<uint64_t>& hashes,
+             std::vector<uint32_t>* slots);
+
+  // Returns the slot in [0, Size()) for given base hash. The result is
+  // arbitrary for hashes not used to build the function.
+  uint32_t Slot(const uint64_t hash) const;
+
+  // Returns the number of slots, i.e. the number of keys.
+  size_t Size() const;
+
+ private:
+  std::vector<uint32_t> seeds_;
+  size_t size_;
+};
+
+#endif  // EXERCISE_SHEET_07_PERFECT_HASH_H_
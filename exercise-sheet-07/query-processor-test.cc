@@ -1,6 +1,8 @@
 // Copyright 2012 Eugen Sawin <esawin@me73.com>
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
+#include <new>
+#include <cstdlib>
 #include <fstream>
 #include <vector>
 #include <set>
@@ -15,6 +17,19 @@ using std::cout;
 using std::endl;
 using std::ofstream;
 
+// Counts all heap allocations of the test binary. The default operator
+// delete frees the memory.
+static size_t _num_allocs = 0u;
+
+__attribute__((noinline)) void* operator new(size_t size) {
+  ++_num_allocs;
+  void* mem = std::malloc(size ? size : 1u);
+  if (!mem) {
+    throw std::bad_alloc();
+  }
+  return mem;
+}
+
 using ::testing::ElementsAre;
 using ::testing::Contains;
 using ::testing::Not;
@@ -169,3 +184,153 @@ TEST_F(QueryProcessorTest, longQuery) {
                                   {2, {0}, 6, 0.0f} }),
             results);
 }
+
+TEST_F(QueryProcessorTest, prefixAnswer) {
+  index_.BuildPrefixIndex(1u, 1u);
+  QueryProcessor proc(index_);
+  {
+    vector<Index::Item> results = proc.Answer("hon*", 1u);
+    EXPECT_EQ(vector<Index::Item>({ {2, {11}, 6, 0.0f}, {2, {25}, 8, 0.0f} }),
+              results);
+  }
+  {
+    vector<Index::Item> results = proc.Answer("hon*", num_results_);
+    EXPECT_EQ(vector<Index::Item>({ {1, {11}, 6, 0.0f}, {2, {11}, 6, 0.0f},
+                                    {2, {25}, 8, 0.0f} }),
+              results);
+  }
+  {
+    vector<Index::Item> results = proc.Answer("Tesla hon*", num_results_);
+    EXPECT_EQ(vector<Index::Item>({ {1, {22}, 5, 0.0f}, {1, {11}, 6, 0.0f},
+                                    {2, {34, 150}, 5, 0.0f},
+                                    {2, {11}, 6, 0.0f}, {2, {25}, 8, 0.0f} }),
+              results);
+  }
+  {
+    vector<Index::Item> results = proc.Answer("honx*", num_results_);
+    EXPECT_EQ(0, results.size());
+  }
+}
+
+TEST_F(QueryProcessorTest, unicodeAnswer) {
+  Index index;
+  Index::AddRecordsFromCsv("Apfel\t\xc3\x84pfel und Birnen \xe2\x80\x94 "
+                           "frisch.\nMoskau\t\xd0\x9c\xd0\xbe\xd1\x81"
+                           "\xd0\xba\xd0\xb2\xd0\xb0: \xc3\xa4pfel, "
+                           "\xc3\x84PFEL.\n", &index);
+  index.BuildPrefixIndex(1u, 1u);
+  QueryProcessor proc(index);
+  {
+    vector<Index::Item> results = proc.Answer("\xc3\xa4pfel!", num_results_);
+    EXPECT_EQ(vector<Index::Item>({ {0, {0}, 6, 0.0f},
+                                    {1, {14, 22}, 6, 0.0f} }),
+              results);
+  }
+  {
+    vector<Index::Item> results = proc.Answer(
+        "\xd0\xbc\xd0\x9e\xd0\xa1\xd0\x9a\xd0\x92\xd0\x90 "
+        "\xc3\x84pfel", num_results_);
+    EXPECT_EQ(vector<Index::Item>({ {1, {0}, 12, 0.0f},
+                                    {1, {14, 22}, 6, 0.0f} }),
+              results);
+  }
+  {
+    vector<Index::Item> results = proc.Answer("\xc3\x84p*", num_results_);
+    EXPECT_EQ(vector<Index::Item>({ {0, {0}, 6, 0.0f},
+                                    {1, {14, 22}, 6, 0.0f} }),
+              results);
+  }
+}
+
+TEST_F(QueryProcessorTest, deletedAnswer) {
+  index_.BuildPrefixIndex(1u, 1u);
+  QueryProcessor proc(index_);
+  index_.DeleteRecord(2);
+  index_.DeleteRecord(4);
+  {
+    vector<Index::Item> results = proc.Answer("tesla", num_results_);
+    EXPECT_EQ(vector<Index::Item>({ {0, {98}, 5, 0.0f}, {1, {22}, 5, 0.0f},
+                                    {3, {13}, 5, 0.0f}, {5, {47}, 5, 0.0f} }),
+              results);
+    EXPECT_EQ(4, proc.LastRecordsFound());
+  }
+  {
+    vector<Index::Item> results = proc.Answer("hon*", 1u);
+    EXPECT_EQ(vector<Index::Item>({ {1, {11}, 6, 0.0f} }), results);
+  }
+  index_.Compact();
+  {
+    vector<Index::Item> results = proc.Answer("Tesla Edison", num_results_);
+    EXPECT_EQ(vector<Index::Item>({ {5, {47}, 5, 0.0f}, {5, {77}, 6, 0.0f} }),
+              results);
+  }
+  {
+    vector<Index::Item> results = proc.Answer("hon*", 1u);
+    EXPECT_EQ(vector<Index::Item>({ {1, {11}, 6, 0.0f} }), results);
+  }
+}
+
+TEST_F(QueryProcessorTest, matchesAnswer) {
+  QueryProcessor proc(index_);
+  vector<QueryProcessor::Match> matches;
+  proc.Answer("Tesla Edison", num_results_, &matches);
+  ASSERT_EQ(4, matches.size());
+  EXPECT_EQ(4, matches[0].record_id);
+  EXPECT_EQ(&index_.Items("tesla")[4], matches[0].item);
+  EXPECT_EQ(&index_.Items("edison")[0], matches[1].item);
+  EXPECT_EQ(matches[0].score, matches[1].score);
+  EXPECT_EQ(5, matches[2].record_id);
+  EXPECT_EQ(&index_.Items("tesla")[5], matches[2].item);
+  EXPECT_EQ(&index_.Items("edison")[1], matches[3].item);
+}
+
+TEST_F(QueryProcessorTest, noAllocations) {
+  index_.BuildPrefixIndex(1u, 1u);
+  QueryProcessor proc(index_);
+  const vector<string> queries = {"tesla", "Tesla Edison", "hmm? Tesla \ta",
+                                  "Google birthday doodle Tesla Legacy",
+                                  "hon*", "tesla hon*", "Nebuchad", "",
+                                  "an_unknown_and_very_long_keyword_12345"};
+  vector<QueryProcessor::Match> matches;
+  // Warm up the arena and buffers.
+  for (const string& query: queries) {
+    proc.Answer(query, num_results_, &matches);
+    proc.Answer(query, 1u, &matches);
+  }
+  const size_t num_allocs = _num_allocs;
+  for (int i = 0; i < 3; ++i) {
+    for (const string& query: queries) {
+      proc.Answer(query, num_results_, &matches);
+      proc.Answer(query, 1u, &matches);
+    }
+  }
+  EXPECT_EQ(num_allocs, _num_allocs);
+}
+
+TEST_F(QueryProcessorTest, recordIterator) {
+  QueryProcessor proc(index_);
+  vector<QueryProcessor::Match> matches;
+  proc.Answer("tesla", 3u, &matches);
+  vector<int> record_ids;
+  for (QueryProcessor::RecordIterator it(matches); it.Valid(); it.Next()) {
+    ASSERT_EQ(1, it.end() - it.begin());
+    EXPECT_EQ(it.RecordId(), it.begin()->item->record_id);
+    record_ids.push_back(it.RecordId());
+  }
+  EXPECT_EQ(3, record_ids.size());
+  EXPECT_EQ(2, record_ids[0]);
+
+  proc.Answer("Tesla Edison", num_results_, &matches);
+  QueryProcessor::RecordIterator it(matches);
+  ASSERT_TRUE(it.Valid());
+  EXPECT_EQ(2, it.end() - it.begin());
+  EXPECT_EQ(matches[0].record_id == 5 ? 4 : 5, it.RecordId());
+  it.Next();
+  ASSERT_TRUE(it.Valid());
+  EXPECT_EQ(matches[0].record_id, it.RecordId());
+  it.Next();
+  EXPECT_FALSE(it.Valid());
+
+  matches.clear();
+  EXPECT_FALSE(QueryProcessor::RecordIterator(matches).Valid());
+}
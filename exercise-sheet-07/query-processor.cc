@@ -1,122 +1,427 @@
 // Copyright 2012 Eugen Sawin <esawin@me73.com>
 #include "./query-processor.h"
 #include <cassert>
+#include <cmath>
 #include <queue>
 #include <algorithm>
+#include <functional>
+#include <utility>
+#include "./analyzer.h"
 
 using std::string;
 using std::vector;
 
+const char QueryProcessor::kPrefixMark = '*';
+
+// Returns copies of the matched items with their score set to the record
+// score.
+static vector<Index::Item> MatchedItems(
+    const vector<QueryProcessor::Match>& matches) {
+  vector<Index::Item> items;
+  items.reserve(matches.size());
+  for (const QueryProcessor::Match& match: matches) {
+    items.push_back(*match.item);
+    items.back().score = match.score;
+  }
+  return items;
+}
+
+// Splits off the last keyword of given query, if it ends with the prefix mark,
+// and writes its position and size without the mark. Returns the size of the
+// remaining query.
+static size_t SplitPrefix(const string& query, const char** prefix,
+                          size_t* prefix_size) {
+  size_t size = query.find_last_not_of(Index::kWhitespace) + 1u;
+  *prefix = 0;
+  *prefix_size = 0u;
+  if (size > 1u && query[size - 1u] == QueryProcessor::kPrefixMark) {
+    size_t prefix_beg = query.find_last_of(Index::kWhitespace, size - 1u);
+    prefix_beg = prefix_beg == string::npos ? 0u : prefix_beg + 1u;
+    if (size - prefix_beg > 1u) {
+      *prefix = query.data() + prefix_beg;
+      *prefix_size = size - prefix_beg - 1u;
+      size = prefix_beg;
+    }
+  }
+  return size;
+}
+
 QueryProcessor::QueryProcessor(const Index& index)
     : index_(index),
+      snapshot_(0),
+      inv_avg_record_size_(0.0f),
+      last_num_records_(0u),
+      last_duration_(0u) {}
+
+QueryProcessor::QueryProcessor(const Index& index,
+                               const SegmentedIndex::Snapshot* snapshot)
+    : index_(index),
+      snapshot_(snapshot),
+      inv_avg_record_size_(static_cast<float>(snapshot->NumRecords()) /
+                           snapshot->TotalSize()),
       last_num_records_(0u),
       last_duration_(0u) {}
 
 vector<Index::Item> QueryProcessor::Answer(const string& query,
                                            const size_t max_num_records) const {
+  vector<Match> matches;
+  Answer(query, max_num_records, &matches);
+  return MatchedItems(matches);
+}
+
+void QueryProcessor::Answer(const string& query, const size_t max_num_records,
+                            vector<Match>* matches) const {
+  static thread_local Arena _arena;
+  static thread_local vector<Analyzer::Term> _terms;
+  static thread_local string _buffer;
+
+  assert(matches);
   auto const beg = Clock();
-  vector<const vector<Index::Item>*> lists;
-  vector<string> keywords = Index::Split(query, Index::kWhitespace);
-  for (auto it = keywords.cbegin(), end = keywords.cend();
-       it != end; ++it) {
-    const string& keyword = *it;
-    const vector<Index::Item>& items = index_.Items(keyword);
+  _arena.Reset();
+  ArenaVector<PostingList> lists((ArenaAllocator<PostingList>(&_arena)));
+  const char* prefix = 0;
+  size_t prefix_size = 0u;
+  const size_t size = SplitPrefix(query, &prefix, &prefix_size);
+  // The query terms are analyzed the same way as the records.
+  index_.TermAnalyzer().Analyze(query.data(), size, &_terms, &_buffer);
+  for (const Analyzer::Term& term: _terms) {
+    const char* keyword = _buffer.data() + term.term_pos;
+    const vector<Index::Item>& items = index_.Items(keyword, term.term_size);
     if (items.size()) {
       // Consider this keyword's items, ignore unknown keywords.
-      lists.push_back(&items);
+      const float inv_record_freq = snapshot_ ?
+          InvRecordFreq(keyword, term.term_size) : 0.0f;
+      lists.push_back({items.data(), 0, items.size(), inv_record_freq, 0});
     } else {
       // Add to ignored keywords list.
     }
   }
+  if (prefix) {
+    // The last keyword is incomplete, match all keywords with its prefix.
+    AddPrefixList(prefix, prefix_size, max_num_records, &_arena, &lists);
+  }
   // Boolean intersection.
-  vector<Index::Item> results = Intersect(lists);
-  results = Rank(results, max_num_records, lists.size());
+  ArenaVector<Match> results((ArenaAllocator<Match>(&_arena)));
+  Intersect(lists, &_arena, &results);
+  Rank(results.data(), results.size(), max_num_records, lists.size(), &_arena,
+       matches);
   last_duration_ = Clock() - beg;
-  return results;
+}
+
+size_t QueryProcessor::Answer(const SegmentedIndex::Snapshot& snapshot,
+                              const string& query,
+                              const size_t max_num_records,
+                              vector<Match>* matches) {
+  // A ranked record within the matches of a segment.
+  struct RankedRecord {
+    float score;
+    int record_id;
+    const Match* beg;
+    const Match* end;
+  };
+  static thread_local vector<vector<Match> > _segment_matches;
+  static thread_local vector<RankedRecord> _records;
+  static thread_local vector<Analyzer::Term> _terms;
+  static thread_local string _buffer;
+  static thread_local vector<char> _known;
+
+  assert(matches);
+  matches->clear();
+  const vector<SegmentedIndex::Segment>& segments = snapshot.Segments();
+  if (segments.empty()) {
+    return 0u;
+  }
+  if (_segment_matches.size() < segments.size()) {
+    _segment_matches.resize(segments.size());
+  }
+  // Unknown keywords are ignored, like for a single index. A keyword unknown
+  // to a segment only, excludes the segment.
+  const char* prefix = 0;
+  size_t prefix_size = 0u;
+  const size_t size = SplitPrefix(query, &prefix, &prefix_size);
+  segments[0].index->TermAnalyzer().Analyze(query.data(), size, &_terms,
+                                            &_buffer);
+  const size_t num_keywords = _terms.size() + (prefix ? 1u : 0u);
+  _known.assign(num_keywords * (segments.size() + 1u), false);
+  char* known = _known.data() + num_keywords * segments.size();
+  for (size_t s = 0; s < segments.size(); ++s) {
+    const Index& index = *segments[s].index;
+    char* segment_known = _known.data() + num_keywords * s;
+    for (size_t t = 0; t < _terms.size(); ++t) {
+      const Analyzer::Term& term = _terms[t];
+      segment_known[t] = index.Items(_buffer.data() + term.term_pos,
+                                     term.term_size).size() > 0u;
+    }
+    if (prefix) {
+      const std::pair<size_t, size_t> range =
+          index.PrefixRange(prefix, prefix_size);
+      segment_known[_terms.size()] = range.first < range.second;
+    }
+    for (size_t k = 0; k < num_keywords; ++k) {
+      known[k] |= segment_known[k];
+    }
+  }
+  // The best records of each segment contain the overall best records.
+  _records.clear();
+  size_t num_records = 0u;
+  for (size_t s = 0; s < segments.size(); ++s) {
+    const char* segment_known = _known.data() + num_keywords * s;
+    size_t k = 0;
+    while (k < num_keywords && (!known[k] || segment_known[k])) {
+      ++k;
+    }
+    if (k < num_keywords) {
+      // The segment does not contain all known keywords.
+      continue;
+    }
+    const QueryProcessor proc(*segments[s].index, &snapshot);
+    proc.Answer(query, max_num_records, &_segment_matches[s]);
+    num_records += proc.LastRecordsFound();
+    const int base_id = segments[s].base_id;
+    for (RecordIterator it(_segment_matches[s]); it.Valid(); it.Next()) {
+      _records.push_back({it.Score(), base_id + it.RecordId(), it.begin(),
+                          it.end()});
+    }
+  }
+  // Sort for the top records, ties are broken by record id as above.
+  size_t record_index = std::min(max_num_records, _records.size());
+  std::partial_sort(_records.begin(), _records.begin() + record_index,
+                    _records.end(),
+      [](const RankedRecord& lhs, const RankedRecord& rhs) {
+    return lhs.score > rhs.score ||
+           (lhs.score == rhs.score && lhs.record_id > rhs.record_id);
+  });
+  // Construct the result in reversed order with global record ids.
+  while (record_index--) {
+    const RankedRecord& record = _records[record_index];
+    for (const Match* match = record.beg; match != record.end; ++match) {
+      matches->push_back({record.record_id, match->score, match->item});
+    }
+  }
+  return num_records;
+}
+
+void QueryProcessor::AddPrefixList(const char* prefix, const size_t size,
+                                   const size_t max_num_records, Arena* arena,
+                                   ArenaVector<PostingList>* lists) const {
+  // Item reference with its order of appearance for the merge.
+  struct ItemRef {
+    int record_id;
+    int order;
+    const Index::Item* item;
+    float inv_record_freq;
+  };
+
+  const vector<Index::Item>& top_items = index_.TopPrefixItems(prefix, size);
+  if (lists->empty() && top_items.size() && !snapshot_ &&
+      max_num_records <= index_.PrefixTopK()) {
+    // Single prefix query, the precomputed top records suffice. The segments
+    // of a snapshot have none, they are not scored.
+    lists->push_back({top_items.data(), 0, top_items.size(), 0.0f, 0});
+    return;
+  }
+  // Merge the item references of all matching keywords by record id. The
+  // items of each record remain in the lexicographical keyword order.
+  const std::pair<size_t, size_t> range = index_.PrefixRange(prefix, size);
+  ArenaVector<ItemRef> item_refs((ArenaAllocator<ItemRef>(arena)));
+  for (size_t p = range.first; p < range.second; ++p) {
+    const int keyword_id = index_.SortedKeywordId(p);
+    const vector<Index::Item>& items = index_.KeywordById(keyword_id).items;
+    float inv_record_freq = 0.0f;
+    if (snapshot_ && items.size()) {
+      inv_record_freq = InvRecordFreq(index_.KeywordNameData(keyword_id),
+                                      index_.KeywordNameSize(keyword_id));
+    }
+    for (const Index::Item& item: items) {
+      item_refs.push_back({item.record_id, static_cast<int>(item_refs.size()),
+                           &item, inv_record_freq});
+    }
+  }
+  const size_t num_refs = item_refs.size();
+  if (num_refs == 0) {
+    return;
+  }
+  std::sort(item_refs.begin(), item_refs.end(),
+      [](const ItemRef& lhs, const ItemRef& rhs) {
+    return lhs.record_id < rhs.record_id ||
+           (lhs.record_id == rhs.record_id && lhs.order < rhs.order);
+  });
+  const Index::Item** refs = static_cast<const Index::Item**>(
+      arena->Allocate(num_refs * sizeof(*refs), alignof(Index::Item*)));
+  for (size_t i = 0; i < num_refs; ++i) {
+    refs[i] = item_refs[i].item;
+  }
+  float* inv_record_freqs = 0;
+  if (snapshot_) {
+    inv_record_freqs = ArenaAllocator<float>(arena).allocate(num_refs);
+    for (size_t i = 0; i < num_refs; ++i) {
+      inv_record_freqs[i] = item_refs[i].inv_record_freq;
+    }
+  }
+  lists->push_back({0, refs, num_refs, 0.0f, inv_record_freqs});
+}
+
+float QueryProcessor::InvRecordFreq(const char* keyword,
+                                    const size_t size) const {
+  assert(snapshot_);
+  // Like Index::ComputeScores for a single index over all records.
+  const float num_records = snapshot_->NumRecords();
+  const float record_freq = snapshot_->RecordFreq(keyword, size);
+  return std::log2(num_records / record_freq);
+}
+
+float QueryProcessor::ItemScore(const PostingList& list, const size_t i) const {
+  const Index::Item& item = list[i];
+  if (!snapshot_) {
+    return item.score;
+  }
+  const float inv_record_freq = list.inv_record_freqs ?
+                                list.inv_record_freqs[i] : list.inv_record_freq;
+  return Index::Bm25(item.positions.size(), index_.RecordSize(item.record_id),
+                     inv_avg_record_size_, inv_record_freq,
+                     snapshot_->Bm25B(), snapshot_->Bm25K());
 }
 
 vector<Index::Item> QueryProcessor::Rank(const vector<Index::Item>& items,
                                          const size_t max_num_records,
                                          const size_t num_keywords) const {
+  vector<Match> matches;
+  matches.reserve(items.size());
+  for (const Index::Item& item: items) {
+    matches.push_back({item.record_id, item.score, &item});
+  }
+  Arena arena;
+  vector<Match> results;
+  Rank(matches.data(), matches.size(), max_num_records, num_keywords, &arena,
+       &results);
+  return MatchedItems(results);
+}
+
+void QueryProcessor::Rank(const Match* matches, const size_t num_matches,
+                          const size_t max_num_records,
+                          const size_t num_keywords, Arena* arena,
+                          vector<Match>* results) const {
   typedef std::pair<float, size_t> ScoreIndexPair;
 
-  const size_t num_items = items.size();
-  vector<ScoreIndexPair> pairs;
-  pairs.reserve(num_items / std::max(1u, num_keywords));
+  ArenaVector<ScoreIndexPair> pairs((ArenaAllocator<ScoreIndexPair>(arena)));
+  pairs.reserve(num_matches / std::max<size_t>(1u, num_keywords));
   int prev_record_id = Index::kInvalidId;
-  for (size_t i = 0; i < num_items; ++i) {
-    const Index::Item& item = items[i];
-    if (item.record_id != prev_record_id) {
+  for (size_t i = 0; i < num_matches; ++i) {
+    const Match& match = matches[i];
+    if (match.record_id != prev_record_id) {
       // New record.
       pairs.push_back({0.0f, i});
     }
-    pairs.back().first += item.score;
-    prev_record_id = item.record_id;
+    pairs.back().first += match.score;
+    prev_record_id = match.record_id;
   }
   // Sort for the top records.
   size_t pair_index = std::min(max_num_records, pairs.size());
   std::partial_sort(pairs.begin(), pairs.begin() + pair_index, pairs.end(),
                     std::greater<ScoreIndexPair>());
   // Construct the result in reversed order.
-  vector<Index::Item> result;
-  result.reserve(pair_index * num_keywords);
+  results->clear();
+  results->reserve(pair_index * num_keywords);
   while (pair_index--) {
     const float score = pairs[pair_index].first;
-    size_t item_index = pairs[pair_index].second;
-    const int record_id = items[item_index].record_id;
-    while (items[item_index].record_id == record_id) {
-      result.push_back(items[item_index++]);
-      result.back().score = score;
+    size_t match_index = pairs[pair_index].second;
+    const int record_id = matches[match_index].record_id;
+    while (match_index < num_matches &&
+           matches[match_index].record_id == record_id) {
+      results->push_back(matches[match_index++]);
+      results->back().score = score;
     }
   }
-  return result;
 }
 
-vector<Index::Item> QueryProcessor::Intersect(
-    const vector<const vector<Index::Item>*>& lists) const {
-  using std::make_pair;
-  typedef std::priority_queue<std::pair<int, int>, vector<std::pair<int, int> >,
-                              std::greater<std::pair<int, int> > > Queue;
+void QueryProcessor::Intersect(const ArenaVector<PostingList>& lists,
+                               Arena* arena,
+                               ArenaVector<Match>* results) const {
+  typedef std::pair<int, int> RecordListPair;
+  typedef std::priority_queue<RecordListPair, ArenaVector<RecordListPair>,
+                              std::greater<RecordListPair> > Queue;
 
   last_num_records_ = 0u;
   const size_t num_lists = lists.size();
-  vector<int> indices(num_lists, 0);
-  Queue queue;
-  size_t max_list_size = 0;
+  ArenaVector<size_t> indices(num_lists, 0u, ArenaAllocator<size_t>(arena));
+  const ArenaVector<RecordListPair> queue_storage(
+      (ArenaAllocator<RecordListPair>(arena)));
+  Queue queue(std::greater<RecordListPair>(), queue_storage);
+  size_t min_list_size = num_lists ? lists[0].size : 0u;
   for (size_t l = 0; l < num_lists; ++l) {
-    const vector<Index::Item>& list = (*lists[l]);
-    queue.push(make_pair(list[indices[l]].record_id, l));
-    std::max(max_list_size, list.size());
+    queue.push(std::make_pair(lists[l][0].record_id, l));
+    min_list_size = std::min(min_list_size, lists[l].size);
   }
 
-  vector<Index::Item> results;
-  // TODO(esawin): Shouldn't this be the size of the smallest list?
-  results.reserve(num_lists * max_list_size);
+  results->reserve(num_lists * min_list_size);
   while (queue.size()) {
     const int record_id = queue.top().first;
     const int list = queue.top().second;
     queue.pop();
-    if (results.size() && results.back().record_id == record_id) {
+    const Index::Item& item = lists[list][indices[list]];
+    if (results->size() && results->back().record_id == record_id) {
       // Current item is another match for an approved intersection.
-      results.push_back((*lists[list])[indices[list]]);
+      results->push_back({record_id, ItemScore(lists[list], indices[list]),
+                          &item});
     } else {
       // Test whether the item itersects.
       size_t l = 0;
-      while (l < num_lists && (*lists[l])[indices[l]].record_id == record_id) {
+      while (l < num_lists && lists[l][indices[l]].record_id == record_id) {
         ++l;
       }
-      if (l == num_lists) {
+      if (l == num_lists && !index_.IsDeleted(record_id)) {
         // Intersection found; add the current item to the results.
         ++last_num_records_;
-        results.push_back((*lists[list])[indices[list]]);
+        results->push_back({record_id, ItemScore(lists[list], indices[list]),
+                            &item});
       }
     }
-    if (indices[list] + 1u < lists[list]->size()) {
+    if (indices[list] + 1u < lists[list].size) {
       // Increment the list index for active list.
-      queue.push(make_pair((*lists[list])[++indices[list]].record_id, list));
+      queue.push(std::make_pair(lists[list][++indices[list]].record_id, list));
     }
   }
-  return results;
+}
+
+QueryProcessor::RecordIterator::RecordIterator(const vector<Match>& matches)
+    : first_(matches.data()),
+      beg_(matches.data() + matches.size()),
+      end_(beg_) {
+  Next();
+}
+
+bool QueryProcessor::RecordIterator::Valid() const {
+  return beg_ != end_;
+}
+
+void QueryProcessor::RecordIterator::Next() {
+  // The records are stored in reversed order.
+  end_ = beg_;
+  if (beg_ == first_) {
+    return;
+  }
+  const int record_id = (beg_ - 1)->record_id;
+  while (beg_ != first_ && (beg_ - 1)->record_id == record_id) {
+    --beg_;
+  }
+}
+
+int QueryProcessor::RecordIterator::RecordId() const {
+  assert(Valid());
+  return beg_->record_id;
+}
+
+float QueryProcessor::RecordIterator::Score() const {
+  assert(Valid());
+  return beg_->score;
+}
+
+auto QueryProcessor::RecordIterator::begin() const -> const Match* {
+  return beg_;
+}
+
+auto QueryProcessor::RecordIterator::end() const -> const Match* {
+  return end_;
 }
 
 size_t QueryProcessor::LastRecordsFound() const {
@@ -5,20 +5,79 @@
 #include <string>
 #include <vector>
 #include "./index.h"
+#include "./segmented-index.h"
+#include "./arena.h"
 #include "./clock.h"
 
 // Query processor based on an inverted index.
 class QueryProcessor {
  public:
+  // A lightweight reference to a matching item of a ranked record.
+  struct Match {
+    int record_id;
+    float score;
+    const Index::Item* item;
+  };
+
+  // Iterates over the ranked records of a matches list as written by Answer,
+  // best record first. Each record spans a consecutive range of matches,
+  // whose items are only accessed on demand, e.g. for snippet generation.
+  class RecordIterator {
+   public:
+    explicit RecordIterator(const std::vector<Match>& matches);
+
+    // Returns whether the iterator points to a record.
+    bool Valid() const;
+
+    // Moves on to the next best record.
+    void Next();
+
+    // Returns the id of the current record.
+    int RecordId() const;
+
+    // Returns the score of the current record.
+    float Score() const;
+
+    // Returns the range of matches for the current record.
+    const Match* begin() const;
+    const Match* end() const;
+
+   private:
+    const Match* first_;
+    const Match* beg_;
+    const Match* end_;
+  };
+
+  // Marks the last query keyword as a prefix, when appended to it.
+  static const char kPrefixMark;
+
   // Initializes the query processor for given index.
   explicit QueryProcessor(const Index& index);
 
-  // Returns the best matching record ids for given query.
+  // Returns the best matching record ids for given query, whose keywords are
+  // the terms given by the index analyzer.
   // The items are sorted by score in reversed order. There is one item per
-  // record for each keyword considered.
+  // record for each keyword considered. If the last keyword ends with the
+  // prefix mark, it matches all keywords starting with it, which requires the
+  // prefix index.
   std::vector<Index::Item> Answer(const std::string& query,
                                   const size_t max_num_records) const;
 
+  // Writes the best matching items for given query to the matches list in the
+  // same order as above. The matches reference the index items and carry the
+  // record score. Uses a per-thread arena for all intermediate results; given
+  // a reused matches list there are no heap allocations in steady state.
+  void Answer(const std::string& query, const size_t max_num_records,
+              std::vector<Match>* matches) const;
+
+  // Writes the best matching items for given query across all segments of the
+  // snapshot to the matches list in the same order as above. The matches
+  // carry global record ids, their items belong to the segment indices, see
+  // SegmentedIndex. Returns the number of records found.
+  static size_t Answer(const SegmentedIndex::Snapshot& snapshot,
+                       const std::string& query, const size_t max_num_records,
+                       std::vector<Match>* matches);
+
   // Returns the best matching items ranked by the score.
   // The result is sorted by score in reversed order.
   // The number of keywords parameter is only used as a hint for efficiency.
@@ -33,11 +92,54 @@ class QueryProcessor {
   Clock::Diff LastDuration() const;
 
  private:
-  // Intersects inverted lists and returns the result list.
-  std::vector<Index::Item> Intersect(
-      const std::vector<const std::vector<Index::Item>*>& lists) const;
+  // A list of items sorted by record id. It either references the items of a
+  // keyword directly or indirectly, e.g. when merged for a prefix. The
+  // inverse record frequencies are only used for scoring at query time, per
+  // reference for merged lists.
+  struct PostingList {
+    const Index::Item& operator[](const size_t i) const {
+      return refs ? *refs[i] : items[i];
+    }
+
+    const Index::Item* items;
+    const Index::Item* const* refs;
+    size_t size;
+    float inv_record_freq;
+    const float* inv_record_freqs;
+  };
+
+  // Initializes the query processor for given segment of the snapshot, which
+  // scores the items at query time by the snapshot statistics.
+  QueryProcessor(const Index& index, const SegmentedIndex::Snapshot* snapshot);
+
+  // Returns the inverse record frequency of given keyword, see Index::Bm25.
+  // Requires the snapshot.
+  float InvRecordFreq(const char* keyword, const size_t size) const;
+
+  // Returns the score of the i-th item of given list, which is either the
+  // precomputed item score or the snapshot-wide BM25 score.
+  float ItemScore(const PostingList& list, const size_t i) const;
+
+  // Appends the posting list for all keywords with given prefix. The merged
+  // references are allocated in the arena.
+  void AddPrefixList(const char* prefix, const size_t size,
+                     const size_t max_num_records, Arena* arena,
+                     ArenaVector<PostingList>* lists) const;
+
+  // Intersects posting lists and writes the matching items of live records to
+  // given list.
+  void Intersect(const ArenaVector<PostingList>& lists, Arena* arena,
+                 ArenaVector<Match>* results) const;
+
+  // Writes the best matching items ranked by the record score to given list.
+  void Rank(const Match* matches, const size_t num_matches,
+            const size_t max_num_records, const size_t num_keywords,
+            Arena* arena, std::vector<Match>* results) const;
 
   const Index& index_;
+  // The snapshot of the segment for scoring at query time, if any.
+  const SegmentedIndex::Snapshot* snapshot_;
+  float inv_avg_record_size_;
   mutable size_t last_num_records_;
   mutable Clock::Diff last_duration_;
 };
@@ -0,0 +1,140 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "./record-store.h"
+
+using std::vector;
+using std::string;
+
+class RecordStoreTest : public ::testing::Test {
+ public:
+  void SetUp() {
+  }
+
+  void TearDown() {
+  }
+
+  // Returns the given string after compression and decompression.
+  static string RoundTrip(const string& raw) {
+    string compressed;
+    RecordStore::Compress(raw.data(), raw.size(), &compressed);
+    string decompressed = "garbage";
+    RecordStore::Decompress(compressed.data(), compressed.size(), raw.size(),
+                            &decompressed);
+    return decompressed;
+  }
+};
+
+TEST_F(RecordStoreTest, Codec) {
+  EXPECT_EQ("", RoundTrip(""));
+  EXPECT_EQ("a", RoundTrip("a"));
+  EXPECT_EQ("abcd", RoundTrip("abcd"));
+  EXPECT_EQ("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+            RoundTrip("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"));
+  // The block ends with 5 literals, following a single overlapping match.
+  string compressed;
+  RecordStore::Compress(string(30u, 'a').data(), 30u, &compressed);
+  EXPECT_EQ(string("\x1f" "a" "\x01\x00" "\x05" "\x50" "aaaaa", 11u),
+            compressed);
+  EXPECT_EQ("Tesla once said that if Edison had to find a needle in a "
+            "haystack he would take apart the haystack one straw at a time.",
+            RoundTrip("Tesla once said that if Edison had to find a needle in "
+                      "a haystack he would take apart the haystack one straw "
+                      "at a time."));
+  string repeated;
+  for (int i = 0; i < 1000; ++i) {
+    repeated += "Nikola Tesla " + std::to_string(i % 37) + ", ";
+  }
+  compressed.clear();
+  RecordStore::Compress(repeated.data(), repeated.size(), &compressed);
+  EXPECT_LT(compressed.size() * 4u, repeated.size());
+  EXPECT_EQ(repeated, RoundTrip(repeated));
+
+  std::mt19937 engine(73);
+  string random;
+  for (int i = 0; i < 100000; ++i) {
+    random += static_cast<char>(engine() % 256);
+  }
+  EXPECT_EQ(random, RoundTrip(random));
+}
+
+TEST_F(RecordStoreTest, Records) {
+  for (size_t cache_size = 0; cache_size < 3; ++cache_size) {
+    RecordStore store(64u, cache_size);
+    vector<string> contents;
+    for (int i = 0; i < 100; ++i) {
+      contents.push_back("Record " + std::to_string(i) + " is about Tesla.");
+      EXPECT_EQ(i, store.Add(contents.back()));
+      if (i % 3 == 0) {
+        contents.back() += " And Edison.";
+        store.Extend(" And Edison.");
+      }
+    }
+    ASSERT_EQ(100, store.NumRecords());
+    EXPECT_LT(10, store.NumBlocks());
+    string content;
+    // Access the records in an order thrashing the cache.
+    for (int i = 0; i < 100; ++i) {
+      const int id = (i * 37) % 100;
+      store.Content(id, &content);
+      EXPECT_EQ(contents[id], content);
+      EXPECT_EQ(contents[id].size(), store.ContentSize(id));
+    }
+  }
+}
+
+TEST_F(RecordStoreTest, ConcurrentContent) {
+  // Readers share the cache, which holds less blocks than they access.
+  RecordStore store(64u, 2u);
+  vector<string> contents;
+  for (int i = 0; i < 200; ++i) {
+    contents.push_back("Record " + std::to_string(i) + " is about Tesla.");
+    store.Add(contents.back());
+  }
+  vector<std::thread> readers;
+  vector<int> num_errors(4u, 0);
+  for (size_t t = 0; t < num_errors.size(); ++t) {
+    readers.push_back(std::thread([&store, &contents, &num_errors, t]() {
+      string content;
+      for (int i = 0; i < 20000; ++i) {
+        const int id = (i * 37 + t * 11) % contents.size();
+        store.Content(id, &content);
+        num_errors[t] += content != contents[id];
+      }
+    }));
+  }
+  for (std::thread& reader: readers) {
+    reader.join();
+  }
+  EXPECT_EQ(vector<int>(num_errors.size(), 0), num_errors);
+}
+
+TEST_F(RecordStoreTest, Purge) {
+  RecordStore store(64u);
+  vector<string> contents;
+  for (int i = 0; i < 50; ++i) {
+    contents.push_back("Record " + std::to_string(i) + " is about Tesla.");
+    store.Add(contents.back());
+  }
+  const vector<int> purged = {0, 7, 8, 30, 49};
+  for (const int id: purged) {
+    contents[id].clear();
+  }
+  const size_t stored_size = store.StoredSize();
+  store.Purge(purged);
+  ASSERT_EQ(50, store.NumRecords());
+  EXPECT_GT(stored_size, store.StoredSize());
+  string content;
+  for (int i = 0; i < 50; ++i) {
+    store.Content(i, &content);
+    EXPECT_EQ(contents[i], content);
+  }
+  // New records are appended as before.
+  EXPECT_EQ(50, store.Add("Edison"));
+  store.Content(50, &content);
+  EXPECT_EQ("Edison", content);
+}
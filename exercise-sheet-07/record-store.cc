@@ -0,0 +1,281 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include "./record-store.h"
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+using std::string;
+using std::vector;
+
+const size_t RecordStore::kDefBlockSize = 64u * 1024u;
+const size_t RecordStore::kDefCacheSize = 16u;
+
+// The minimum match length of the codec.
+static const size_t kMinMatch = 4u;
+// The maximum match offset of the codec.
+static const size_t kMaxOffset = 65535u;
+// The number of bytes at the end of a block, which are always literals.
+static const size_t kLastLiterals = 5u;
+// The last match starts at least this number of bytes before the block end.
+static const size_t kMatchFindLimit = 12u;
+// Number of bits used for the match finder hash table.
+static const int kHashBits = 14;
+
+// Reads 4 bytes without alignment requirements.
+static inline uint32_t Read32(const char* src) {
+  uint32_t value;
+  std::memcpy(&value, src, sizeof(value));
+  return value;
+}
+
+// Appends the length exceeding the token nibble as a sequence of 255 bytes
+// and a terminating remainder byte.
+static inline void AppendLength(size_t length, string* dst) {
+  while (length >= 255u) {
+    dst->push_back(static_cast<char>(255u));
+    length -= 255u;
+  }
+  dst->push_back(static_cast<char>(length));
+}
+
+// Appends a sequence of literals followed by a match. The last sequence has
+// no match, which is indicated by a match length of 0.
+static void AppendSequence(const char* literals, const size_t num_literals,
+                           const size_t offset, const size_t match_size,
+                           string* dst) {
+  const size_t match_code = match_size ? match_size - kMinMatch : 0u;
+  const uint8_t token = (std::min<size_t>(num_literals, 15u) << 4) |
+                        std::min<size_t>(match_code, 15u);
+  dst->push_back(static_cast<char>(token));
+  if (num_literals >= 15u) {
+    AppendLength(num_literals - 15u, dst);
+  }
+  dst->append(literals, num_literals);
+  if (match_size == 0u) {
+    return;
+  }
+  dst->push_back(static_cast<char>(offset & 255u));
+  dst->push_back(static_cast<char>(offset >> 8));
+  if (match_code >= 15u) {
+    AppendLength(match_code - 15u, dst);
+  }
+}
+
+// Reads a length continued after a full token nibble.
+static inline size_t ReadLength(const uint8_t** src) {
+  size_t length = 0u;
+  uint8_t byte = 255u;
+  while (byte == 255u) {
+    byte = *(*src)++;
+    length += byte;
+  }
+  return length;
+}
+
+void RecordStore::Compress(const char* src, const size_t size, string* dst) {
+  assert(dst);
+  vector<int> table(1u << kHashBits, -1);
+  size_t anchor = 0u;
+  size_t pos = 0u;
+  while (pos + kMatchFindLimit <= size) {
+    const uint32_t seq = Read32(src + pos);
+    const uint32_t hash = (seq * 2654435761u) >> (32 - kHashBits);
+    const int candidate = table[hash];
+    table[hash] = pos;
+    if (candidate < 0 || pos - candidate > kMaxOffset ||
+        Read32(src + candidate) != seq) {
+      ++pos;
+      continue;
+    }
+    // Found a match, extend it as far as possible, short of the last literals.
+    size_t match_size = kMinMatch;
+    while (pos + match_size < size - kLastLiterals &&
+           src[candidate + match_size] == src[pos + match_size]) {
+      ++match_size;
+    }
+    AppendSequence(src + anchor, pos - anchor, pos - candidate, match_size,
+                   dst);
+    pos += match_size;
+    anchor = pos;
+  }
+  // The remaining bytes are literals, at least the last ones of the block.
+  AppendSequence(src + anchor, size - anchor, 0u, 0u, dst);
+}
+
+void RecordStore::Decompress(const char* src, const size_t size,
+                             const size_t raw_size, string* dst) {
+  assert(dst);
+  dst->resize(raw_size);
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+  const uint8_t* in_end = in + size;
+  char* out = &(*dst)[0];
+  char* out_end = out + raw_size;
+  while (in < in_end) {
+    const uint8_t token = *in++;
+    size_t num_literals = token >> 4;
+    if (num_literals == 15u) {
+      num_literals += ReadLength(&in);
+    }
+    assert(out + num_literals <= out_end);
+    std::memcpy(out, in, num_literals);
+    out += num_literals;
+    in += num_literals;
+    if (in >= in_end) {
+      // The last sequence has no match.
+      break;
+    }
+    const size_t offset = in[0] | (in[1] << 8);
+    in += 2;
+    size_t match_size = token & 15u;
+    if (match_size == 15u) {
+      match_size += ReadLength(&in);
+    }
+    match_size += kMinMatch;
+    assert(out + match_size <= out_end);
+    // Matches may overlap with the output, copy byte-wise.
+    const char* match = out - offset;
+    for (size_t i = 0; i < match_size; ++i) {
+      out[i] = match[i];
+    }
+    out += match_size;
+  }
+  assert(out == out_end);
+}
+
+RecordStore::RecordStore(const size_t block_size, const size_t cache_size)
+    : block_size_(block_size),
+      cache_size_(cache_size),
+      raw_size_(0u),
+      num_uses_(0u) {}
+
+int RecordStore::Add(const string& content) {
+  if (open_block_.size() >= block_size_) {
+    // The previous record is complete, the block can be sealed.
+    Seal();
+  }
+  record_blocks_.push_back(block_sizes_.size());
+  record_offsets_.push_back(open_block_.size());
+  record_sizes_.push_back(content.size());
+  open_block_ += content;
+  raw_size_ += content.size();
+  return record_sizes_.size() - 1;
+}
+
+void RecordStore::Extend(const string& content) {
+  assert(record_sizes_.size());
+  assert(record_blocks_.back() == block_sizes_.size());
+  record_sizes_.back() += content.size();
+  open_block_ += content;
+  raw_size_ += content.size();
+}
+
+void RecordStore::Purge(const vector<int>& record_ids) {
+  assert(std::is_sorted(record_ids.begin(), record_ids.end()));
+  RecordStore store(block_size_, cache_size_);
+  string content;
+  auto purged = record_ids.begin();
+  for (size_t r = 0; r < NumRecords(); ++r) {
+    if (purged != record_ids.end() && *purged == static_cast<int>(r)) {
+      content.clear();
+      ++purged;
+    } else {
+      Content(r, &content);
+    }
+    store.Add(content);
+  }
+  // The store is not accessed concurrently while purging, replace all but the
+  // settings and the cache lock.
+  blocks_.swap(store.blocks_);
+  open_block_.swap(store.open_block_);
+  block_sizes_.swap(store.block_sizes_);
+  record_blocks_.swap(store.record_blocks_);
+  record_offsets_.swap(store.record_offsets_);
+  record_sizes_.swap(store.record_sizes_);
+  raw_size_ = store.raw_size_;
+  cache_.clear();
+  string().swap(uncached_block_);
+}
+
+void RecordStore::Seal() {
+  string block;
+  Compress(open_block_.data(), open_block_.size(), &block);
+  block.shrink_to_fit();
+  blocks_.push_back(std::move(block));
+  block_sizes_.push_back(open_block_.size());
+  open_block_.clear();
+}
+
+auto RecordStore::Block(const int block_id) const -> const string& {
+  assert(block_id >= 0 && block_id < static_cast<int>(blocks_.size()));
+  const string& block = blocks_[block_id];
+  ++num_uses_;
+  if (cache_size_ == 0u) {
+    Decompress(block.data(), block.size(), block_sizes_[block_id],
+               &uncached_block_);
+    return uncached_block_;
+  }
+  CacheEntry* lru = 0;
+  for (CacheEntry& entry: cache_) {
+    if (entry.block_id == block_id) {
+      entry.last_use = num_uses_;
+      return entry.data;
+    }
+    if (!lru || entry.last_use < lru->last_use) {
+      lru = &entry;
+    }
+  }
+  if (cache_.size() < cache_size_) {
+    cache_.push_back({block_id, 0u, string()});
+    lru = &cache_.back();
+  }
+  // Replace the least recently used block.
+  lru->block_id = block_id;
+  lru->last_use = num_uses_;
+  Decompress(block.data(), block.size(), block_sizes_[block_id], &lru->data);
+  return lru->data;
+}
+
+void RecordStore::Content(const int record_id, string* content) const {
+  assert(content);
+  assert(record_id >= 0 && record_id < static_cast<int>(NumRecords()));
+  const uint32_t block_id = record_blocks_[record_id];
+  if (block_id == block_sizes_.size()) {
+    content->assign(open_block_, record_offsets_[record_id],
+                    record_sizes_[record_id]);
+    return;
+  }
+  // The cached block may be replaced by other readers after unlocking.
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  content->assign(Block(block_id), record_offsets_[record_id],
+                  record_sizes_[record_id]);
+}
+
+size_t RecordStore::ContentSize(const int record_id) const {
+  assert(record_id >= 0 && record_id < static_cast<int>(NumRecords()));
+  return record_sizes_[record_id];
+}
+
+size_t RecordStore::NumRecords() const {
+  return record_sizes_.size();
+}
+
+size_t RecordStore::NumBlocks() const {
+  return block_sizes_.size() + 1u;
+}
+
+size_t RecordStore::RawSize() const {
+  return raw_size_;
+}
+
+size_t RecordStore::StoredSize() const {
+  size_t size = open_block_.capacity() + blocks_.capacity() * sizeof(string);
+  for (const string& block: blocks_) {
+    size += block.capacity();
+  }
+  return size + (block_sizes_.capacity() + record_blocks_.capacity() +
+          record_offsets_.capacity() + record_sizes_.capacity()) *
+         sizeof(uint32_t);
+}
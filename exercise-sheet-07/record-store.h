@@ -0,0 +1,100 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#ifndef EXERCISE_SHEET_07_RECORD_STORE_H_
+#define EXERCISE_SHEET_07_RECORD_STORE_H_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Document store keeping the record contents in compressed blocks. Records
+// are appended to an open block, which is compressed once it exceeds the
+// block size. Records never span multiple blocks. Recently decompressed
+// blocks are kept in a small LRU cache. Content access is thread-safe, the
+// cache is guarded by a mutex, while adding records requires exclusive access.
+class RecordStore {
+ public:
+  // The default minimum uncompressed block size in bytes.
+  static const size_t kDefBlockSize;
+
+  // The default number of decompressed blocks cached.
+  static const size_t kDefCacheSize;
+
+  // Compresses the given bytes and appends them to the destination, using an
+  // LZ77 byte codec following the LZ4 block format and its end of block rules.
+  static void Compress(const char* src, const size_t size, std::string* dst);
+
+  // Decompresses the given bytes into the destination, which is resized to
+  // the given uncompressed size.
+  static void Decompress(const char* src, const size_t size,
+                         const size_t raw_size, std::string* dst);
+
+  // Initializes the store with given block and cache sizes. A cache size of
+  // 0 disables caching.
+  explicit RecordStore(const size_t block_size = kDefBlockSize,
+                       const size_t cache_size = kDefCacheSize);
+
+  // Adds the content of a new record. Returns the new record id.
+  int Add(const std::string& content);
+
+  // Appends the content to the last record added.
+  void Extend(const std::string& content);
+
+  // Rebuilds the store without the contents of the records with given ids,
+  // sorted in ascending order. The record ids are kept, the purged records
+  // have empty contents.
+  void Purge(const std::vector<int>& record_ids);
+
+  // Writes the content of the record with given id to the given string.
+  void Content(const int record_id, std::string* content) const;
+
+  // Returns the content size of the record with given id.
+  size_t ContentSize(const int record_id) const;
+
+  // Returns the number of records stored.
+  size_t NumRecords() const;
+
+  // Returns the number of blocks, including the open one.
+  size_t NumBlocks() const;
+
+  // Returns the total uncompressed size of all records.
+  size_t RawSize() const;
+
+  // Returns the memory used by the compressed blocks, the open block and the
+  // record tables.
+  size_t StoredSize() const;
+
+ private:
+  // A decompressed block held in the cache.
+  struct CacheEntry {
+    int block_id;
+    uint64_t last_use;
+    std::string data;
+  };
+
+  // Compresses the open block and starts a new one.
+  void Seal();
+
+  // Returns the uncompressed data of the sealed block with given id, which is
+  // valid until the next call. Requires the cache lock.
+  const std::string& Block(const int block_id) const;
+
+  size_t block_size_;
+  size_t cache_size_;
+  std::vector<std::string> blocks_;
+  std::string open_block_;
+  // Uncompressed size of each sealed block.
+  std::vector<uint32_t> block_sizes_;
+  // Block id and offset within the block for each record.
+  std::vector<uint32_t> record_blocks_;
+  std::vector<uint32_t> record_offsets_;
+  std::vector<uint32_t> record_sizes_;
+  size_t raw_size_;
+  // Guards the cache, the uncached block and the use counter.
+  mutable std::mutex cache_mutex_;
+  mutable std::vector<CacheEntry> cache_;
+  mutable std::string uncached_block_;
+  mutable uint64_t num_uses_;
+};
+
+#endif  // EXERCISE_SHEET_07_RECORD_STORE_H_
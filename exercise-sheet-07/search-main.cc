@@ -5,10 +5,11 @@
 #include <vector>
 #include <fstream>
 #include <sstream>
-#include <queue>
 #include <limits>
+#include <algorithm>
 #include "./index.h"
 #include "./query-processor.h"
+#include "./snippet.h"
 #include "./profiler.h"
 #include "./clock.h"
 
@@ -16,8 +17,6 @@ using std::vector;
 using std::string;
 using std::ifstream;
 using std::ostream;
-using std::pair;
-using std::make_pair;
 
 // 0: all off, 1: bold, 4: underscore, 5: blinking, 7: reversed, 8: concealed
 // 3x: text, 4x: background
@@ -27,6 +26,10 @@ static const char* kBoldText = "\033[1m";
 static const char* kUnderscoreText = "\033[4m";
 // The default n-gram value for n.
 static const int kNGramN = 3;
+// The number of top records precomputed for frequent prefixes.
+static const size_t kPrefixTopK = 10u;
+// The size of the record snippets shown in characters.
+static const size_t kSnippetSize = 160u;
 
 // Returns the file size of given file. Returns 0, if the file is not found.
 size_t FileSize(const string& path) {
@@ -56,76 +59,6 @@ void WriteUrlScore(const Index::Record& record, const float score,
   *stream << record.url << " (" << score << ")\n";
 }
 
-// Writes the given record to the given stream, highlighting the given matches.
-// Matches are given as (position, size) pairs.
-void WriteRecord(const Index::Record& record, const float score,
-                 const vector<pair<size_t, size_t> >& matches,
-                 ostream* stream) {
-  WriteUrlScore(record, score, stream);
-  std::priority_queue<pair<int, int>, vector<pair<int, int> >,
-                      std::greater<pair<int, int> > > queue;
-  for (auto it = matches.cbegin(), end = matches.cend();
-       it != end; ++it) {
-    queue.push(*it);
-  }
-  size_t pos = 0u;
-  while (queue.size()) {
-    const size_t match_beg = queue.top().first;
-    const size_t match_size = queue.top().second;
-    queue.pop();
-    if (pos <= match_beg) {
-      *stream << record.content.substr(pos, match_beg - pos)
-              << kBoldText << record.content.substr(match_beg, match_size)
-              << kResetMode;
-    }
-    pos = match_beg + match_size;
-  }
-  if (pos < record.content.size()) {
-    *stream << record.content.substr(pos, record.content.size() - pos);
-  }
-}
-
-// Writes the snippets of given record to the given stream,
-// highlighting the given matches.
-// Matches are given as (position, size) pairs.
-// TODO(esawin): Shorten output, make it digestible.
-void WriteRecordSnippets(const Index::Record& record, const float score,
-                         const vector<pair<size_t, size_t> >& matches,
-                         const size_t offset,
-                         ostream* stream) {
-  WriteUrlScore(record, score, stream);
-  std::priority_queue<pair<int, int>, vector<pair<int, int> >,
-                      std::greater<pair<int, int> > > queue;
-  for (auto it = matches.cbegin(), end = matches.cend();
-       it != end; ++it) {
-    queue.push(*it);
-  }
-  size_t next_end = 0u;
-  size_t pos = 0u;
-  while (queue.size()) {
-    const size_t match_beg = queue.top().first;
-    const size_t match_size = queue.top().second;
-    queue.pop();
-    if (next_end < match_beg - offset) {
-      *stream << record.content.substr(pos, next_end - pos) << " ... ";
-      pos = next_end;
-    }
-    if (pos <= match_beg) {
-      const size_t beg = std::max(static_cast<int>(pos),
-                                  static_cast<int>(match_beg) -
-                                  static_cast<int>(offset));
-      *stream << record.content.substr(beg, match_beg - beg)
-              << kBoldText << record.content.substr(match_beg, match_size)
-              << kResetMode;
-      next_end = match_beg + match_size + offset;
-    }
-    pos = match_beg + match_size;
-  }
-  if (pos < next_end) {
-    *stream << record.content.substr(pos, next_end - pos);
-  }
-}
-
 // Main function.
 int main(int argc, char** argv) {
   using std::cout;
@@ -176,6 +109,8 @@ int main(int argc, char** argv) {
   Index::AddRecordsFromCsv(file_content, &index);
   index.ComputeScores(bm25_b, bm25_k);
   index.BuildNGrams(ngram_n);
+  index.BuildPrefixIndex(kPrefixTopK);
+  index.FreezeKeywords();
   auto end = Clock();
   Profiler::Stop();
   auto diff = end - start;
@@ -183,12 +118,20 @@ int main(int argc, char** argv) {
        << "\nNumber of items: " << index.NumItems()
        << "\nIndex construction time: " << diff
        << "\nNumber of bytes repaired: " << num_repaired
+       << "\nRecord store size: " << index.Records().StoredSize() << " of "
+       << index.Records().RawSize() << " bytes in "
+       << index.Records().NumBlocks() << " blocks"
        << "\nShow top " << max_num_records << " results"
        << "\nN-gram value: " << ngram_n
        << "\nBM25 parameters: b = " << bm25_b << ", k = " << bm25_k
+       << "\nEnd the last word with " << QueryProcessor::kPrefixMark
+       << " to search for its completions"
        << "\nType q to quit\n";
 
   QueryProcessor proc(index);
+  vector<QueryProcessor::Match> results;
+  vector<Index::PosSize> matches;
+  string content;
   while (true) {
     string query;
     // Get user query.
@@ -202,7 +145,7 @@ int main(int argc, char** argv) {
     }
 
     // Process query, get matching records.
-    vector<Index::Item> results = proc.Answer(query, max_num_records);
+    proc.Answer(query, max_num_records, &results);
     const size_t records_found = proc.LastRecordsFound();
     auto const duration = proc.LastDuration();
     if (results.size() == 0) {
@@ -215,39 +158,30 @@ int main(int argc, char** argv) {
            << duration << "\n";
     }
 
-    size_t num_records = 0;
-    vector<pair<size_t, size_t> > matches;
-    int prev_record_id = Index::kInvalidId;
-    float prev_score = 0;
-    const size_t num_show_records = std::min(records_found, max_num_records);
-    // Iterate over results to output all matching records.
-    // Result items are sorted by record ids, with one item for each keyword
-    // occurrence.
-    while (num_records < num_show_records) {
-      if ((results.size() &&
-           results.back().record_id != prev_record_id &&
-           matches.size()) ||
-          results.empty()) {
-        // Found new/last record id, so we output the matches for the previous
-        // record id.
-        const Index::Record& record = index.RecordById(prev_record_id);
-        // WriteRecordSnippets(record, prev_score, matches, 20u, &cout);
-        WriteUrlScore(record, prev_score, &cout);
-        ++num_records;
-        matches.clear();
-      }
-      if (results.size()) {
-        // Remember the keyword occurrence until all occurrences are
-        // collected for the current record id.
-        const Index::Item& item = results.back();
-        for (auto it = item.positions.cbegin(), end = item.positions.cend();
-             it != end; ++it) {
-          matches.push_back(make_pair(*it, item.size));
+    // Iterate over the ranked records and output them, the keyword positions
+    // and the record contents are only fetched for the records shown.
+    auto const snippets_beg = Clock();
+    for (QueryProcessor::RecordIterator it(results); it.Valid(); it.Next()) {
+      const Index::Record& record = index.RecordById(it.RecordId());
+      matches.clear();
+      for (const QueryProcessor::Match& match: it) {
+        for (const size_t pos: match.item->positions) {
+          matches.push_back({pos, match.item->size});
         }
-        prev_record_id = item.record_id;
-        prev_score = item.score;
-        results.pop_back();
       }
+      std::sort(matches.begin(), matches.end(),
+          [](const Index::PosSize& lhs, const Index::PosSize& rhs) {
+        return lhs.pos < rhs.pos;
+      });
+      index.RecordContent(it.RecordId(), &content);
+      index.SetTokenSizes(content, &matches);
+      WriteUrlScore(record, it.Score(), &cout);
+      Snippet::Write(content, matches, kSnippetSize, kBoldText, kResetMode,
+                     &cout);
+      cout << "\n";
+    }
+    if (results.size()) {
+      cout << "Snippets generated in " << Clock() - snippets_beg << "\n";
     }
   }
   cout << "Bye!" << endl;
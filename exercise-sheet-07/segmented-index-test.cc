@@ -0,0 +1,178 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "./segmented-index.h"
+#include "./query-processor.h"
+
+using std::vector;
+using std::string;
+using std::shared_ptr;
+
+class SegmentedIndexTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    records_ = {
+      {"Jook_Walraven", "To keep the atomic hydrogen from forming hydrogen "
+                        "molecules, the atoms were spin-polarized by a 7 "
+                        "tesla magnet."},
+      {"Nikola_Tesla1", "Legacy and honors The tesla (symbol T) compound "
+                        "derived SI unit of magnetic flux density."},
+      {"Nikola_Tesla2", "Legacy and honors Google honoured Tesla on his "
+                        "birthday by displaying a doodle, that showed the G "
+                        "as a tesla coil."},
+      {"Benjamin_Lamme", "After Nikola Tesla left Westinghouse, Lamme "
+                         "redesigned the induction motor."},
+      {"Thomas_Edison1", "Tesla once said that if Edison had to find a "
+                         "needle in a haystack he would take apart the "
+                         "haystack one straw at a time."},
+      {"Thomas_Edison2", "Tesla who had once worked for Edison quit when he "
+                         "was promised a large bonus."},
+      {"Tesla_Coil", "A Tesla coil is an electrical resonant transformer "
+                     "circuit designed by Nikola Tesla in 1891."},
+      {"Hydrogen", "Hydrogen is the chemical element with symbol H."}
+    };
+    queries_ = {"tesla", "Tesla Edison", "hydrogen", "the", "legacy hon*",
+                "t*", "Nikola tesla", "unknown", ""};
+    // The single index over all records, scored like the snapshots.
+    for (const vector<string>& record: records_) {
+      index_.AddRecordAndItems(record[0], record[1]);
+    }
+    index_.ComputeScores(SegmentedIndex::kDefaultBm25B,
+                         SegmentedIndex::kDefaultBm25K);
+    index_.BuildPrefixIndex(10u);
+    index_.FreezeKeywords();
+  }
+
+  void TearDown() {
+  }
+
+  // Checks the answers on given snapshot against the single index answers.
+  void CheckAnswers(const SegmentedIndex::Snapshot& snapshot) const {
+    ASSERT_EQ(records_.size(), snapshot.NumRecords());
+    for (const string& query: queries_) {
+      for (const size_t max_num_records: {1u, 3u, 100u}) {
+        vector<QueryProcessor::Match> expected;
+        QueryProcessor(index_).Answer(query, max_num_records, &expected);
+        vector<QueryProcessor::Match> matches;
+        QueryProcessor::Answer(snapshot, query, max_num_records, &matches);
+        ASSERT_EQ(expected.size(), matches.size()) << query;
+        for (size_t i = 0; i < matches.size(); ++i) {
+          EXPECT_EQ(expected[i].record_id, matches[i].record_id) << query;
+          EXPECT_EQ(expected[i].score, matches[i].score) << query;
+          EXPECT_EQ(expected[i].item->positions, matches[i].item->positions);
+        }
+      }
+    }
+  }
+
+  vector<vector<string> > records_;
+  vector<string> queries_;
+  Index index_;
+};
+
+TEST_F(SegmentedIndexTest, Records) {
+  // Disable the time-based refresh.
+  SegmentedIndex index(3u, Clock::kMicroInMin, 100u);
+  for (size_t i = 0; i < records_.size(); ++i) {
+    EXPECT_EQ(i, index.AddRecord(records_[i][0], records_[i][1]));
+  }
+  EXPECT_EQ(records_.size(), index.NumRecords());
+  index.Refresh();
+  shared_ptr<const SegmentedIndex::Snapshot> snapshot = index.CurrentSnapshot();
+  ASSERT_EQ(records_.size(), snapshot->NumRecords());
+  // The buffer is sealed into segments of the maximum size.
+  EXPECT_EQ(3u, snapshot->Segments().size());
+  string content;
+  for (size_t i = 0; i < records_.size(); ++i) {
+    EXPECT_EQ(records_[i][0], snapshot->RecordById(i).url);
+    snapshot->RecordContent(i, &content);
+    EXPECT_EQ(records_[i][1], content);
+  }
+  CheckAnswers(*snapshot);
+}
+
+TEST_F(SegmentedIndexTest, Merge) {
+  SegmentedIndex index(1u, Clock::kMicroInMin, 2u);
+  for (size_t i = 0; i < 4u; ++i) {
+    index.AddRecord(records_[i][0], records_[i][1]);
+    index.Refresh();
+  }
+  shared_ptr<const SegmentedIndex::Snapshot> old_snapshot =
+      index.CurrentSnapshot();
+  index.WaitForMerges();
+  ASSERT_EQ(1u, index.NumSegments());
+  EXPECT_EQ(2, index.CurrentSnapshot()->Segments()[0].tier);
+  for (size_t i = 4u; i < 7u; ++i) {
+    index.AddRecord(records_[i][0], records_[i][1]);
+    index.Refresh();
+  }
+  index.WaitForMerges();
+  shared_ptr<const SegmentedIndex::Snapshot> snapshot = index.CurrentSnapshot();
+  ASSERT_EQ(3u, snapshot->Segments().size());
+  EXPECT_EQ(2, snapshot->Segments()[0].tier);
+  EXPECT_EQ(1, snapshot->Segments()[1].tier);
+  EXPECT_EQ(0, snapshot->Segments()[2].tier);
+  EXPECT_EQ(4, snapshot->Segments()[1].base_id);
+  EXPECT_EQ(6, snapshot->Segments()[2].base_id);
+  EXPECT_EQ(1u, snapshot->SegmentIndex(5));
+  // The last record triggers a cascade of merges.
+  index.AddRecord(records_[7][0], records_[7][1]);
+  index.WaitForMerges();
+  snapshot = index.CurrentSnapshot();
+  ASSERT_EQ(1u, snapshot->Segments().size());
+  EXPECT_EQ(3, snapshot->Segments()[0].tier);
+  CheckAnswers(*snapshot);
+  // Old snapshots remain valid.
+  EXPECT_EQ(4u, old_snapshot->NumRecords());
+  EXPECT_EQ(records_[3][0], old_snapshot->RecordById(3).url);
+}
+
+TEST_F(SegmentedIndexTest, RefreshInterval) {
+  SegmentedIndex index(100u, Clock::kMicroInMilli, 2u);
+  for (const vector<string>& record: records_) {
+    index.AddRecord(record[0], record[1]);
+  }
+  // The records become searchable without explicit refresh.
+  auto const beg = std::chrono::steady_clock::now();
+  while (index.CurrentSnapshot()->NumRecords() < records_.size() &&
+         std::chrono::steady_clock::now() - beg < std::chrono::seconds(10)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  CheckAnswers(*index.CurrentSnapshot());
+}
+
+TEST_F(SegmentedIndexTest, ConcurrentSearch) {
+  SegmentedIndex index(4u, 100 * Clock::kMicroInMilli, 2u);
+  std::atomic<bool> done(false);
+  std::thread writer([&]() {
+    for (int i = 0; i < 200; ++i) {
+      const vector<string>& record = records_[i % records_.size()];
+      index.AddRecord(record[0], record[1]);
+    }
+    done = true;
+  });
+  vector<QueryProcessor::Match> matches;
+  while (!done) {
+    shared_ptr<const SegmentedIndex::Snapshot> snapshot =
+        index.CurrentSnapshot();
+    QueryProcessor::Answer(*snapshot, "tesla", 10u, &matches);
+    for (const QueryProcessor::Match& match: matches) {
+      ASSERT_GT(snapshot->NumRecords(), match.record_id);
+      EXPECT_EQ(records_[match.record_id % records_.size()][0],
+                snapshot->RecordById(match.record_id).url);
+    }
+  }
+  writer.join();
+  index.WaitForMerges();
+  EXPECT_EQ(200u, index.CurrentSnapshot()->NumRecords());
+  // Two of eight records contain the keyword.
+  EXPECT_EQ(50u, QueryProcessor::Answer(*index.CurrentSnapshot(), "hydrogen",
+                                        100u, &matches));
+  EXPECT_EQ(50u, matches.size());
+}
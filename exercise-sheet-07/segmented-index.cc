@@ -0,0 +1,255 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include "./segmented-index.h"
+#include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+using std::shared_ptr;
+using std::mutex;
+using std::lock_guard;
+using std::unique_lock;
+
+const size_t SegmentedIndex::kDefaultMergeFactor = 4u;
+const float SegmentedIndex::kDefaultBm25B = 0.75f;
+const float SegmentedIndex::kDefaultBm25K = 1.75f;
+
+SegmentedIndex::Snapshot::Snapshot()
+    : num_records_(0u),
+      total_size_(0u),
+      bm25_b_(kDefaultBm25B),
+      bm25_k_(kDefaultBm25K) {}
+
+auto SegmentedIndex::Snapshot::Segments() const -> const vector<Segment>& {
+  return segments_;
+}
+
+size_t SegmentedIndex::Snapshot::SegmentIndex(const int record_id) const {
+  assert(record_id >= 0 && static_cast<size_t>(record_id) < num_records_);
+  auto const it = std::upper_bound(segments_.begin(), segments_.end(),
+                                   record_id,
+      [](const int id, const Segment& segment) {
+    return id < segment.base_id;
+  });
+  return it - segments_.begin() - 1;
+}
+
+const Index::Record& SegmentedIndex::Snapshot::RecordById(
+    const int record_id) const {
+  const Segment& segment = segments_[SegmentIndex(record_id)];
+  return segment.index->RecordById(record_id - segment.base_id);
+}
+
+void SegmentedIndex::Snapshot::RecordContent(const int record_id,
+                                             string* content) const {
+  const Segment& segment = segments_[SegmentIndex(record_id)];
+  segment.index->RecordContent(record_id - segment.base_id, content);
+}
+
+size_t SegmentedIndex::Snapshot::NumRecords() const {
+  return num_records_;
+}
+
+size_t SegmentedIndex::Snapshot::TotalSize() const {
+  return total_size_;
+}
+
+size_t SegmentedIndex::Snapshot::RecordFreq(const char* keyword,
+                                            const size_t size) const {
+  size_t record_freq = 0u;
+  for (const Segment& segment: segments_) {
+    record_freq += segment.index->Items(keyword, size).size();
+  }
+  return record_freq;
+}
+
+float SegmentedIndex::Snapshot::Bm25B() const {
+  return bm25_b_;
+}
+
+float SegmentedIndex::Snapshot::Bm25K() const {
+  return bm25_k_;
+}
+
+SegmentedIndex::SegmentedIndex(const size_t max_segment_size,
+                               const Clock::Diff& refresh,
+                               const size_t merge_factor,
+                               const float bm25_b, const float bm25_k)
+    : max_segment_size_(max_segment_size),
+      refresh_(refresh),
+      merge_factor_(merge_factor),
+      bm25_b_(bm25_b),
+      bm25_k_(bm25_k),
+      next_id_(0),
+      pending_base_id_(0),
+      snapshot_(new Snapshot()),
+      stop_(false) {
+  assert(max_segment_size_ > 0u && merge_factor_ > 1u);
+  thread_ = std::thread(&SegmentedIndex::Run, this);
+}
+
+SegmentedIndex::~SegmentedIndex() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  thread_.join();
+}
+
+int SegmentedIndex::AddRecord(const string& url, const string& content) {
+  bool full = false;
+  int record_id = Index::kInvalidId;
+  {
+    lock_guard<mutex> lock(mutex_);
+    record_id = next_id_++;
+    pending_.push_back({url, content});
+    full = pending_.size() >= max_segment_size_;
+  }
+  if (full) {
+    // Let the background thread seal the segment.
+    wake_.notify_one();
+  }
+  return record_id;
+}
+
+void SegmentedIndex::Refresh() {
+  Seal();
+}
+
+void SegmentedIndex::WaitForMerges() {
+  Seal();
+  while (Merge()) {}
+}
+
+shared_ptr<const SegmentedIndex::Snapshot>
+SegmentedIndex::CurrentSnapshot() const {
+  lock_guard<mutex> lock(mutex_);
+  return snapshot_;
+}
+
+size_t SegmentedIndex::NumRecords() const {
+  lock_guard<mutex> lock(mutex_);
+  return next_id_;
+}
+
+size_t SegmentedIndex::NumSegments() const {
+  return CurrentSnapshot()->Segments().size();
+}
+
+void SegmentedIndex::Run() {
+  typedef std::chrono::steady_clock SteadyClock;
+
+  const std::chrono::microseconds interval(refresh_.value());
+  unique_lock<mutex> lock(mutex_);
+  while (!stop_) {
+    // Seal the buffer when it is full or the refresh interval elapsed.
+    wake_.wait_until(lock, SteadyClock::now() + interval, [this]() {
+      return stop_ || pending_.size() >= max_segment_size_;
+    });
+    if (stop_) {
+      break;
+    }
+    lock.unlock();
+    Seal();
+    while (Merge()) {}
+    lock.lock();
+  }
+}
+
+bool SegmentedIndex::Seal() {
+  lock_guard<mutex> seal_lock(seal_mutex_);
+  vector<PendingRecord> records;
+  int base_id = 0;
+  {
+    lock_guard<mutex> lock(mutex_);
+    if (pending_.empty()) {
+      return false;
+    }
+    records.swap(pending_);
+    base_id = pending_base_id_;
+    pending_base_id_ = next_id_;
+  }
+  // Build the segments without holding the lock.
+  vector<Segment> segments;
+  for (size_t beg = 0; beg < records.size(); beg += max_segment_size_) {
+    const size_t end = std::min(records.size(), beg + max_segment_size_);
+    shared_ptr<Index> index(new Index());
+    index->ReserveRecords(end - beg);
+    for (size_t r = beg; r < end; ++r) {
+      index->AddRecordAndItems(records[r].url, records[r].content);
+    }
+    Finalize(index.get());
+    segments.push_back({index, base_id + static_cast<int>(beg), 0});
+  }
+  lock_guard<mutex> lock(mutex_);
+  const size_t num_segments = snapshot_->segments_.size();
+  Publish(num_segments, num_segments, segments);
+  return true;
+}
+
+bool SegmentedIndex::Merge() {
+  lock_guard<mutex> merge_lock(merge_mutex_);
+  // Find the first run of segments of the same tier. Other threads only
+  // append segments, so the run stays in place.
+  const shared_ptr<const Snapshot> snapshot = CurrentSnapshot();
+  const vector<Segment>& segments = snapshot->segments_;
+  size_t beg = 0u;
+  size_t end = 0u;
+  for (size_t i = 0; i < segments.size() && end == 0u; ++i) {
+    if (segments[i].tier != segments[beg].tier) {
+      beg = i;
+    }
+    if (i + 1u - beg == merge_factor_) {
+      end = i + 1u;
+    }
+  }
+  if (end == 0u) {
+    return false;
+  }
+  // Rebuild the merged segment from the record contents.
+  shared_ptr<Index> index(new Index());
+  string content;
+  for (size_t s = beg; s < end; ++s) {
+    const Index& segment = *segments[s].index;
+    for (size_t r = 0; r < segment.NumRecords(); ++r) {
+      segment.RecordContent(r, &content);
+      index->AddRecordAndItems(segment.RecordById(r).url, content);
+    }
+  }
+  Finalize(index.get());
+  const Segment merged = {index, segments[beg].base_id, segments[beg].tier + 1};
+  lock_guard<mutex> lock(mutex_);
+  Publish(beg, end, vector<Segment>(1u, merged));
+  return true;
+}
+
+void SegmentedIndex::Finalize(Index* index) {
+  index->BuildPrefixIndex(0u);
+  index->FreezeKeywords();
+}
+
+void SegmentedIndex::Publish(const size_t beg, const size_t end,
+                             const vector<Segment>& segments) {
+  const vector<Segment>& current = snapshot_->segments_;
+  assert(beg <= end && end <= current.size());
+  Snapshot* snapshot = new Snapshot();
+  snapshot->segments_.reserve(current.size() - (end - beg) + segments.size());
+  snapshot->segments_.insert(snapshot->segments_.end(), current.begin(),
+                             current.begin() + beg);
+  snapshot->segments_.insert(snapshot->segments_.end(), segments.begin(),
+                             segments.end());
+  snapshot->segments_.insert(snapshot->segments_.end(), current.begin() + end,
+                             current.end());
+  // The statistics for scoring the items at query time.
+  for (const Segment& segment: snapshot->segments_) {
+    snapshot->num_records_ += segment.index->NumRecords();
+    snapshot->total_size_ += segment.index->TotalSize();
+  }
+  snapshot->bm25_b_ = bm25_b_;
+  snapshot->bm25_k_ = bm25_k_;
+  snapshot_.reset(snapshot);
+}
@@ -0,0 +1,162 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#ifndef EXERCISE_SHEET_07_SEGMENTED_INDEX_H_
+#define EXERCISE_SHEET_07_SEGMENTED_INDEX_H_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "./index.h"
+#include "./clock.h"
+
+// Incremental index consisting of immutable, append-only segments. New records
+// are buffered and sealed into a new segment, when the buffer reaches the
+// maximum segment size or the refresh interval elapsed. A background thread
+// seals the segments and merges them in tiers: whenever there are enough
+// consecutive segments of the same tier, they are replaced by a single segment
+// of the next tier, like in a log-structured merge tree.
+//
+// Searches operate on snapshots of the sealed segments, which are published
+// atomically and remain valid while referenced. Neither adding records nor
+// merging blocks searches. Records are identified by global ids, which are
+// assigned in the order of addition and remain stable across merges. The
+// segments are not scored, the items are scored at query time by BM25 with
+// the statistics of the whole snapshot, see QueryProcessor.
+class SegmentedIndex {
+ public:
+  // A sealed segment holding the records starting at given global id.
+  struct Segment {
+    std::shared_ptr<const Index> index;
+    int base_id;
+    int tier;
+  };
+
+  // A consistent view of all sealed segments, ordered by record ids.
+  class Snapshot {
+   public:
+    // Initializes an empty snapshot.
+    Snapshot();
+
+    // Returns the segments.
+    const std::vector<Segment>& Segments() const;
+
+    // Returns the index of the segment holding the record with given global
+    // id.
+    size_t SegmentIndex(const int record_id) const;
+
+    // Returns a const reference to the record of given global id.
+    const Index::Record& RecordById(const int record_id) const;
+
+    // Writes the content of the record with given global id to the string.
+    void RecordContent(const int record_id, std::string* content) const;
+
+    // Returns the number of records.
+    size_t NumRecords() const;
+
+    // Returns the total content size of all records.
+    size_t TotalSize() const;
+
+    // Returns the number of records containing the given normalized keyword.
+    size_t RecordFreq(const char* keyword, const size_t size) const;
+
+    // Returns the BM25 parameters, see Index::ComputeScores.
+    float Bm25B() const;
+    float Bm25K() const;
+
+   private:
+    friend class SegmentedIndex;
+
+    std::vector<Segment> segments_;
+    size_t num_records_;
+    size_t total_size_;
+    float bm25_b_;
+    float bm25_k_;
+  };
+
+  // The default number of segments merged per tier.
+  static const size_t kDefaultMergeFactor;
+
+  // The default BM25 parameters.
+  static const float kDefaultBm25B;
+  static const float kDefaultBm25K;
+
+  // Initializes the index and starts the background thread. Added records are
+  // searchable after at most the refresh interval (in microseconds).
+  SegmentedIndex(const size_t max_segment_size, const Clock::Diff& refresh,
+                 const size_t merge_factor = kDefaultMergeFactor,
+                 const float bm25_b = kDefaultBm25B,
+                 const float bm25_k = kDefaultBm25K);
+
+  // Stops the background thread, pending records are discarded.
+  ~SegmentedIndex();
+
+  // Adds the record with given url and content to the buffer.
+  // Returns the new global record id.
+  int AddRecord(const std::string& url, const std::string& content);
+
+  // Seals all buffered records into a new segment, making them searchable.
+  void Refresh();
+
+  // Seals all buffered records and performs all pending merges.
+  void WaitForMerges();
+
+  // Returns the current snapshot.
+  std::shared_ptr<const Snapshot> CurrentSnapshot() const;
+
+  // Returns the number of records added.
+  size_t NumRecords() const;
+
+  // Returns the number of sealed segments.
+  size_t NumSegments() const;
+
+ private:
+  // A buffered record.
+  struct PendingRecord {
+    std::string url;
+    std::string content;
+  };
+
+  // The background thread loop, seals and merges segments.
+  void Run();
+
+  // Seals the buffered records into segments of at most the maximum size.
+  // Returns whether a segment was added.
+  bool Seal();
+
+  // Merges the first run of segments of the same tier. Returns whether a
+  // merge was performed.
+  bool Merge();
+
+  // Prepares given index for searching. The segments are not scored, so only
+  // the sorted keywords of the prefix index are built, without top records.
+  static void Finalize(Index* index);
+
+  // Replaces the segments [beg, end) of the current snapshot by given
+  // segments and publishes the new snapshot. Requires the lock.
+  void Publish(const size_t beg, const size_t end,
+               const std::vector<Segment>& segments);
+
+  const size_t max_segment_size_;
+  const Clock::Diff refresh_;
+  const size_t merge_factor_;
+  const float bm25_b_;
+  const float bm25_k_;
+
+  // Guards the buffer, the snapshot and the thread state.
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  // Serializes sealing to keep the segments ordered.
+  std::mutex seal_mutex_;
+  // Serializes merging, only merges remove segments.
+  std::mutex merge_mutex_;
+  std::vector<PendingRecord> pending_;
+  int next_id_;
+  int pending_base_id_;
+  std::shared_ptr<const Snapshot> snapshot_;
+  bool stop_;
+  std::thread thread_;
+};
+
+#endif  // EXERCISE_SHEET_07_SEGMENTED_INDEX_H_
@@ -0,0 +1,61 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <utility>
+#include "./snippet.h"
+
+using std::vector;
+using std::string;
+using std::make_pair;
+
+class SnippetTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    content_ = "Legacy and honors Google honoured Tesla on his birthday on 10 "
+               "July 2009 by displaying a doodle in the Google search home "
+               "page, that showed the G as a tesla coil.";
+  }
+
+  void TearDown() {
+  }
+
+  // Returns the snippet written to a string stream.
+  string Write(const vector<Index::PosSize>& matches, const size_t size) {
+    std::stringstream stream;
+    Snippet::Write(content_, matches, size, "[", "]", &stream);
+    return stream.str();
+  }
+
+  string content_;
+};
+
+TEST_F(SnippetTest, BestWindow) {
+  EXPECT_EQ(make_pair(0lu, content_.size()),
+            Snippet::BestWindow(content_, {}, content_.size()));
+  EXPECT_EQ(make_pair(0lu, 20lu), Snippet::BestWindow(content_, {}, 20u));
+  EXPECT_EQ(make_pair(0lu, 24lu),
+            Snippet::BestWindow(content_, { {0, 6}, {11, 6}, {18, 6} }, 24u));
+  // The window with both doodle and Google is preferred, centered and cut at
+  // word borders.
+  EXPECT_EQ(make_pair(86lu, 108lu),
+            Snippet::BestWindow(content_, { {0, 6}, {88, 6}, {102, 6} }, 30u));
+  // The window does not exceed the content.
+  EXPECT_EQ(make_pair(139lu, 161lu),
+            Snippet::BestWindow(content_, { {150, 5} }, 25u));
+}
+
+TEST_F(SnippetTest, Write) {
+  EXPECT_EQ(content_, Write({}, 1000u));
+  EXPECT_EQ("[Legacy] and honors ...", Write({ {0, 6} }, 20u));
+  EXPECT_EQ("... and [honors] [Google] ...", Write({ {11, 6}, {18, 6} }, 24u));
+  EXPECT_EQ("... a [doodle] in the [Google] ...",
+            Write({ {0, 6}, {88, 6}, {102, 6} }, 30u));
+  // Overlapping matches are highlighted once.
+  EXPECT_EQ("... as a [tesla] coil.", Write({ {150, 5}, {150, 3} }, 16u));
+  // Multibyte UTF-8 sequences are part of the words.
+  content_ = "Die Größe über Tesla Spule ändert größere Ströme";
+  EXPECT_EQ("... über [Tesla] Spule ...", Write({ {18, 5} }, 20u));
+}
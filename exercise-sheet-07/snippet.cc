@@ -0,0 +1,110 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include "./snippet.h"
+#include <cassert>
+#include <cctype>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <utility>
+
+using std::string;
+using std::vector;
+
+const char* Snippet::kEllipsis = "...";
+
+// Returns whether the given byte is ASCII whitespace, bytes of multibyte UTF-8
+// sequences are not.
+static inline bool IsSpace(const char c) {
+  return std::isspace(static_cast<unsigned char>(c));
+}
+
+std::pair<size_t, size_t> Snippet::BestWindow(
+    const string& content, const vector<Index::PosSize>& matches,
+    const size_t window_size) {
+  const size_t content_size = content.size();
+  if (content_size <= window_size) {
+    return std::make_pair(0u, content_size);
+  }
+  if (matches.empty()) {
+    return std::make_pair(0u, window_size);
+  }
+  // Slide over the matches to find the window with the highest match density.
+  const size_t num_matches = matches.size();
+  size_t best_first = 0u;
+  size_t best_last = 0u;
+  size_t last = 0u;
+  for (size_t first = 0; first < num_matches; ++first) {
+    last = std::max(last, first);
+    const size_t window_end = matches[first].pos + window_size;
+    while (last + 1u < num_matches &&
+           matches[last + 1u].pos + matches[last + 1u].size <= window_end) {
+      ++last;
+    }
+    if (last - first > best_last - best_first) {
+      best_first = first;
+      best_last = last;
+    }
+  }
+  // Center the window around its matches.
+  const size_t matches_beg = matches[best_first].pos;
+  const size_t matches_end = std::max(matches_beg + matches[best_first].size,
+      matches[best_last].pos + matches[best_last].size);
+  const size_t slack = window_size - std::min(window_size,
+                                              matches_end - matches_beg);
+  size_t beg = matches_beg - std::min(matches_beg, slack / 2u);
+  beg = std::min(beg, content_size - window_size);
+  size_t end = beg + window_size;
+  // Avoid cutting words at the window borders.
+  if (beg > 0u) {
+    size_t word_beg = beg;
+    while (word_beg < matches_beg && !IsSpace(content[word_beg - 1u])) {
+      ++word_beg;
+    }
+    if (word_beg <= matches_beg) {
+      beg = word_beg;
+    }
+  }
+  if (end < content_size) {
+    size_t word_end = end;
+    while (word_end > matches_end && !IsSpace(content[word_end])) {
+      --word_end;
+    }
+    if (word_end >= matches_end) {
+      end = word_end;
+    }
+  }
+  return std::make_pair(beg, end);
+}
+
+void Snippet::Write(const string& content,
+                    const vector<Index::PosSize>& matches,
+                    const size_t window_size, const char* highlight_beg,
+                    const char* highlight_end, std::ostream* stream) {
+  assert(stream);
+  const std::pair<size_t, size_t> window = BestWindow(content, matches,
+                                                      window_size);
+  const char* data = content.data();
+  if (window.first > 0u) {
+    *stream << kEllipsis << ' ';
+  }
+  size_t pos = window.first;
+  for (const Index::PosSize& match: matches) {
+    if (match.pos < pos) {
+      // Overlapping or preceding the window.
+      continue;
+    }
+    if (match.pos + match.size > window.second) {
+      // Beyond the window.
+      break;
+    }
+    stream->write(data + pos, match.pos - pos);
+    *stream << highlight_beg;
+    stream->write(data + match.pos, match.size);
+    *stream << highlight_end;
+    pos = match.pos + match.size;
+  }
+  stream->write(data + pos, window.second - pos);
+  if (window.second < content.size()) {
+    *stream << ' ' << kEllipsis;
+  }
+}
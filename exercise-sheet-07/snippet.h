@@ -0,0 +1,35 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#ifndef EXERCISE_SHEET_07_SNIPPET_H_
+#define EXERCISE_SHEET_07_SNIPPET_H_
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <utility>
+#include "./index.h"
+
+// Snippet generation for the records shown as query results.
+class Snippet {
+ public:
+  // Marks the omitted content before and after a snippet.
+  static const char* kEllipsis;
+
+  // Returns the range [first, second) of the content window with given size,
+  // which contains the most matches. Matches are given as (position, size)
+  // pairs sorted by position. The window is centered around its matches and
+  // does not cut words at its borders, if possible.
+  static std::pair<size_t, size_t> BestWindow(
+      const std::string& content, const std::vector<Index::PosSize>& matches,
+      const size_t window_size);
+
+  // Writes the best window snippet of given content to the stream,
+  // highlighting all contained matches by enclosing them with the given
+  // begin and end markers. Matches are given as above. The content is written
+  // directly from the record without intermediate copies.
+  static void Write(const std::string& content,
+                    const std::vector<Index::PosSize>& matches,
+                    const size_t window_size, const char* highlight_beg,
+                    const char* highlight_end, std::ostream* stream);
+};
+
+#endif  // EXERCISE_SHEET_07_SNIPPET_H_
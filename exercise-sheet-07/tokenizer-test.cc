@@ -0,0 +1,183 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <random>
+#include <cctype>
+#include <string>
+#include <vector>
+#include "./tokenizer.h"
+#include "./perfect-hash.h"
+
+using std::vector;
+using std::string;
+
+class TokenizerTest : public ::testing::Test {
+ public:
+  void SetUp() {
+  }
+
+  void TearDown() {
+  }
+
+  // Returns the (position, size) pairs of the tokens following the keyword
+  // rules of the original byte-wise extraction.
+  static vector<std::pair<size_t, size_t> > Reference(const string& s,
+                                                      const size_t min_size) {
+    vector<std::pair<size_t, size_t> > tokens;
+    size_t pos = 0;
+    while (pos < s.size()) {
+      if (isalnum(s[pos])) {
+        bool valid = isalpha(s[pos]);
+        const size_t beg = pos;
+        ++pos;
+        while (pos < s.size() && isalnum(s[pos])) {
+          valid = valid || isalpha(s[pos]);
+          ++pos;
+        }
+        if (valid && pos - beg >= min_size) {
+          tokens.push_back(std::make_pair(beg, pos - beg));
+        }
+      }
+      ++pos;
+    }
+    return tokens;
+  }
+
+  // Checks both implementations against the reference and the hashes.
+  static void Check(const string& s, const size_t min_size) {
+    const vector<std::pair<size_t, size_t> > expected = Reference(s, min_size);
+    vector<Tokenizer::Token> tokens;
+    Tokenizer::TokenizeScalar(s.data(), s.size(), min_size, false, &tokens);
+    ASSERT_EQ(expected.size(), tokens.size()) << s;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      EXPECT_EQ(expected[i].first, tokens[i].pos);
+      EXPECT_EQ(expected[i].second, tokens[i].size);
+      EXPECT_EQ(PerfectHash::Hash(s.data() + tokens[i].pos, tokens[i].size),
+                tokens[i].hash);
+    }
+    if (!Tokenizer::HasAvx2()) {
+      return;
+    }
+    vector<Tokenizer::Token> simd_tokens;
+    Tokenizer::TokenizeAvx2(s.data(), s.size(), min_size, false,
+                            &simd_tokens);
+    ASSERT_EQ(tokens.size(), simd_tokens.size()) << s;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      EXPECT_EQ(tokens[i].pos, simd_tokens[i].pos);
+      EXPECT_EQ(tokens[i].size, simd_tokens[i].size);
+      EXPECT_EQ(tokens[i].hash, simd_tokens[i].hash);
+    }
+  }
+};
+
+TEST_F(TokenizerTest, Tokenize) {
+  vector<Tokenizer::Token> tokens;
+  const string s = "Nikola Tesla (1856-1943), 2nd @ A_b xYz!";
+  Tokenizer::Tokenize(s.data(), s.size(), 2u, &tokens);
+  ASSERT_EQ(4, tokens.size());
+  EXPECT_EQ("Nikola", s.substr(tokens[0].pos, tokens[0].size));
+  EXPECT_EQ("Tesla", s.substr(tokens[1].pos, tokens[1].size));
+  EXPECT_EQ("2nd", s.substr(tokens[2].pos, tokens[2].size));
+  EXPECT_EQ("xYz", s.substr(tokens[3].pos, tokens[3].size));
+  EXPECT_EQ(PerfectHash::Hash("tesla", 5), tokens[1].hash);
+  Tokenizer::Tokenize("", 0u, 2u, &tokens);
+  EXPECT_EQ(0, tokens.size());
+}
+
+TEST_F(TokenizerTest, Boundaries) {
+  Check("", 2u);
+  Check("a", 1u);
+  Check("ab", 2u);
+  Check(string(31, 'a'), 2u);
+  Check(string(32, 'a'), 2u);
+  Check(string(33, 'a'), 2u);
+  Check(string(31, '1') + "a" + string(40, '2'), 2u);
+  Check(string(32, ' ') + "ab", 2u);
+  Check(string(31, ' ') + "ab" + string(31, ' ') + "cd", 2u);
+  Check(string(100, '7'), 1u);
+  Check(string(64, 'z') + string(64, '\xc3'), 3u);
+}
+
+TEST_F(TokenizerTest, Random) {
+  // Mostly alphanumeric characters, some non-ASCII and punctuation bytes.
+  const string alphabet = "abcxyzABCXYZ019@[`{/:_ \n\t\x80\xc3\xff";
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<size_t> char_dist(0, alphabet.size() - 1);
+  std::uniform_int_distribution<size_t> size_dist(0, 300);
+  for (int i = 0; i < 500; ++i) {
+    string s(size_dist(gen), ' ');
+    for (char& c: s) {
+      c = alphabet[char_dist(gen)];
+    }
+    Check(s, 1u + i % 3);
+  }
+  // All byte values.
+  string all;
+  for (int c = 0; c < 256; ++c) {
+    all.push_back(static_cast<char>(c));
+    all.push_back('a');
+  }
+  Check(all, 1u);
+}
+
+TEST_F(TokenizerTest, TokenizeUtf8) {
+  vector<Tokenizer::Token> tokens;
+  // Letters of other scripts are word characters, the em dash and the
+  // guillemets are not.
+  const string s = "\xc3\x84pfel\xe2\x80\x94" "Birnen \xc2\xab\xd0\x9c\xd0\xb8"
+                   "\xd1\x80\xc2\xbb na\xc3\xafve \xc3\xa9 x\xe2\x80\x94y";
+  Tokenizer::TokenizeUtf8(s.data(), s.size(), 2u, &tokens);
+  ASSERT_EQ(4, tokens.size());
+  EXPECT_EQ("\xc3\x84pfel", s.substr(tokens[0].pos, tokens[0].size));
+  EXPECT_EQ("Birnen", s.substr(tokens[1].pos, tokens[1].size));
+  EXPECT_EQ("\xd0\x9c\xd0\xb8\xd1\x80",
+            s.substr(tokens[2].pos, tokens[2].size));
+  EXPECT_EQ("na\xc3\xafve", s.substr(tokens[3].pos, tokens[3].size));
+  EXPECT_EQ(PerfectHash::Hash("birnen", 6), tokens[1].hash);
+  // The minimum size applies to code points, not bytes.
+  Tokenizer::TokenizeUtf8(s.data(), s.size(), 4u, &tokens);
+  ASSERT_EQ(3, tokens.size());
+  EXPECT_EQ("na\xc3\xafve", s.substr(tokens[2].pos, tokens[2].size));
+  // The ASCII mode splits at all non-ASCII bytes.
+  Tokenizer::Tokenize(s.data(), s.size(), 2u, &tokens);
+  ASSERT_EQ(4, tokens.size());
+  EXPECT_EQ("pfel", s.substr(tokens[0].pos, tokens[0].size));
+  EXPECT_EQ("na", s.substr(tokens[2].pos, tokens[2].size));
+}
+
+TEST_F(TokenizerTest, RandomUtf8) {
+  // ASCII, Latin, Cyrillic, punctuation, CJK and invalid sequences.
+  const vector<string> alphabet = {
+    "a", "Z", "7", " ", "-", "\xc3\xa4", "\xc3\x9f", "\xd0\x96", "\xc2\xbb",
+    "\xe2\x80\x94", "\xe4\xb8\xad", "\xf0\x9f\x98\x80", "\xc3", "\x80"
+  };
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<size_t> char_dist(0, alphabet.size() - 1);
+  std::uniform_int_distribution<size_t> size_dist(0, 120);
+  for (int i = 0; i < 500; ++i) {
+    string s;
+    const size_t size = size_dist(gen);
+    for (size_t j = 0; j < size; ++j) {
+      s += alphabet[char_dist(gen)];
+    }
+    const size_t min_size = 1u + i % 3;
+    vector<Tokenizer::Token> tokens;
+    Tokenizer::TokenizeScalar(s.data(), s.size(), min_size, true, &tokens);
+    for (const Tokenizer::Token& token: tokens) {
+      EXPECT_EQ(PerfectHash::Hash(s.data() + token.pos, token.size),
+                token.hash);
+    }
+    if (!Tokenizer::HasAvx2()) {
+      continue;
+    }
+    vector<Tokenizer::Token> simd_tokens;
+    Tokenizer::TokenizeAvx2(s.data(), s.size(), min_size, true,
+                            &simd_tokens);
+    ASSERT_EQ(tokens.size(), simd_tokens.size()) << s;
+    for (size_t j = 0; j < tokens.size(); ++j) {
+      EXPECT_EQ(tokens[j].pos, simd_tokens[j].pos);
+      EXPECT_EQ(tokens[j].size, simd_tokens[j].size);
+      EXPECT_EQ(tokens[j].hash, simd_tokens[j].hash);
+    }
+  }
+}
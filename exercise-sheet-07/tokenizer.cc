@@ -0,0 +1,288 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include "./tokenizer.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOKENIZER_X86
+#endif
+#include <cassert>
+#include <vector>
+#include "./perfect-hash.h"
+#include "./utf8.h"
+
+using std::vector;
+
+// Character class bits. Alphabetic characters are split into two classes by
+// their high nibble: A-O, a-o (4 and 6) and P-Z, p-z (5 and 7).
+static const uint8_t kAlphaLow = 1u;
+static const uint8_t kAlphaHigh = 2u;
+static const uint8_t kDigit = 4u;
+static const uint8_t kNonAscii = 8u;
+static const uint8_t kAlpha = kAlphaLow | kAlphaHigh;
+static const uint8_t kAlnum = kAlpha | kDigit;
+
+// Class lookup table for the low nibble.
+static const uint8_t kLowNibbleClass[16] = {
+  kAlphaHigh | kDigit | kNonAscii, kAlnum | kNonAscii, kAlnum | kNonAscii,
+  kAlnum | kNonAscii, kAlnum | kNonAscii, kAlnum | kNonAscii,
+  kAlnum | kNonAscii, kAlnum | kNonAscii, kAlnum | kNonAscii,
+  kAlnum | kNonAscii, kAlpha | kNonAscii, kAlphaLow | kNonAscii,
+  kAlphaLow | kNonAscii, kAlphaLow | kNonAscii, kAlphaLow | kNonAscii,
+  kAlphaLow | kNonAscii
+};
+
+// Class lookup table for the high nibble.
+static const uint8_t kHighNibbleClass[16] = {
+  0u, 0u, 0u, kDigit, kAlphaLow, kAlphaHigh, kAlphaLow, kAlphaHigh,
+  kNonAscii, kNonAscii, kNonAscii, kNonAscii,
+  kNonAscii, kNonAscii, kNonAscii, kNonAscii
+};
+
+// Returns the class bits of given byte.
+static inline uint8_t Class(const uint8_t c) {
+  return kLowNibbleClass[c & 15u] & kHighNibbleClass[c >> 4];
+}
+
+// Returns the class bits of the bytes considered part of a token.
+static inline uint8_t WordClass(const bool utf8) {
+  return utf8 ? kAlnum | kNonAscii : kAlnum;
+}
+
+// Splits the range [beg, end), which contains non-ASCII characters, into
+// tokens at code points of other classes than letters and digits and appends
+// the valid ones. The minimum size applies to the number of code points.
+static void AddUtf8Tokens(const char* s, const size_t beg, const size_t end,
+                          const size_t min_size,
+                          vector<Tokenizer::Token>* tokens) {
+  size_t pos = beg;
+  size_t seq_size = 0u;
+  while (pos < end) {
+    uint8_t c = Utf8::Class(Utf8::Decode(s + pos, end - pos, &seq_size));
+    if (c == Utf8::kOther) {
+      pos += seq_size;
+      continue;
+    }
+    const size_t token_beg = pos;
+    size_t num_chars = 0u;
+    bool letter = false;
+    while (c != Utf8::kOther) {
+      letter = letter || c == Utf8::kLetter;
+      ++num_chars;
+      pos += seq_size;
+      if (pos == end) {
+        break;
+      }
+      c = Utf8::Class(Utf8::Decode(s + pos, end - pos, &seq_size));
+    }
+    if (letter && num_chars >= min_size) {
+      tokens->push_back({token_beg, pos - token_beg, 0u});
+    }
+  }
+}
+
+// Appends the token in range [beg, end) to the list, if it is valid. Tokens
+// with non-ASCII characters are split further. The hash is computed
+// separately.
+static inline void AddToken(const char* s, const size_t beg, const size_t end,
+                            const bool alpha, const bool non_ascii,
+                            const size_t min_size,
+                            vector<Tokenizer::Token>* tokens) {
+  if (non_ascii) {
+    AddUtf8Tokens(s, beg, end, min_size, tokens);
+    return;
+  }
+  const size_t size = end - beg;
+  if (alpha && size >= min_size) {
+    tokens->push_back({beg, size, 0u});
+  }
+}
+
+// Computes the hashes of all tokens. Done in a separate pass, since the
+// independent hash computations pipeline better than when interleaved with
+// the boundary detection.
+static void HashTokens(const char* s, vector<Tokenizer::Token>* tokens) {
+  for (Tokenizer::Token& token: *tokens) {
+    token.hash = PerfectHash::Hash(s + token.pos, token.size);
+  }
+}
+
+bool Tokenizer::HasAvx2() {
+#ifdef TOKENIZER_X86
+  static const bool _avx2 = __builtin_cpu_supports("avx2");
+  return _avx2;
+#else
+  return false;
+#endif
+}
+
+void Tokenizer::Tokenize(const char* s, const size_t size,
+                         const size_t min_size, vector<Token>* tokens) {
+  if (HasAvx2()) {
+    TokenizeAvx2(s, size, min_size, false, tokens);
+  } else {
+    TokenizeScalar(s, size, min_size, false, tokens);
+  }
+}
+
+void Tokenizer::TokenizeUtf8(const char* s, const size_t size,
+                             const size_t min_size, vector<Token>* tokens) {
+  if (HasAvx2()) {
+    TokenizeAvx2(s, size, min_size, true, tokens);
+  } else {
+    TokenizeScalar(s, size, min_size, true, tokens);
+  }
+}
+
+void Tokenizer::TokenizeScalar(const char* s, const size_t size,
+                               const size_t min_size, const bool utf8,
+                               vector<Token>* tokens) {
+  assert(tokens);
+  tokens->clear();
+  const uint8_t word_class = WordClass(utf8);
+  size_t pos = 0u;
+  while (pos < size) {
+    uint8_t c = Class(s[pos]) & word_class;
+    if (c == 0u) {
+      ++pos;
+      continue;
+    }
+    // Found the beginning of a token.
+    const size_t beg = pos;
+    bool alpha = false;
+    bool non_ascii = false;
+    while (c) {
+      alpha = alpha || (c & kAlpha);
+      non_ascii = non_ascii || (c & kNonAscii);
+      if (++pos == size) {
+        break;
+      }
+      c = Class(s[pos]) & word_class;
+    }
+    AddToken(s, beg, pos, alpha, non_ascii, min_size, tokens);
+  }
+  HashTokens(s, tokens);
+}
+
+#ifdef TOKENIZER_X86
+// Tokenizer state carried across blocks.
+struct ScanState {
+  size_t beg;
+  bool in_token;
+  bool alpha;
+  bool non_ascii;
+};
+
+// Returns whether any bit of the mask is set within [beg, end).
+static inline bool AnyInRange(const uint64_t mask, const size_t beg,
+                              const size_t end) {
+  return mask & ((uint64_t(1u) << end) - (uint64_t(1u) << beg));
+}
+
+// Scans the block of given size at offset base given its word, alphabetic and
+// non-ASCII masks and emits all tokens ending within the block. Only the bits
+// of the block may be set in the masks. Token boundaries are derived from the
+// masks, so the cost is per token, not per byte.
+static inline void ScanBlock(const char* s, const size_t base,
+                             const size_t block_size, const uint64_t word,
+                             const uint64_t alpha, const uint64_t non_ascii,
+                             const size_t min_size, ScanState* state,
+                             vector<Tokenizer::Token>* tokens) {
+  const uint64_t prev = (word << 1) | state->in_token;
+  uint64_t starts = word & ~prev;
+  // A token ends before the first non-word character following it.
+  uint64_t ends = ~word & prev & ((uint64_t(1u) << block_size) - 1u);
+  if (state->in_token) {
+    if (ends == 0u) {
+      // The token continues in the next block.
+      state->alpha = state->alpha || alpha;
+      state->non_ascii = state->non_ascii || non_ascii;
+      return;
+    }
+    const size_t end = __builtin_ctzll(ends);
+    ends &= ends - 1u;
+    AddToken(s, state->beg, base + end,
+             state->alpha || AnyInRange(alpha, 0u, end),
+             state->non_ascii || AnyInRange(non_ascii, 0u, end), min_size,
+             tokens);
+    state->in_token = false;
+  }
+  // Each remaining end closes the next start.
+  while (ends) {
+    const size_t beg = __builtin_ctzll(starts);
+    const size_t end = __builtin_ctzll(ends);
+    starts &= starts - 1u;
+    ends &= ends - 1u;
+    AddToken(s, base + beg, base + end, AnyInRange(alpha, beg, end),
+             AnyInRange(non_ascii, beg, end), min_size, tokens);
+  }
+  if (starts) {
+    // The last token continues in the next block.
+    const size_t beg = __builtin_ctzll(starts);
+    state->beg = base + beg;
+    state->in_token = true;
+    state->alpha = alpha >> beg;
+    state->non_ascii = non_ascii >> beg;
+  }
+}
+
+__attribute__((target("avx2")))
+void Tokenizer::TokenizeAvx2(const char* s, const size_t size,
+                             const size_t min_size, const bool utf8,
+                             vector<Token>* tokens) {
+  assert(tokens);
+  tokens->clear();
+  tokens->reserve(size / 4u);
+  const __m128i low_lut = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(kLowNibbleClass));
+  const __m128i high_lut = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(kHighNibbleClass));
+  const __m256i low_class = _mm256_broadcastsi128_si256(low_lut);
+  const __m256i high_class = _mm256_broadcastsi128_si256(high_lut);
+  const __m256i nibble = _mm256_set1_epi8(15);
+  const uint8_t word_class = WordClass(utf8);
+  const __m256i word_classes = _mm256_set1_epi8(word_class);
+  const __m256i alpha_class = _mm256_set1_epi8(kAlpha);
+  const __m256i zero = _mm256_setzero_si256();
+  ScanState state = {0u, false, false, false};
+  size_t base = 0u;
+  for (; base + 32u <= size; base += 32u) {
+    const __m256i bytes = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(s + base));
+    const __m256i low = _mm256_shuffle_epi8(low_class,
+                                            _mm256_and_si256(bytes, nibble));
+    const __m256i high = _mm256_shuffle_epi8(
+        high_class, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+    const __m256i c = _mm256_and_si256(low, high);
+    const uint32_t no_word = _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_and_si256(c, word_classes), zero));
+    const uint32_t no_alpha = _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_and_si256(c, alpha_class), zero));
+    const uint32_t non_ascii = utf8 ? _mm256_movemask_epi8(bytes) : 0u;
+    ScanBlock(s, base, 32u, ~no_word, ~no_alpha, non_ascii, min_size, &state,
+              tokens);
+  }
+  // Classify the remaining bytes one by one.
+  uint64_t word = 0u;
+  uint64_t alpha = 0u;
+  uint64_t non_ascii = 0u;
+  for (size_t i = base; i < size; ++i) {
+    const uint8_t c = Class(s[i]) & word_class;
+    word |= uint64_t(c != 0u) << (i - base);
+    alpha |= uint64_t((c & kAlpha) != 0u) << (i - base);
+    non_ascii |= uint64_t((c & kNonAscii) != 0u) << (i - base);
+  }
+  ScanBlock(s, base, size - base, word, alpha, non_ascii, min_size, &state,
+            tokens);
+  if (state.in_token) {
+    AddToken(s, state.beg, size, state.alpha, state.non_ascii, min_size,
+             tokens);
+  }
+  HashTokens(s, tokens);
+}
+#else
+void Tokenizer::TokenizeAvx2(const char* s, const size_t size,
+                             const size_t min_size, const bool utf8,
+                             vector<Token>* tokens) {
+  assert(false && "AVX2 is not supported on this platform");
+  TokenizeScalar(s, size, min_size, utf8, tokens);
+}
+#endif
@@ -0,0 +1,53 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#ifndef EXERCISE_SHEET_07_TOKENIZER_H_
+#define EXERCISE_SHEET_07_TOKENIZER_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Single-pass keyword tokenizer. A token is a maximal run of ASCII
+// alphanumeric characters; it is emitted if it contains at least one
+// alphabetic character and has at least the minimum size. The bytes are
+// classified 32 at a time using AVX2 nibble lookup tables, if supported by the
+// CPU, otherwise by a scalar fallback with identical results.
+//
+// In UTF-8 mode, letters and digits of other scripts are word characters as
+// well, see Utf8::Class. Non-ASCII bytes are first treated as word bytes, only
+// the resulting tokens containing them are split further at the code point
+// level, so ASCII text is processed at the same speed.
+class Tokenizer {
+ public:
+  // A token given by its position, size and base hash, which equals
+  // PerfectHash::Hash of the token.
+  struct Token {
+    size_t pos;
+    size_t size;
+    uint64_t hash;
+  };
+
+  // Returns whether the AVX2 implementation is supported by the CPU.
+  static bool HasAvx2();
+
+  // Writes all tokens of the given bytes to the tokens list, replacing its
+  // previous contents. Uses the fastest implementation available.
+  static void Tokenize(const char* s, const size_t size,
+                       const size_t min_size, std::vector<Token>* tokens);
+
+  // Same as above in UTF-8 mode. The minimum size applies to the number of
+  // code points. Only the hashes of ASCII tokens are case-insensitive.
+  static void TokenizeUtf8(const char* s, const size_t size,
+                           const size_t min_size, std::vector<Token>* tokens);
+
+  // The scalar implementation of both modes.
+  static void TokenizeScalar(const char* s, const size_t size,
+                             const size_t min_size, const bool utf8,
+                             std::vector<Token>* tokens);
+
+  // The AVX2 implementation of both modes, requires HasAvx2.
+  static void TokenizeAvx2(const char* s, const size_t size,
+                           const size_t min_size, const bool utf8,
+                           std::vector<Token>* tokens);
+};
+
+#endif  // EXERCISE_SHEET_07_TOKENIZER_H_
@@ -0,0 +1,164 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "./utf8.h"
+#include "./index.h"
+
+using std::vector;
+using std::string;
+
+class Utf8Test : public ::testing::Test {
+ public:
+  void SetUp() {
+  }
+
+  void TearDown() {
+  }
+
+  // Returns the valid prefix size of both implementations, expecting the
+  // AVX2 one to accept at least the scalar one.
+  static size_t ValidPrefix(const string& s) {
+    const size_t scalar_size = Utf8::ValidPrefixScalar(s.data(), s.size());
+    if (!Utf8::HasAvx2()) {
+      return scalar_size;
+    }
+    const size_t size = Utf8::ValidPrefixAvx2(s.data(), s.size());
+    EXPECT_GE(size, scalar_size);
+    return size;
+  }
+};
+
+TEST_F(Utf8Test, ValidPrefix) {
+  const string ascii(Utf8::kBlockSize, 'a');
+  EXPECT_EQ(0, ValidPrefix(""));
+  EXPECT_EQ(0, ValidPrefix(string(Utf8::kBlockSize - 1u, 'a')));
+  EXPECT_EQ(Utf8::kBlockSize, ValidPrefix(ascii + "a"));
+  EXPECT_EQ(3 * Utf8::kBlockSize, ValidPrefix(ascii + ascii + ascii));
+  EXPECT_EQ(Utf8::kBlockSize, ValidPrefix(ascii + '\x80' + ascii));
+  EXPECT_EQ(0, ValidPrefix("\xff" + ascii));
+  if (!Utf8::HasAvx2()) {
+    return;
+  }
+  string euros;
+  for (int i = 0; i < 10; ++i) {
+    euros += "\xe2\x82\xac";
+  }
+  // 16 2-byte sequences.
+  string umlauts;
+  for (int i = 0; i < 16; ++i) {
+    umlauts += "\xc3\xa4";
+  }
+  EXPECT_EQ(2 * Utf8::kBlockSize, ValidPrefix(umlauts + ascii));
+  // Sequences may cross block borders, but not the end of the prefix.
+  EXPECT_EQ(2 * Utf8::kBlockSize, ValidPrefix("a" + umlauts + ascii));
+  EXPECT_EQ(Utf8::kBlockSize - 1u, ValidPrefix("a" + umlauts + "\xff" + ascii));
+  EXPECT_EQ(Utf8::kBlockSize - 1u, ValidPrefix("a" + umlauts));
+  EXPECT_EQ(Utf8::kBlockSize - 2u,
+            ValidPrefix(ascii.substr(2) + euros.substr(0, 2) + ascii));
+  // 3-byte sequences, 10 euro signs and a 2-byte sequence.
+  EXPECT_EQ(Utf8::kBlockSize, ValidPrefix(euros + "\xc3\xa4"));
+  // Overlong sequences and surrogates.
+  EXPECT_EQ(0, ValidPrefix("\xc1\xb3" + ascii.substr(2)));
+  EXPECT_EQ(0, ValidPrefix("\xe0\x90\x80" + ascii.substr(3)));
+  EXPECT_EQ(0, ValidPrefix("\xed\xa0\x80" + ascii.substr(3)));
+  // 4-byte sequences are left to the repair.
+  EXPECT_EQ(0, ValidPrefix("\xf0\x9f\x98\x80" + ascii.substr(4)));
+  // Missing and superfluous continuation bytes.
+  EXPECT_EQ(0, ValidPrefix("\xe2\x82" + ascii.substr(2)));
+  EXPECT_EQ(0, ValidPrefix("\xc3\xa4\xa4" + ascii.substr(3)));
+}
+
+TEST_F(Utf8Test, RepairUtf8) {
+  // Strings shorter than a block are repaired byte-wise only. Prepending
+  // valid sequences, which are skipped by the fast path, does not change their
+  // repair.
+  const vector<string> valid = {
+    "a", "ab ", "\xc3\xa4", "\xe2\x82\xac", "\xf0\x9f\x98\x80"
+  };
+  const vector<string> pieces = {
+    "a", "\xc3\xa4", "\xe2\x82\xac", "\xf0\x9f\x98\x80",
+    "\xf0\xa0\x80\x80", "\xc1\xb3", "\xe0\x90\x80", "\xe0\x81\xa0",
+    "\xed\xa0\x80", "\x80", "\xbf", "\xc3", "\xe2\x82", "\xfe", "\xff"
+  };
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<size_t> valid_dist(0, valid.size() - 1);
+  std::uniform_int_distribution<size_t> piece_dist(0, pieces.size() - 1);
+  std::uniform_int_distribution<size_t> size_dist(0, 60);
+  for (int i = 0; i < 1000; ++i) {
+    string prefix;
+    const size_t num_valid = size_dist(gen);
+    for (size_t p = 0; p < num_valid; ++p) {
+      prefix += valid[valid_dist(gen)];
+    }
+    string s;
+    while (s.size() + 4u < Utf8::kBlockSize) {
+      s += pieces[piece_dist(gen)];
+    }
+    string expected = s;
+    const int expected_num_repaired = Index::RepairUtf8(&expected);
+    s = prefix + s;
+    EXPECT_EQ(expected_num_repaired, Index::RepairUtf8(&s));
+    EXPECT_EQ(prefix + expected, s);
+  }
+}
+
+TEST_F(Utf8Test, CodePoints) {
+  size_t seq_size = 0u;
+  EXPECT_EQ('a', Utf8::Decode("a", 1u, &seq_size));
+  EXPECT_EQ(1u, seq_size);
+  EXPECT_EQ(0xe4u, Utf8::Decode("\xc3\xa4", 2u, &seq_size));
+  EXPECT_EQ(2u, seq_size);
+  EXPECT_EQ(0x20acu, Utf8::Decode("\xe2\x82\xac", 3u, &seq_size));
+  EXPECT_EQ(3u, seq_size);
+  EXPECT_EQ(0x1f600u, Utf8::Decode("\xf0\x9f\x98\x80", 4u, &seq_size));
+  EXPECT_EQ(4u, seq_size);
+  // Invalid, overlong and truncated sequences.
+  EXPECT_EQ(Utf8::kInvalid, Utf8::Decode("\x80", 1u, &seq_size));
+  EXPECT_EQ(1u, seq_size);
+  EXPECT_EQ(Utf8::kInvalid, Utf8::Decode("\xc1\xb3", 2u, &seq_size));
+  EXPECT_EQ(Utf8::kInvalid, Utf8::Decode("\xe2\x82", 2u, &seq_size));
+  EXPECT_EQ(Utf8::kInvalid, Utf8::Decode("\xed\xa0\x80", 3u, &seq_size));
+  EXPECT_EQ(1u, seq_size);
+  // Encoding round trips.
+  for (const uint32_t code_point: {0x41u, 0xe4u, 0x416u, 0x20acu, 0x1f600u}) {
+    char bytes[4];
+    const size_t size = Utf8::Encode(code_point, bytes);
+    EXPECT_EQ(code_point, Utf8::Decode(bytes, size, &seq_size));
+    EXPECT_EQ(size, seq_size);
+  }
+}
+
+TEST_F(Utf8Test, ClassAndFold) {
+  EXPECT_EQ(Utf8::kLetter, Utf8::Class('a'));
+  EXPECT_EQ(Utf8::kDigit, Utf8::Class('7'));
+  EXPECT_EQ(Utf8::kOther, Utf8::Class('-'));
+  EXPECT_EQ(Utf8::kLetter, Utf8::Class(0xe4u));  // ä
+  EXPECT_EQ(Utf8::kLetter, Utf8::Class(0x416u));  // Ж
+  EXPECT_EQ(Utf8::kLetter, Utf8::Class(0x4e2du));  // 中
+  EXPECT_EQ(Utf8::kOther, Utf8::Class(0xabu));  // «
+  EXPECT_EQ(Utf8::kOther, Utf8::Class(0xd7u));  // ×
+  EXPECT_EQ(Utf8::kOther, Utf8::Class(0x2014u));  // —
+  EXPECT_EQ(Utf8::kOther, Utf8::Class(0x1f600u));
+  EXPECT_EQ(Utf8::kDigit, Utf8::Class(0x967u));  // Devanagari one
+  EXPECT_EQ('a', Utf8::Fold('A'));
+  EXPECT_EQ('1', Utf8::Fold('1'));
+  EXPECT_EQ(0xe4u, Utf8::Fold(0xc4u));  // Ä
+  EXPECT_EQ(0xdfu, Utf8::Fold(0xdfu));  // ß
+  EXPECT_EQ(0x3c3u, Utf8::Fold(0x3a3u));  // Σ
+  EXPECT_EQ(0x436u, Utf8::Fold(0x416u));  // Ж
+  EXPECT_EQ(0x450u, Utf8::Fold(0x400u));  // Ѐ
+  EXPECT_EQ(0x561u, Utf8::Fold(0x531u));  // Ա
+  EXPECT_EQ(0x1e01u, Utf8::Fold(0x1e00u));
+  EXPECT_EQ(0xff41u, Utf8::Fold(0xff21u));  // Fullwidth A
+  // The case pair of K (Kelvin sign) and ẞ have different sizes.
+  EXPECT_EQ(0x212au, Utf8::Fold(0x212au));
+  EXPECT_EQ(0x1e9eu, Utf8::Fold(0x1e9eu));
+  // Folding keeps the encoded size for all table code points.
+  char bytes[4];
+  for (uint32_t c = 0u; c < 0x800u; ++c) {
+    EXPECT_EQ(Utf8::Encode(c, bytes), Utf8::Encode(Utf8::Fold(c), bytes));
+  }
+}
@@ -0,0 +1,421 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include "./utf8.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTF8_X86
+#endif
+#include <cstring>
+
+const size_t Utf8::kBlockSize;
+const uint8_t Utf8::kOther;
+const uint8_t Utf8::kDigit;
+const uint8_t Utf8::kLetter;
+const uint32_t Utf8::kInvalid;
+
+// The number of code points covered by the precomputed tables, i.e. all code
+// points encoded in 1 or 2 bytes.
+static const uint32_t kNumTableCodePoints = 0x800u;
+
+// Returns whether the code point is within [beg, end].
+static inline bool InRange(const uint32_t c, const uint32_t beg,
+                           const uint32_t end) {
+  return c >= beg && c <= end;
+}
+
+// Precomputed character classes and case folds.
+class CodePointTables {
+ public:
+  CodePointTables() {
+    for (uint32_t c = 0; c < kNumTableCodePoints; ++c) {
+      classes_[c] = ComputeClass(c);
+      folds_[c] = ComputeFold(c);
+    }
+  }
+
+  uint8_t Class(const uint32_t c) const {
+    return classes_[c];
+  }
+
+  uint16_t Fold(const uint32_t c) const {
+    return folds_[c];
+  }
+
+ private:
+  static uint8_t ComputeClass(const uint32_t c) {
+    if (InRange(c, '0', '9') || InRange(c, 0x660u, 0x669u) ||
+        InRange(c, 0x6f0u, 0x6f9u) || InRange(c, 0x7c0u, 0x7c9u)) {
+      return Utf8::kDigit;
+    }
+    if (InRange(c, 'a', 'z') || InRange(c, 'A', 'Z') ||
+        c == 0xaau || c == 0xb5u || c == 0xbau ||
+        (InRange(c, 0xc0u, 0x2afu) && c != 0xd7u && c != 0xf7u) ||
+        // Combining diacritical marks.
+        InRange(c, 0x300u, 0x36fu) ||
+        // Greek and Coptic.
+        (InRange(c, 0x370u, 0x3ffu) && c != 0x375u && c != 0x37eu &&
+         c != 0x384u && c != 0x385u && c != 0x387u) ||
+        // Cyrillic.
+        (InRange(c, 0x400u, 0x52fu) && c != 0x482u) ||
+        // Armenian.
+        InRange(c, 0x531u, 0x556u) || InRange(c, 0x561u, 0x587u) ||
+        // Hebrew.
+        InRange(c, 0x591u, 0x5bdu) || InRange(c, 0x5d0u, 0x5f2u) ||
+        // Arabic.
+        InRange(c, 0x610u, 0x61au) || InRange(c, 0x620u, 0x65fu) ||
+        InRange(c, 0x66eu, 0x6d3u) || InRange(c, 0x6d5u, 0x6dcu) ||
+        InRange(c, 0x6e5u, 0x6e6u) || InRange(c, 0x6eeu, 0x6efu) ||
+        InRange(c, 0x6fau, 0x6ffu) ||
+        // Syriac, Thaana and NKo.
+        InRange(c, 0x710u, 0x74fu) || InRange(c, 0x780u, 0x7b1u) ||
+        InRange(c, 0x7cau, 0x7f5u)) {
+      return Utf8::kLetter;
+    }
+    return Utf8::kOther;
+  }
+
+  static uint16_t ComputeFold(const uint32_t c) {
+    const bool even = (c & 1u) == 0u;
+    if (InRange(c, 'A', 'Z') || (InRange(c, 0xc0u, 0xdeu) && c != 0xd7u) ||
+        InRange(c, 0x391u, 0x3a1u) || InRange(c, 0x3a3u, 0x3abu) ||
+        InRange(c, 0x410u, 0x42fu)) {
+      return c + 0x20u;
+    }
+    if ((InRange(c, 0x100u, 0x12fu) && even) ||
+        (InRange(c, 0x132u, 0x137u) && even) ||
+        (InRange(c, 0x139u, 0x148u) && !even) ||
+        (InRange(c, 0x14au, 0x177u) && even) ||
+        (InRange(c, 0x179u, 0x17eu) && !even) ||
+        (InRange(c, 0x1cdu, 0x1dcu) && !even) ||
+        (InRange(c, 0x1deu, 0x1efu) && even) ||
+        (InRange(c, 0x1f8u, 0x21fu) && even) ||
+        (InRange(c, 0x222u, 0x233u) && even) ||
+        (InRange(c, 0x246u, 0x24fu) && even) ||
+        (InRange(c, 0x3d8u, 0x3efu) && even) ||
+        (InRange(c, 0x460u, 0x481u) && even) ||
+        (InRange(c, 0x48au, 0x4bfu) && even) ||
+        (InRange(c, 0x4c1u, 0x4ceu) && !even) ||
+        (InRange(c, 0x4d0u, 0x52fu) && even)) {
+      return c + 1u;
+    }
+    if (InRange(c, 0x400u, 0x40fu)) {
+      return c + 0x50u;
+    }
+    if (InRange(c, 0x531u, 0x556u)) {
+      return c + 0x30u;
+    }
+    if (InRange(c, 0x388u, 0x38au)) {
+      return c + 0x25u;
+    }
+    if (InRange(c, 0x38eu, 0x38fu)) {
+      return c + 0x3fu;
+    }
+    switch (c) {
+      case 0x178u: return 0xffu;
+      case 0x386u: return 0x3acu;
+      case 0x38cu: return 0x3ccu;
+      case 0x3c2u: return 0x3c3u;
+      case 0x4c0u: return 0x4cfu;
+      default: return c;
+    }
+  }
+
+  uint8_t classes_[kNumTableCodePoints];
+  uint16_t folds_[kNumTableCodePoints];
+};
+
+// Returns the tables, which are computed on first use.
+static const CodePointTables& Tables() {
+  static const CodePointTables _tables;
+  return _tables;
+}
+
+uint32_t Utf8::Decode(const char* s, const size_t size, size_t* seq_size) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(s);
+  *seq_size = 1u;
+  if (bytes[0] < 0x80u) {
+    return bytes[0];
+  }
+  size_t num_bytes = 0u;
+  uint32_t code_point = 0u;
+  uint32_t min_code_point = 0u;
+  if (InRange(bytes[0], 0xc2u, 0xdfu)) {
+    num_bytes = 2u;
+    code_point = bytes[0] & 0x1fu;
+    min_code_point = 0x80u;
+  } else if (InRange(bytes[0], 0xe0u, 0xefu)) {
+    num_bytes = 3u;
+    code_point = bytes[0] & 0x0fu;
+    min_code_point = 0x800u;
+  } else if (InRange(bytes[0], 0xf0u, 0xf4u)) {
+    num_bytes = 4u;
+    code_point = bytes[0] & 0x07u;
+    min_code_point = 0x10000u;
+  } else {
+    return kInvalid;
+  }
+  if (num_bytes > size) {
+    return kInvalid;
+  }
+  for (size_t i = 1; i < num_bytes; ++i) {
+    if ((bytes[i] & 0xc0u) != 0x80u) {
+      return kInvalid;
+    }
+    code_point = (code_point << 6) | (bytes[i] & 0x3fu);
+  }
+  if (code_point < min_code_point || code_point > 0x10ffffu ||
+      InRange(code_point, 0xd800u, 0xdfffu)) {
+    return kInvalid;
+  }
+  *seq_size = num_bytes;
+  return code_point;
+}
+
+size_t Utf8::Encode(const uint32_t code_point, char* dst) {
+  uint8_t* bytes = reinterpret_cast<uint8_t*>(dst);
+  if (code_point < 0x80u) {
+    bytes[0] = code_point;
+    return 1u;
+  }
+  if (code_point < 0x800u) {
+    bytes[0] = 0xc0u | (code_point >> 6);
+    bytes[1] = 0x80u | (code_point & 0x3fu);
+    return 2u;
+  }
+  if (code_point < 0x10000u) {
+    bytes[0] = 0xe0u | (code_point >> 12);
+    bytes[1] = 0x80u | ((code_point >> 6) & 0x3fu);
+    bytes[2] = 0x80u | (code_point & 0x3fu);
+    return 3u;
+  }
+  bytes[0] = 0xf0u | (code_point >> 18);
+  bytes[1] = 0x80u | ((code_point >> 12) & 0x3fu);
+  bytes[2] = 0x80u | ((code_point >> 6) & 0x3fu);
+  bytes[3] = 0x80u | (code_point & 0x3fu);
+  return 4u;
+}
+
+uint8_t Utf8::Class(const uint32_t code_point) {
+  if (code_point < kNumTableCodePoints) {
+    return Tables().Class(code_point);
+  }
+  const uint32_t c = code_point;
+  if (InRange(c, 0x966u, 0x96fu) || InRange(c, 0xe50u, 0xe59u) ||
+      InRange(c, 0xff10u, 0xff19u)) {
+    return kDigit;
+  }
+  // Punctuation, symbols, surrogates, private use, specials and emojis.
+  if (InRange(c, 0x2000u, 0x2bffu) || InRange(c, 0x2e00u, 0x2e7fu) ||
+      InRange(c, 0x3000u, 0x303fu) || InRange(c, 0xd800u, 0xf8ffu) ||
+      InRange(c, 0xfe10u, 0xfe6fu) || InRange(c, 0xff00u, 0xff0fu) ||
+      InRange(c, 0xff1au, 0xff20u) || InRange(c, 0xff3bu, 0xff40u) ||
+      InRange(c, 0xff5bu, 0xff65u) || InRange(c, 0xfff0u, 0xffffu) ||
+      InRange(c, 0x1f000u, 0x1faffu) || c > 0x10ffffu) {
+    return kOther;
+  }
+  return kLetter;
+}
+
+uint32_t Utf8::Fold(const uint32_t code_point) {
+  if (code_point < kNumTableCodePoints) {
+    return Tables().Fold(code_point);
+  }
+  const uint32_t c = code_point;
+  if ((InRange(c, 0x1e00u, 0x1e95u) || InRange(c, 0x1ea0u, 0x1effu)) &&
+      (c & 1u) == 0u) {
+    // Latin extended additional.
+    return c + 1u;
+  }
+  if (InRange(c, 0xff21u, 0xff3au)) {
+    // Fullwidth Latin.
+    return c + 0x20u;
+  }
+  return c;
+}
+
+// Returns whether the block is pure ASCII, checking 8 bytes at a time.
+static inline bool IsAsciiBlock(const char* s) {
+  uint64_t bits = 0u;
+  for (size_t i = 0; i < Utf8::kBlockSize; i += 8u) {
+    uint64_t word;
+    std::memcpy(&word, s + i, sizeof(word));
+    bits |= word;
+  }
+  return (bits & 0x8080808080808080ull) == 0u;
+}
+
+bool Utf8::HasAvx2() {
+#ifdef UTF8_X86
+  static const bool _avx2 = __builtin_cpu_supports("avx2");
+  return _avx2;
+#else
+  return false;
+#endif
+}
+
+size_t Utf8::ValidPrefix(const char* s, const size_t size) {
+  return HasAvx2() ? ValidPrefixAvx2(s, size) : ValidPrefixScalar(s, size);
+}
+
+size_t Utf8::ValidPrefixScalar(const char* s, const size_t size) {
+  size_t pos = 0u;
+  while (pos + kBlockSize <= size && IsAsciiBlock(s + pos)) {
+    pos += kBlockSize;
+  }
+  return pos;
+}
+
+#ifdef UTF8_X86
+// Error classes of the lookup algorithm, each detected by a combination of
+// the high and low nibble of a byte and the high nibble of the next byte.
+static const uint8_t kTooShort = 1u << 0;
+static const uint8_t kTooLong = 1u << 1;
+static const uint8_t kOverlong3 = 1u << 2;
+static const uint8_t kTooLarge = 1u << 3;
+static const uint8_t kSurrogate = 1u << 4;
+static const uint8_t kOverlong2 = 1u << 5;
+static const uint8_t kTooLarge1000 = 1u << 6;
+static const uint8_t kOverlong4 = 1u << 6;
+static const uint8_t kTwoConts = 1u << 7;
+static const uint8_t kCarry = kTooShort | kTooLong | kTwoConts;
+
+// Error classes by the high nibble of the first byte.
+static const uint8_t kByte1High[16] = {
+  // ASCII.
+  kTooLong, kTooLong, kTooLong, kTooLong,
+  kTooLong, kTooLong, kTooLong, kTooLong,
+  // Continuation.
+  kTwoConts, kTwoConts, kTwoConts, kTwoConts,
+  // 2-byte lead.
+  kTooShort | kOverlong2,
+  kTooShort,
+  // 3-byte lead.
+  kTooShort | kOverlong3 | kSurrogate,
+  // 4-byte lead.
+  kTooShort | kTooLarge | kTooLarge1000 | kOverlong4
+};
+
+// Error classes by the low nibble of the first byte.
+static const uint8_t kByte1Low[16] = {
+  kCarry | kOverlong3 | kOverlong2 | kOverlong4,
+  kCarry | kOverlong2,
+  kCarry,
+  kCarry,
+  kCarry | kTooLarge,
+  kCarry | kTooLarge | kTooLarge1000,
+  kCarry | kTooLarge | kTooLarge1000,
+  kCarry | kTooLarge | kTooLarge1000,
+  kCarry | kTooLarge | kTooLarge1000,
+  kCarry | kTooLarge | kTooLarge1000,
+  kCarry | kTooLarge | kTooLarge1000,
+  kCarry | kTooLarge | kTooLarge1000,
+  kCarry | kTooLarge | kTooLarge1000,
+  kCarry | kTooLarge | kTooLarge1000 | kSurrogate,
+  kCarry | kTooLarge | kTooLarge1000,
+  kCarry | kTooLarge | kTooLarge1000
+};
+
+// Error classes by the high nibble of the second byte.
+static const uint8_t kByte2High[16] = {
+  // ASCII.
+  kTooShort, kTooShort, kTooShort, kTooShort,
+  kTooShort, kTooShort, kTooShort, kTooShort,
+  // Continuation 1000____.
+  kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge1000 | kOverlong4,
+  // Continuation 1001____.
+  kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge,
+  // Continuation 101_____.
+  kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+  kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+  // Lead bytes.
+  kTooShort, kTooShort, kTooShort, kTooShort
+};
+
+// Returns the 16 byte table broadcasted to both lanes.
+__attribute__((target("avx2")))
+static inline __m256i Table(const uint8_t* table) {
+  return _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(table)));
+}
+
+// Returns the bytes shifted by n positions towards the end, filling in the
+// last bytes of the previous block at the beginning.
+template<int n>
+__attribute__((target("avx2")))
+static inline __m256i Prev(const __m256i bytes, const __m256i prev_bytes) {
+  const __m256i shifted = _mm256_permute2x128_si256(prev_bytes, bytes, 0x21);
+  return _mm256_alignr_epi8(bytes, shifted, 16 - n);
+}
+
+__attribute__((target("avx2")))
+size_t Utf8::ValidPrefixAvx2(const char* s, const size_t size) {
+  const __m256i byte_1_high_table = Table(kByte1High);
+  const __m256i byte_1_low_table = Table(kByte1Low);
+  const __m256i byte_2_high_table = Table(kByte2High);
+  const __m256i nibble = _mm256_set1_epi8(15);
+  // Bytes from 0xf0 on start 4-byte sequences, which are left to the repair.
+  const __m256i max_lead = _mm256_set1_epi8(static_cast<char>(0xefu));
+  // The maximum values of the last bytes of a block, which do not start a
+  // sequence continued in the next block.
+  const __m256i max_last = _mm256_setr_epi8(
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      static_cast<char>(0xf0u - 1u), static_cast<char>(0xe0u - 1u),
+      static_cast<char>(0xc0u - 1u));
+  const __m256i third_byte = _mm256_set1_epi8(0xe0u - 0x80u);
+  const __m256i fourth_byte = _mm256_set1_epi8(0xf0u - 0x80u);
+  const __m256i high_bit = _mm256_set1_epi8(static_cast<char>(0x80u));
+  // The bytes start at a sequence border, which is equivalent to following
+  // ASCII bytes.
+  __m256i prev_bytes = _mm256_setzero_si256();
+  __m256i prev_incomplete = _mm256_setzero_si256();
+  size_t pos = 0u;
+  for (; pos + kBlockSize <= size; pos += kBlockSize) {
+    const __m256i bytes = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(s + pos));
+    if (_mm256_movemask_epi8(bytes) == 0) {
+      // ASCII block, valid unless a sequence of the last block is cut off.
+      if (!_mm256_testz_si256(prev_incomplete, prev_incomplete)) {
+        break;
+      }
+      prev_bytes = bytes;
+      continue;
+    }
+    const __m256i prev1 = Prev<1>(bytes, prev_bytes);
+    const __m256i byte_1_high = _mm256_shuffle_epi8(
+        byte_1_high_table,
+        _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    const __m256i byte_1_low = _mm256_shuffle_epi8(
+        byte_1_low_table, _mm256_and_si256(prev1, nibble));
+    const __m256i byte_2_high = _mm256_shuffle_epi8(
+        byte_2_high_table,
+        _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+    const __m256i special_cases = _mm256_and_si256(
+        _mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+    // The third and fourth bytes of a sequence must be continuations.
+    const __m256i must_23 = _mm256_or_si256(
+        _mm256_subs_epu8(Prev<2>(bytes, prev_bytes), third_byte),
+        _mm256_subs_epu8(Prev<3>(bytes, prev_bytes), fourth_byte));
+    const __m256i error = _mm256_or_si256(
+        _mm256_xor_si256(_mm256_and_si256(must_23, high_bit), special_cases),
+        _mm256_subs_epu8(bytes, max_lead));
+    if (!_mm256_testz_si256(error, error)) {
+      break;
+    }
+    prev_bytes = bytes;
+    prev_incomplete = _mm256_subs_epu8(bytes, max_last);
+  }
+  // Exclude a sequence cut off at the end of the last valid block.
+  const uint8_t* end = reinterpret_cast<const uint8_t*>(s + pos);
+  if (pos >= 1u && end[-1] >= 0xc0u) {
+    return pos - 1u;
+  }
+  if (pos >= 2u && end[-2] >= 0xe0u) {
+    return pos - 2u;
+  }
+  return pos;
+}
+#else
+size_t Utf8::ValidPrefixAvx2(const char* s, const size_t size) {
+  return ValidPrefixScalar(s, size);
+}
+#endif
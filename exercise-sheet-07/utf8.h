@@ -0,0 +1,66 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#ifndef EXERCISE_SHEET_07_UTF8_H_
+#define EXERCISE_SHEET_07_UTF8_H_
+
+#include <cstdint>
+#include <cstddef>
+
+// Block-wise UTF-8 validation used as fast path for the byte-wise repair.
+// The bytes are validated in blocks of 32 using the lookup algorithm by
+// Keiser and Lemire with AVX2, if supported by the CPU. Without AVX2 only
+// ASCII blocks are recognized. Validation is conservative: only 1-3 byte
+// sequences are accepted, since the repair treats some valid 4-byte sequences
+// differently.
+//
+// Also provides the code point tables used for Unicode-aware tokenization and
+// case folding. The tables are precomputed for all 1-2 byte sequences, i.e.
+// Latin, Greek, Cyrillic, Armenian, Hebrew and Arabic, and use block ranges
+// beyond.
+class Utf8 {
+ public:
+  // The validation block size in bytes.
+  static const size_t kBlockSize = 32u;
+
+  // Character classes of code points.
+  static const uint8_t kOther = 0u;
+  static const uint8_t kDigit = 1u;
+  static const uint8_t kLetter = 2u;
+
+  // The code point returned for invalid sequences.
+  static const uint32_t kInvalid = 0xfffdu;
+
+  // Decodes the sequence at the beginning of given bytes, writes its size and
+  // returns its code point. Invalid or truncated sequences decode to kInvalid
+  // with size 1.
+  static uint32_t Decode(const char* s, const size_t size, size_t* seq_size);
+
+  // Encodes given code point, writes up to 4 bytes to the destination and
+  // returns the number of bytes written.
+  static size_t Encode(const uint32_t code_point, char* dst);
+
+  // Returns the character class of given code point. Combining marks are
+  // letters, so they do not split words.
+  static uint8_t Class(const uint32_t code_point);
+
+  // Returns the case-folded (lower-case) code point. The folded code point
+  // has the same encoded size, case pairs with different sizes are kept.
+  static uint32_t Fold(const uint32_t code_point);
+
+  // Returns whether the AVX2 implementation is supported by the CPU.
+  static bool HasAvx2();
+
+  // Returns the size of a prefix of given bytes, which is known to be valid
+  // and ends at a sequence border. It covers all leading valid blocks, except
+  // for a sequence continued in the first invalid or incomplete block. The
+  // bytes need to start at a sequence border.
+  static size_t ValidPrefix(const char* s, const size_t size);
+
+  // The scalar implementation of ValidPrefix, only accepts ASCII blocks and
+  // may return a shorter prefix.
+  static size_t ValidPrefixScalar(const char* s, const size_t size);
+
+  // The AVX2 implementation of ValidPrefix, requires HasAvx2.
+  static size_t ValidPrefixAvx2(const char* s, const size_t size);
+};
+
+#endif  // EXERCISE_SHEET_07_UTF8_H_
@@ -0,0 +1,108 @@
+// Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <vector>
+#include "./index.h"
+#include "./clock.h"
+#include "./k-means-clustering.h"
+
+using std::string;
+using std::vector;
+
+// Returns the file size of given file. Returns 0, if the file is not found.
+size_t FileSize(const string& path) {
+  using std::ifstream;
+
+  ifstream stream(path.c_str());
+  size_t size = 0;
+  if (stream.good()) {
+    stream.seekg(0, std::ios::end);
+    size = stream.tellg();
+    stream.seekg(0, std::ios::beg);
+  }
+  return size;
+}
+
+// Reads the whole file from given path and returns the content.
+string ReadFile(const string& path) {
+  using std::ifstream;
+
+  const size_t file_size = FileSize(path);
+  string content;
+  content.resize(file_size);
+  ifstream stream(path.c_str());
+  stream.read(&content[0], file_size);
+  return content;
+}
+
+// Splits the CSV content of the format <url>\t<content>\n into the urls and
+// contents. The contents include the line break like the indexed records.
+void SplitCsv(const string& file_content, vector<string>* urls,
+              vector<string>* contents) {
+  const size_t content_size = file_content.size();
+  size_t pos = 0;
+  while (pos < content_size) {
+    const size_t content_beg = file_content.find('\t', pos);
+    const size_t content_end = file_content.find('\n', content_beg);
+    if (content_beg == string::npos || content_end == string::npos) {
+      break;
+    }
+    urls->push_back(file_content.substr(pos, content_beg - pos));
+    contents->push_back(file_content.substr(content_beg + 1,
+                                            content_end - content_beg));
+    pos = content_end + 1;
+  }
+}
+
+// Assigns new records to the nearest centroids of a clustering saved by
+// exercise09-main, e.g. to backfill records indexed after the clustering.
+int main(int argc, char** argv) {
+  using std::cout;
+  using std::endl;
+
+  float bm25_b = 0.75f;
+  float bm25_k = 1.75f;
+  if (argc < 4) {
+    cout << "Usage: assign-main <index-CSV-file> <centroids-file> "
+         << "<records-CSV-file>" << endl;
+    return 1;
+  }
+  Index index;
+  Index::AddRecordsFromCsv(ReadFile(argv[1]), &index);
+  index.ComputeScores(bm25_b, bm25_k);
+  KMeansClustering clustering(index);
+  if (!clustering.LoadCentroids(argv[2])) {
+    cout << "Could not read centroids from " << argv[2] << endl;
+    return 1;
+  }
+  vector<string> urls;
+  vector<string> contents;
+  SplitCsv(ReadFile(argv[3]), &urls, &contents);
+  cout << "Number of clusters: " << clustering.NumClusters()
+       << "\nNumber of records: " << contents.size() << endl;
+  auto start = Clock(Clock::kRealMonotonic);
+  vector<int> centroid_ids;
+  clustering.AssignRecords(contents, &centroid_ids);
+  const Clock::Diff duration = Clock(Clock::kRealMonotonic) - start;
+  cout << "Assignment time: " << duration;
+  if (contents.size()) {
+    cout << " (" << duration / contents.size() << " per record)";
+  }
+  cout << endl;
+  // Single records as assigned at ingest time.
+  start = Clock(Clock::kRealMonotonic);
+  for (const string& content: contents) {
+    clustering.NearestCentroid(clustering.Vectorize(content));
+  }
+  if (contents.size()) {
+    cout << "Single record assignment time: "
+         << (Clock(Clock::kRealMonotonic) - start) / contents.size()
+         << endl;
+  }
+  std::ofstream assignment_file("assignments.txt");
+  for (size_t i = 0; i < urls.size(); ++i) {
+    assignment_file << urls[i] << "\t" << centroid_ids[i] << "\n";
+  }
+  return 0;
+}
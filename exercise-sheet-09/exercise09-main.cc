@@ -1,4 +1,5 @@
 // Copyright 2013 Eugen Sawin <esawin@me73.com>
+#include <random>
 #include <cassert>
 #include <iostream>
 #include <string>
@@ -7,10 +8,13 @@
 #include <functional>
 #include <algorithm>
 #include <cmath>
+#include <set>
+#include <vector>
 #include "./index.h"
 #include "./profiler.h"
 #include "./clock.h"
 #include "./k-means-clustering.h"
+#include "./query-processor.h"
 
 using std::string;
 
@@ -40,6 +44,103 @@ string ReadFile(const string& path) {
   return content;
 }
 
+// Returns the comma-separated names of the keywords with the highest scores
+// of given centroid.
+string TopKeywords(const Index& index,
+                   std::vector<KMeansClustering::IdScore> centroid) {
+  KMeansClustering::Truncate(10, &centroid);
+  string keywords;
+  for (auto end = centroid.end(), it = centroid.begin(); it != end; ++it) {
+    if (it != centroid.begin()) {
+      keywords += ", ";
+    }
+    keywords += index.KeywordById(it->id).name;
+  }
+  return keywords;
+}
+
+// Writes the subtree of the cluster hierarchy rooted at given node depth-first
+// to the stream, indented by depth.
+void WriteHierarchy(const Index& index,
+                    const std::vector<KMeansClustering::Node>& hierarchy,
+                    const int node, const size_t depth, std::ostream* stream) {
+  const KMeansClustering::Node& n = hierarchy[node];
+  *stream << string(2 * depth, ' ');
+  if (n.cluster != KMeansClustering::kInvalidId) {
+    *stream << "[" << n.cluster << "] ";
+  }
+  *stream << n.size << ": " << TopKeywords(index, n.centroid) << "\n";
+  if (n.left != KMeansClustering::kInvalidId) {
+    WriteHierarchy(index, hierarchy, n.left, depth + 1, stream);
+    WriteHierarchy(index, hierarchy, n.right, depth + 1, stream);
+  }
+}
+
+// Compares the cluster-pruned search for increasing numbers of probed clusters
+// with the full search. The queries consist of one or two keywords of random
+// records. Reports the recall of the top 10 records and the average query
+// duration.
+void EvaluateClusterSearch(const Index& index,
+                           const KMeansClustering& clustering,
+                           const size_t num_queries) {
+  using std::cout;
+  using std::endl;
+
+  std::mt19937 engine;
+  // Just a random number.
+  engine.seed(7355);
+  std::uniform_int_distribution<int> record_dist(0, index.NumRecords() - 1);
+  std::vector<string> queries;
+  while (queries.size() < num_queries) {
+    const KMeansClustering::Row vec =
+        clustering.RecordVector(record_dist(engine));
+    if (vec.empty()) {
+      continue;
+    }
+    std::uniform_int_distribution<int> entry_dist(0, vec.size - 1);
+    string query = index.KeywordById(vec.ids[entry_dist(engine)]).name;
+    if (queries.size() % 2) {
+      query += " " + index.KeywordById(vec.ids[entry_dist(engine)]).name;
+    }
+    queries.push_back(query);
+  }
+  const size_t top_k = 10;
+  QueryProcessor full(index);
+  std::vector<std::set<int> > expected(num_queries);
+  Clock::Diff full_duration = 0;
+  for (size_t q = 0; q < num_queries; ++q) {
+    for (const Index::Item& item: full.Answer(queries[q], top_k)) {
+      expected[q].insert(item.record_id);
+    }
+    full_duration += full.LastDuration();
+  }
+  cout << "Full search: " << (full_duration / num_queries).Str()
+       << " per query" << endl;
+  QueryProcessor pruned(index);
+  pruned.BuildClusterIndex(clustering);
+  for (size_t num_probes = 1; num_probes < 2 * clustering.NumClusters();
+       num_probes *= 2) {
+    pruned.SetNumProbes(num_probes);
+    size_t num_found = 0u;
+    size_t num_expected = 0u;
+    Clock::Diff duration = 0;
+    for (size_t q = 0; q < num_queries; ++q) {
+      std::set<int> found;
+      for (const Index::Item& item: pruned.Answer(queries[q], top_k)) {
+        found.insert(item.record_id);
+      }
+      for (const int record_id: found) {
+        num_found += expected[q].count(record_id);
+      }
+      num_expected += expected[q].size();
+      duration += pruned.LastDuration();
+    }
+    cout << "Cluster search, " << num_probes << " probes: recall@" << top_k
+         << " " << static_cast<float>(num_found) / num_expected << ", "
+         << (duration / num_queries).Str() << " per query" << endl;
+  }
+}
+
 // Main function.
 int main(int argc, char** argv) {
   using std::cout;
@@ -51,21 +152,44 @@ int main(int argc, char** argv) {
   size_t k = 50;
   size_t m = 1000;
   size_t max_num_iter = 100;
+  // Full-batch clustering for batch size 0.
+  size_t batch_size = 0;
   float min_roc = 0.1f;
+  bool bisecting = false;
+  // Exact assignment for shortlist size 0.
+  size_t shortlist_size = 0;
   // Parse command line arguments.
   if (argc < 2) {
-    cout << "Usage: exercise05-main <CSV-file> [max-num-iterations]" << endl;
+    cout << "Usage: exercise09-main <CSV-file> [max-num-iterations] "
+         << "[batch-size] [num-clusters] [bisecting] [shortlist-size]"
+         << endl;
     return 1;
   }
   if (argc > 2) {
     std::stringstream(argv[2]) >> max_num_iter;
   }
+  if (argc > 3) {
+    std::stringstream(argv[3]) >> batch_size;
+  }
+  if (argc > 4) {
+    std::stringstream(argv[4]) >> k;
+  }
+  if (argc > 5) {
+    std::stringstream(argv[5]) >> bisecting;
+  }
+  if (argc > 6) {
+    std::stringstream(argv[6]) >> shortlist_size;
+  }
   Index index;
   auto start = Clock();
   Index::AddRecordsFromCsv(ReadFile(argv[1]), &index);
   index.ComputeScores(bm25_b, bm25_k);
   KMeansClustering cluster(index);
   cluster.ConstructMatrix();
+  // The shortlist pays off for the merge assignment only.
+  cluster.SetAssignment(shortlist_size ? KMeansClustering::kMergeAssignment :
+                                         KMeansClustering::kDenseAssignment);
+  cluster.SetShortlist(shortlist_size);
   auto end = Clock();
   cout << "Number of records: " << index.NumRecords()
        << "\nNumber of items: " << index.NumItems()
@@ -74,23 +198,36 @@ int main(int argc, char** argv) {
        << endl;
   start = Clock(Clock::kThreadCpuTime);
   Profiler::Start("clustering.prof");
-  const float rss = cluster.ComputeClustering(k, m, min_roc, max_num_iter);
+  const float rss = bisecting ?
+      cluster.ComputeBisectingClustering(k, m, min_roc, max_num_iter) :
+      batch_size ?
+      cluster.ComputeMiniBatchClustering(k, m, batch_size, min_roc,
+                                         max_num_iter) :
+      cluster.ComputeClustering(k, m, min_roc, max_num_iter);
   Profiler::Stop();
   cout << "Number of iterations: " << cluster.LastNumIters() << endl;
   cout << "Final RSS: " << rss << endl;
+  cout << "Distance computations: " << cluster.LastNumDistances();
+  if (!batch_size && !bisecting) {
+    cout << " of " << cluster.LastNumIters() * index.NumRecords() * k;
+  }
+  cout << endl;
+  if (shortlist_size && !batch_size && !bisecting) {
+    cout << "Shortlist miss rate: " << cluster.LastShortlistMissRate() << endl;
+  }
   cout << "Clustering time: " << Clock(Clock::kThreadCpuTime) - start << endl;
   // Output the clusters.
   std::ofstream cluster_file("clusters.txt");
-  for (size_t c = 0; c < k; ++c) {
-    auto centroid = cluster.Centroid(c);
-    KMeansClustering::Truncate(10, &centroid);
-    for (auto end = centroid.end(), it = centroid.begin(); it != end; ++it) {
-      if (it != centroid.begin()) {
-        cluster_file << ", ";
-      }
-      cluster_file << index.KeywordById(it->id).name;
-    }
-    cluster_file << "\n";
+  for (size_t c = 0; c < cluster.NumClusters(); ++c) {
+    cluster_file << TopKeywords(index, cluster.Centroid(c)) << "\n";
+  }
+  if (!cluster.SaveCentroids("centroids.bin")) {
+    cout << "Could not write centroids.bin" << endl;
+  }
+  if (bisecting) {
+    std::ofstream hierarchy_file("hierarchy.txt");
+    WriteHierarchy(index, cluster.Hierarchy(), 0, 0, &hierarchy_file);
   }
+  EvaluateClusterSearch(index, cluster, 1000);
   return 0;
 }
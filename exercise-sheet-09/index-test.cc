@@ -135,6 +135,15 @@ TEST_F(IndexTest, GoogleItems) {
             items);
 }
 
+TEST_F(IndexTest, NonAsciiKeywordId) {
+  // Only the ASCII letters are folded, other UTF-8 bytes are kept.
+  Index index;
+  const int id = index.AddKeyword("Straße");
+  EXPECT_EQ(id, index.KeywordId("straße"));
+  EXPECT_EQ(id, index.KeywordId("STRAße"));
+  EXPECT_EQ(Index::kInvalidId, index.KeywordId("strasse"));
+}
+
 TEST_F(IndexTest, NGrams) {
   EXPECT_EQ(vector<string>({}), Index::NGrams("", 2));
   EXPECT_EQ(vector<string>({}), Index::NGrams("", 3));
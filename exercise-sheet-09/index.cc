@@ -39,8 +39,8 @@ auto Index::ExtractKeywords(const string& content, const size_t beg,
                             const size_t end) -> vector<PosSize> {
   using std::isalnum;
 
-  // Keyword density approximation.
-  static float density = 1.0f / kMinKeywordSize;
+  // Keyword density approximation, per thread for concurrent extractions.
+  static thread_local float density = 1.0f / kMinKeywordSize;
 
   const size_t content_size = content.size();
   assert(beg < end && end <= content_size);
@@ -259,6 +259,8 @@ Index::Index()
     : num_items_(0u),
       total_size_(0u),
       ngram_n_(0),
+      bm25_b_(0.0f),
+      bm25_k_(0.0f),
       last_ed_avg_duration_(0) {}
 
 vector<string> Index::ApproximateMatches(const std::string& query,
@@ -301,23 +303,31 @@ vector<string> Index::ApproximateMatches(const std::string& query,
 }
 
 void Index::ComputeScores(const float b, const float k) {
-  const float num_records = NumRecords();
-  const float inv_avg_record_size = num_records / TotalSize();
+  bm25_b_ = b;
+  bm25_k_ = k;
   for (auto it = keywords_.begin(), end = keywords_.end(); it != end; ++it) {
     vector<Item>& items = it->items;
-    const float record_freq = items.size();
-    assert(record_freq >= 1.0f);
-    const float inv_record_freq = std::log2(num_records / record_freq);
+    const size_t record_freq = items.size();
+    assert(record_freq >= 1u);
     for (auto it2 = items.begin(), end2 = items.end(); it2 != end2; ++it2) {
       Item& item = *it2;
-      const float record_size  = RecordById(item.record_id).content.size();
-      item.score = item.score * (k + 1.0f) /
-                   (k * (1.0f - b + b * record_size * inv_avg_record_size) +
-                    item.score) * inv_record_freq;
+      const size_t record_size = RecordById(item.record_id).content.size();
+      item.score = Score(item.score, record_size, record_freq);
     }
   }
 }
 
+float Index::Score(const float freq, const size_t record_size,
+                   const size_t record_freq) const {
+  const float num_records = NumRecords();
+  const float inv_avg_record_size = num_records / TotalSize();
+  const float inv_record_freq = std::log2(num_records / record_freq);
+  const float size = record_size;
+  return freq * (bm25_k_ + 1.0f) /
+         (bm25_k_ * (1.0f - bm25_b_ + bm25_b_ * size * inv_avg_record_size) +
+          freq) * inv_record_freq;
+}
+
 void Index::BuildNGrams(const int ngram_n) {
   assert(ngram_n > 1);
   ngram_n_ = ngram_n;
@@ -352,9 +362,18 @@ auto Index::Items(const string& keyword) const -> const vector<Item>& {
 }
 
 int Index::KeywordId(const string& keyword) const {
-  string low = keyword;
-  std::transform(keyword.cbegin(), keyword.cend(), low.begin(), ::tolower);
-  auto const it = keyword_index_.find(low);
+  static thread_local string _low;
+
+  // Most keywords are lower case already. The bytes are passed unsigned, non
+  // ASCII bytes are negative chars.
+  const bool lower = std::none_of(keyword.cbegin(), keyword.cend(),
+      [](const unsigned char c) { return isupper(c); });
+  if (!lower) {
+    _low.resize(keyword.size());
+    std::transform(keyword.cbegin(), keyword.cend(), _low.begin(),
+        [](const unsigned char c) { return tolower(c); });
+  }
+  auto const it = keyword_index_.find(lower ? keyword : _low);
   if (it == keyword_index_.end()) {
     return kInvalidId;
   }
@@ -414,7 +433,8 @@ const vector<int>& Index::NGramItems(const string& ngram) const {
 
 int Index::AddKeyword(const string& keyword) {
   string low = keyword;
-  std::transform(keyword.cbegin(), keyword.cend(), low.begin(), ::tolower);
+  std::transform(keyword.cbegin(), keyword.cend(), low.begin(),
+      [](const unsigned char c) { return tolower(c); });
   int id = keywords_.size();
   keywords_.push_back(Keyword(low));
   keyword_index_.insert(std::make_pair(low, id));
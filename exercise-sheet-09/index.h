@@ -112,6 +112,12 @@ class Index {
   // Computes BM25 scores, replacing the term frequency based defaults.
   void ComputeScores(const float bm25_b, const float bm25_k);
 
+  // Returns the BM25 score of a keyword with given frequency within a record
+  // of given content size, if the keyword occurs in given number of records.
+  // Uses the parameters of the last call to ComputeScores.
+  float Score(const float freq, const size_t record_size,
+              const size_t record_freq) const;
+
   // Builds the n-gram index with given parameter.
   void BuildNGrams(const int ngram_n);
 
@@ -179,6 +185,8 @@ class Index {
   size_t num_items_;
   size_t total_size_;
   int ngram_n_;
+  float bm25_b_;
+  float bm25_k_;
   mutable Clock::Diff last_ed_avg_duration_;
 };
 
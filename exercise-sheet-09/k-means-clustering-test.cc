@@ -1,10 +1,15 @@
 // Copyright 2012 Eugen Sawin <esawin@me73.com>
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
+#include <omp.h>
+#include <random>
+#include <cstdio>
 #include <fstream>
+#include <string>
 #include <vector>
 #include <set>
 #include "./k-means-clustering.h"
+#include "./index.h"
 
 using std::vector;
 using std::set;
@@ -23,10 +28,53 @@ typedef KMeansClustering::IdScore IdScore;
 class KMeansClusteringTest : public ::testing::Test {
  public:
   void SetUp() {
+    const char* records[][2] = {
+      {"Tesla1", "Nikola Tesla invented the tesla coil and induction motor"},
+      {"Tesla2", "The tesla coil is a resonant transformer circuit by Tesla"},
+      {"Tesla3", "Tesla worked for Edison before building his motors"},
+      {"Tesla4", "Westinghouse bought the patents of the Tesla motor"},
+      {"Hydrogen1", "Hydrogen is the lightest chemical element of all"},
+      {"Hydrogen2", "Atomic hydrogen forms hydrogen molecules at low energy"},
+      {"Hydrogen3", "The hydrogen atom has a single proton and an electron"},
+      {"Hydrogen4", "Hydrogen molecules are the most abundant chemical "
+                    "molecules"},
+      {"Edison1", "Thomas Edison invented the phonograph and the light bulb"},
+      {"Edison2", "Edison founded General Electric and built the phonograph"}
+    };
+    string csv;
+    for (auto& record: records) {
+      csv += string(record[0]) + "\t" + record[1] + "\n";
+    }
+    Index::AddRecordsFromCsv(csv, &index_);
+    index_.ComputeScores(0.75f, 1.75f);
   }
 
   void TearDown() {
   }
+
+  // Adds a synthetic corpus of given number of records to the index. The
+  // records draw most words from the vocabulary of one of several topics.
+  // Corpora of more than 2 * 4096 records span several scheduling chunks and
+  // prefix sum blocks, so that the parallel merges are exercised.
+  static void AddSyntheticRecords(const size_t num_records, Index* index) {
+    std::mt19937 engine(73);
+    string csv;
+    for (size_t r = 0; r < num_records; ++r) {
+      csv += "Synthetic" + std::to_string(r) + "\t";
+      const size_t topic = engine() % 7u;
+      const size_t size = 8u + engine() % 16u;
+      for (size_t w = 0; w < size; ++w) {
+        const size_t word = engine() % 4u ? topic * 100u + engine() % 100u :
+                            1000u + engine() % 500u;
+        csv += "w" + std::to_string(word) + " ";
+      }
+      csv += "\n";
+    }
+    Index::AddRecordsFromCsv(csv, index);
+    index->ComputeScores(0.75f, 1.75f);
+  }
+
+  Index index_;
 };
 
 TEST_F(KMeansClusteringTest, Truncate) {
@@ -182,3 +230,380 @@ TEST_F(KMeansClusteringTest, Distance) {
   vec2 = { {4, 0.5f}, {5, 0.5f}, {6, 0.5f}, {7, 0.5f} };
   EXPECT_EQ(1.0f, KMeansClustering::Distance(vec1, vec2));
 }
+
+TEST_F(KMeansClusteringTest, Matrix) {
+  KMeansClustering clustering(index_);
+  clustering.ConstructMatrix();
+  ASSERT_EQ(index_.NumRecords(), clustering.NumRecords());
+  // Each keyword item becomes an entry of the record's row.
+  vector<vector<IdScore> > expected(index_.NumRecords());
+  for (size_t k = 0; k < index_.NumKeywords(); ++k) {
+    for (const Index::Item& item: index_.KeywordById(k).items) {
+      expected[item.record_id].push_back({static_cast<int>(k), item.score});
+    }
+  }
+  for (size_t r = 0; r < expected.size(); ++r) {
+    const KMeansClustering::Row row = clustering.RecordVector(r);
+    const vector<IdScore> vec = row.ToVector();
+    ASSERT_EQ(expected[r].size(), vec.size());
+    for (size_t i = 0; i < vec.size(); ++i) {
+      EXPECT_EQ(expected[r][i].id, vec[i].id);
+      EXPECT_EQ(expected[r][i].score, vec[i].score);
+    }
+    EXPECT_EQ(KMeansClustering::Distance(expected[r], expected[r]),
+              KMeansClustering::Distance(row, expected[r]));
+  }
+  // Rebuilding the matrix yields the same rows.
+  clustering.ConstructMatrix();
+  EXPECT_EQ(expected[0].size(), clustering.RecordVector(0).size);
+}
+
+TEST_F(KMeansClusteringTest, CompactMatrix) {
+  KMeansClustering clustering(index_);
+  clustering.ConstructMatrix();
+  KMeansClustering compact(index_);
+  compact.SetCompactMatrix(true);
+  compact.ConstructMatrix();
+  ASSERT_EQ(index_.NumRecords(), compact.NumRecords());
+  EXPECT_LT(compact.MatrixSize(), clustering.MatrixSize());
+  const float rss = clustering.ComputeClustering(3u, 100u, 0.0f, 100u);
+  // The normalized scores keep 8 significant bits.
+  for (size_t r = 0; r < index_.NumRecords(); ++r) {
+    const vector<IdScore> expected = clustering.RecordVector(r).ToVector();
+    const vector<IdScore> vec = compact.RecordVector(r).ToVector();
+    ASSERT_EQ(expected.size(), vec.size());
+    for (size_t i = 0; i < vec.size(); ++i) {
+      EXPECT_EQ(expected[i].id, vec[i].id);
+      EXPECT_NEAR(expected[i].score, vec[i].score, expected[i].score / 256);
+    }
+  }
+  EXPECT_NEAR(rss, compact.ComputeClustering(3u, 100u, 0.0f, 100u),
+              rss / 100);
+  // Large keyword id gaps are escaped.
+  string words;
+  string word = " waaaa";
+  for (int i = 0; i < 70000; ++i) {
+    for (int p = 0, n = i; p < 4; ++p, n /= 26) {
+      word[2 + p] = 'a' + n % 26;
+    }
+    words += word;
+  }
+  Index index;
+  Index::AddRecordsFromCsv("All\t" + words + "\nGap\t" + words.substr(0, 6) +
+                           words.substr(words.size() - 6) + "\n", &index);
+  index.ComputeScores(0.75f, 1.75f);
+  KMeansClustering large(index);
+  large.ConstructMatrix();
+  large.ComputeClustering(1u, 100u, 0.0f, 1u);
+  KMeansClustering large_compact(index);
+  large_compact.SetCompactMatrix(true);
+  large_compact.ConstructMatrix();
+  EXPECT_LT(large_compact.MatrixSize(), large.MatrixSize() * 0.51);
+  for (int r = 0; r < 2; ++r) {
+    const vector<IdScore> expected = large.RecordVector(r).ToVector();
+    const vector<IdScore> vec = large_compact.RecordVector(r).ToVector();
+    ASSERT_EQ(expected.size(), vec.size());
+    for (size_t i = 0; i < vec.size(); ++i) {
+      EXPECT_EQ(expected[i].id, vec[i].id);
+    }
+  }
+  const KMeansClustering::Row gap = large_compact.RecordVector(1);
+  ASSERT_EQ(2u, gap.size);
+  EXPECT_LE(0xffffu, gap.ids[1] - gap.ids[0]);
+}
+
+TEST_F(KMeansClusteringTest, ParallelClustering) {
+  // The clustering does not depend on the number of threads.
+  Index index;
+  AddSyntheticRecords(9000u, &index);
+  const int num_threads = omp_get_max_threads();
+  omp_set_num_threads(1);
+  KMeansClustering serial(index);
+  serial.ConstructMatrix();
+  const float serial_rss = serial.ComputeClustering(3u, 100u, 0.0f, 10u);
+  omp_set_num_threads(4);
+  KMeansClustering parallel(index);
+  parallel.ConstructMatrix();
+  const float rss = parallel.ComputeClustering(3u, 100u, 0.0f, 10u);
+  omp_set_num_threads(num_threads);
+  EXPECT_EQ(serial_rss, rss);
+  EXPECT_EQ(serial.LastNumIters(), parallel.LastNumIters());
+  set<int> records;
+  for (int c = 0; c < 3; ++c) {
+    EXPECT_EQ(serial.Cluster(c), parallel.Cluster(c));
+    EXPECT_EQ(serial.Centroid(c), parallel.Centroid(c));
+    records.insert(parallel.Cluster(c).begin(), parallel.Cluster(c).end());
+  }
+  // Each record is assigned to exactly one cluster.
+  EXPECT_EQ(index.NumRecords(), records.size());
+}
+
+TEST_F(KMeansClusteringTest, Assignment) {
+  KMeansClustering merge(index_);
+  merge.ConstructMatrix();
+  const float merge_rss = merge.ComputeClustering(3u, 5u, 0.0f, 10u);
+  for (const KMeansClustering::Assignment assignment:
+       {KMeansClustering::kDenseAssignment,
+        KMeansClustering::kInvertedAssignment}) {
+    KMeansClustering clustering(index_);
+    clustering.SetAssignment(assignment);
+    clustering.ConstructMatrix();
+    const float rss = clustering.ComputeClustering(3u, 5u, 0.0f, 10u);
+    EXPECT_EQ(merge_rss, rss);
+    EXPECT_EQ(merge.LastNumIters(), clustering.LastNumIters());
+    for (int c = 0; c < 3; ++c) {
+      EXPECT_EQ(merge.Cluster(c), clustering.Cluster(c));
+      EXPECT_EQ(merge.Centroid(c), clustering.Centroid(c));
+    }
+  }
+}
+
+TEST_F(KMeansClusteringTest, Pruning) {
+  KMeansClustering base(index_);
+  base.ConstructMatrix();
+  const float base_rss = base.ComputeClustering(3u, 5u, 0.0f, 10u);
+  EXPECT_EQ(base.LastNumIters() * index_.NumRecords() * 3u,
+            base.LastNumDistances());
+  for (const KMeansClustering::Assignment assignment:
+       {KMeansClustering::kMergeAssignment,
+        KMeansClustering::kInvertedAssignment}) {
+    KMeansClustering clustering(index_);
+    clustering.SetAssignment(assignment);
+    clustering.SetPruning(true);
+    clustering.ConstructMatrix();
+    const float rss = clustering.ComputeClustering(3u, 5u, 0.0f, 10u);
+    EXPECT_EQ(base_rss, rss);
+    EXPECT_EQ(base.LastNumIters(), clustering.LastNumIters());
+    EXPECT_GT(base.LastNumDistances(), clustering.LastNumDistances());
+    for (int c = 0; c < 3; ++c) {
+      EXPECT_EQ(base.Cluster(c), clustering.Cluster(c));
+      EXPECT_EQ(base.Centroid(c), clustering.Centroid(c));
+    }
+  }
+}
+
+TEST_F(KMeansClusteringTest, Shortlist) {
+  KMeansClustering base(index_);
+  base.ConstructMatrix();
+  const float base_rss = base.ComputeClustering(3u, 5u, 0.0f, 10u);
+  // A shortlist of all centroids equals the exact assignment.
+  KMeansClustering full(index_);
+  full.SetShortlist(3u);
+  full.ConstructMatrix();
+  EXPECT_EQ(base_rss, full.ComputeClustering(3u, 5u, 0.0f, 10u));
+  EXPECT_EQ(0.0f, full.LastShortlistMissRate());
+  for (int c = 0; c < 3; ++c) {
+    EXPECT_EQ(base.Cluster(c), full.Cluster(c));
+  }
+  KMeansClustering clustering(index_);
+  clustering.SetShortlist(1u);
+  clustering.ConstructMatrix();
+  clustering.ComputeClustering(3u, 5u, 0.0f, 10u);
+  // One distance per record and iteration, all sampled records use all.
+  const size_t num_sampled = (index_.NumRecords() - 1) /
+                             KMeansClustering::kShortlistSampleStep + 1;
+  EXPECT_EQ(clustering.LastNumIters() * (index_.NumRecords() +
+                                         3u * num_sampled),
+            clustering.LastNumDistances());
+  EXPECT_LE(0.0f, clustering.LastShortlistMissRate());
+  EXPECT_GE(1.0f, clustering.LastShortlistMissRate());
+  size_t num_records = 0u;
+  for (int c = 0; c < 3; ++c) {
+    num_records += clustering.Cluster(c).size();
+  }
+  EXPECT_EQ(index_.NumRecords(), num_records);
+}
+
+TEST_F(KMeansClusteringTest, MiniBatchClustering) {
+  KMeansClustering clustering(index_);
+  clustering.ConstructMatrix();
+  const float rss = clustering.ComputeMiniBatchClustering(3u, 100u, 4u, 0.0f,
+                                                          20u);
+  EXPECT_GE(20u, clustering.LastNumIters());
+  // The final RSS is computed over all records.
+  float expected_rss = 0.0f;
+  set<int> records;
+  for (int c = 0; c < 3; ++c) {
+    for (const int record_id: clustering.Cluster(c)) {
+      const float dist = KMeansClustering::Distance(
+          clustering.RecordVector(record_id), clustering.Centroid(c));
+      expected_rss += dist * dist;
+      records.insert(record_id);
+    }
+  }
+  EXPECT_EQ(index_.NumRecords(), records.size());
+  EXPECT_FLOAT_EQ(expected_rss, rss);
+  // The sampling is deterministic.
+  const int num_threads = omp_get_max_threads();
+  omp_set_num_threads(4);
+  KMeansClustering other(index_);
+  other.ConstructMatrix();
+  EXPECT_EQ(rss, other.ComputeMiniBatchClustering(3u, 100u, 4u, 0.0f, 20u));
+  omp_set_num_threads(num_threads);
+  for (int c = 0; c < 3; ++c) {
+    EXPECT_EQ(clustering.Centroid(c), other.Centroid(c));
+  }
+}
+
+TEST_F(KMeansClusteringTest, Seeding) {
+  Index index;
+  AddSyntheticRecords(9000u, &index);
+  for (const KMeansClustering::Seeding seeding:
+       {KMeansClustering::kPPSeeding, KMeansClustering::kScalableSeeding}) {
+    // The seeds are distinct records, independent of the number of threads.
+    const int num_threads = omp_get_max_threads();
+    omp_set_num_threads(1);
+    KMeansClustering serial(index);
+    serial.SetSeeding(seeding);
+    serial.ConstructMatrix();
+    serial.ComputeClustering(5u, 100u, 0.0f, 0u);
+    omp_set_num_threads(4);
+    KMeansClustering parallel(index);
+    parallel.SetSeeding(seeding);
+    parallel.ConstructMatrix();
+    parallel.ComputeClustering(5u, 100u, 0.0f, 0u);
+    omp_set_num_threads(num_threads);
+    for (int c = 0; c < 5; ++c) {
+      EXPECT_EQ(serial.Centroid(c), parallel.Centroid(c));
+      for (int other = 0; other < c; ++other) {
+        EXPECT_NE(parallel.Centroid(other), parallel.Centroid(c));
+      }
+    }
+  }
+}
+
+TEST_F(KMeansClusteringTest, BisectingClustering) {
+  // The clustering does not depend on the number of threads.
+  Index index;
+  AddSyntheticRecords(9000u, &index);
+  const int num_threads = omp_get_max_threads();
+  omp_set_num_threads(1);
+  KMeansClustering serial(index);
+  serial.ConstructMatrix();
+  const float serial_rss = serial.ComputeBisectingClustering(3u, 100u, 0.0f,
+                                                             100u);
+  omp_set_num_threads(4);
+  KMeansClustering parallel(index);
+  parallel.ConstructMatrix();
+  const float rss = parallel.ComputeBisectingClustering(3u, 100u, 0.0f, 100u);
+  omp_set_num_threads(num_threads);
+  EXPECT_EQ(serial_rss, rss);
+  ASSERT_EQ(3u, parallel.NumClusters());
+  // Two splits of binary nodes.
+  const vector<KMeansClustering::Node>& hierarchy = parallel.Hierarchy();
+  ASSERT_EQ(5u, hierarchy.size());
+  EXPECT_EQ(KMeansClustering::kInvalidId, hierarchy[0].parent);
+  EXPECT_EQ(index.NumRecords(), hierarchy[0].size);
+  for (const KMeansClustering::Node& node: hierarchy) {
+    if (node.left != KMeansClustering::kInvalidId) {
+      EXPECT_EQ(KMeansClustering::kInvalidId, node.cluster);
+      EXPECT_EQ(node.size,
+                hierarchy[node.left].size + hierarchy[node.right].size);
+    } else {
+      EXPECT_EQ(node.size, parallel.Cluster(node.cluster).size());
+    }
+  }
+  set<int> records;
+  for (int c = 0; c < 3; ++c) {
+    EXPECT_EQ(serial.Cluster(c), parallel.Cluster(c));
+    EXPECT_EQ(serial.Centroid(c), parallel.Centroid(c));
+    records.insert(parallel.Cluster(c).begin(), parallel.Cluster(c).end());
+    // The converged clusters are consistent with the hierarchy descent.
+    for (const int record_id: parallel.Cluster(c)) {
+      EXPECT_EQ(c, parallel.NearestCluster(
+          parallel.RecordVector(record_id).ToVector()));
+    }
+  }
+  // Each record is assigned to exactly one cluster.
+  EXPECT_EQ(index.NumRecords(), records.size());
+  // The flat clusterings have no hierarchy.
+  parallel.ComputeClustering(3u, 100u, 0.0f, 10u);
+  EXPECT_TRUE(parallel.Hierarchy().empty());
+}
+
+TEST_F(KMeansClusteringTest, RecordAssignment) {
+  KMeansClustering clustering(index_);
+  clustering.ConstructMatrix();
+  clustering.ComputeClustering(3u, 100u, 0.0f, 100u);
+  // New records are vectorized like the indexed records.
+  vector<string> contents;
+  for (size_t r = 0; r < index_.NumRecords(); ++r) {
+    contents.push_back(index_.RecordById(r).content);
+    EXPECT_EQ(clustering.RecordVector(r).ToVector(),
+              clustering.Vectorize(contents.back()));
+  }
+  EXPECT_TRUE(clustering.Vectorize("").empty());
+  EXPECT_TRUE(clustering.Vectorize("unknown words only").empty());
+  // The converged clusters are consistent with the assignment.
+  vector<int> centroid_ids;
+  clustering.AssignRecords(contents, &centroid_ids);
+  ASSERT_EQ(contents.size(), centroid_ids.size());
+  for (int c = 0; c < 3; ++c) {
+    for (const int record_id: clustering.Cluster(c)) {
+      EXPECT_EQ(c, centroid_ids[record_id]);
+    }
+  }
+  // The loaded centroids assign the records equally.
+  const string path = "KMeansClusteringTest.TMP.centroids";
+  ASSERT_TRUE(clustering.SaveCentroids(path));
+  KMeansClustering loaded(index_);
+  EXPECT_FALSE(loaded.LoadCentroids(path + ".missing"));
+  ASSERT_TRUE(loaded.LoadCentroids(path));
+  std::remove(path.c_str());
+  ASSERT_EQ(3u, loaded.NumClusters());
+  for (int c = 0; c < 3; ++c) {
+    EXPECT_EQ(clustering.Centroid(c), loaded.Centroid(c));
+    EXPECT_TRUE(loaded.Cluster(c).empty());
+  }
+  vector<int> loaded_ids;
+  loaded.AssignRecords(contents, &loaded_ids);
+  EXPECT_EQ(centroid_ids, loaded_ids);
+}
+
+TEST_F(KMeansClusteringTest, Reproducibility) {
+  // All modes yield bit-identical results for any number of threads.
+  Index index;
+  AddSyntheticRecords(9000u, &index);
+  const KMeansClustering::Assignment assignments[] = {
+    KMeansClustering::kMergeAssignment, KMeansClustering::kDenseAssignment,
+    KMeansClustering::kInvertedAssignment
+  };
+  const int num_threads = omp_get_max_threads();
+  for (int mode = 0; mode < 10; ++mode) {
+    vector<vector<IdScore> > expected_centroids;
+    vector<vector<int> > expected_clusters;
+    float expected_rss = 0.0f;
+    for (const int threads: {1, 3, 8}) {
+      omp_set_num_threads(threads);
+      KMeansClustering clustering(index);
+      clustering.SetCompactMatrix(mode == 9);
+      clustering.ConstructMatrix();
+      clustering.SetAssignment(assignments[mode % 3]);
+      clustering.SetPruning(mode == 3);
+      clustering.SetShortlist(mode == 8 ? 2u : 0u);
+      clustering.SetSeeding(mode == 4 ? KMeansClustering::kScalableSeeding :
+                            KMeansClustering::kPPSeeding);
+      const float rss =
+          mode == 6 ? clustering.ComputeMiniBatchClustering(4u, 5u, 3u, 0.0f,
+                                                            20u) :
+          mode == 7 ? clustering.ComputeBisectingClustering(4u, 5u, 0.0f, 10u) :
+          clustering.ComputeClustering(4u, 5u, 0.0f, 10u);
+      vector<vector<IdScore> > centroids;
+      vector<vector<int> > clusters;
+      for (size_t c = 0; c < clustering.NumClusters(); ++c) {
+        centroids.push_back(clustering.Centroid(c));
+        clusters.push_back(clustering.Cluster(c));
+      }
+      if (threads == 1) {
+        expected_centroids = centroids;
+        expected_clusters = clusters;
+        expected_rss = rss;
+      } else {
+        EXPECT_EQ(expected_rss, rss) << mode;
+        EXPECT_EQ(expected_centroids, centroids) << mode;
+        EXPECT_EQ(expected_clusters, clusters) << mode;
+      }
+    }
+  }
+  omp_set_num_threads(num_threads);
+}
@@ -1,25 +1,260 @@
 // Copyright 2013 Eugen Sawin <esawin@me73.com>
 #include "./k-means-clustering.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include <random>
 #include <cassert>
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <limits>
+#include <string>
+#include <unordered_map>
 #include "./index.h"
 
+using std::string;
 using std::vector;
 
 const int KMeansClustering::kInvalidId = -1;
+const size_t KMeansClustering::kMaxNoImprovement = 10u;
+const size_t KMeansClustering::kScalableNumRounds = 5u;
+const size_t KMeansClustering::kScalableOversampling = 2u;
+const size_t KMeansClustering::kSignatureWords = 4u;
+const size_t KMeansClustering::kShortlistSampleStep = 32u;
+
+// Safety margin of the Euclidean distance bounds used for pruning. The
+// distances are derived from float dot products, their rounding errors are
+// amplified by the square root for nearby vectors.
+static const float kBoundMargin = 1e-2f;
+
+// Marks a delta of the compact matrix ids stored in the two following units,
+// low half first.
+static const uint16_t kDeltaEscape = 0xffffu;
+
+// Returns the bfloat16 bits of given finite float, rounded to nearest even.
+static inline uint16_t ToBfloat16(const float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return (bits + 0x7fffu + ((bits >> 16) & 1u)) >> 16;
+}
+
+// Returns the float of given bfloat16 bits.
+static inline float FromBfloat16(const uint16_t half) {
+  const uint32_t bits = static_cast<uint32_t>(half) << 16;
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Maximum deviation of the squared norm of a normalized vector from one.
+static const float kMaxNormError = 1e-3f;
+
+// Returns the Euclidean distance between two normalized vectors with given
+// distance, see KMeansClustering::Distance.
+static inline float Euclidean(const float dist) {
+  return std::sqrt(std::max(0.0f, 2.0f * dist));
+}
+
+// Moves the centroid towards given record vector by the learning rate, i.e.
+// computes (1 - rate) * centroid + rate * vec. Uses the buffer as scratch
+// space.
+static void MoveTowards(const KMeansClustering::Row& vec, const float rate,
+                        vector<KMeansClustering::IdScore>* centroid,
+                        vector<KMeansClustering::IdScore>* buffer) {
+  buffer->clear();
+  const float keep = 1.0f - rate;
+  auto it1 = centroid->begin();
+  const auto end1 = centroid->end();
+  size_t i2 = 0u;
+  while (it1 != end1 || i2 < vec.size) {
+    const int id2 = i2 < vec.size ? vec.ids[i2] : 0;
+    if (i2 == vec.size || (it1 != end1 && it1->id < id2)) {
+      buffer->push_back({it1->id, keep * it1->score});
+      ++it1;
+    } else if (it1 == end1 || id2 < it1->id) {
+      buffer->push_back({id2, rate * vec.scores[i2]});
+      ++i2;
+    } else {
+      buffer->push_back({it1->id, keep * it1->score + rate * vec.scores[i2]});
+      ++it1;
+      ++i2;
+    }
+  }
+  centroid->swap(*buffer);
+}
+
+// The block size of the parallel prefix sums and reductions. It is
+// independent of the number of threads, which keeps the sums deterministic.
+static const size_t kPrefixBlockSize = 4096u;
+
+// Writes the prefix sums of the weighted squared distances to the list. The
+// weights are optional.
+static void SquaredPrefixSums(const vector<float>& dists,
+                              const vector<float>* weights,
+                              vector<double>* sums) {
+  assert(sums && (!weights || weights->size() == dists.size()));
+  const size_t size = dists.size();
+  sums->resize(size);
+  const size_t num_blocks = (size + kPrefixBlockSize - 1) / kPrefixBlockSize;
+  vector<double> block_sums(num_blocks + 1, 0.0);
+  #pragma omp parallel for
+  for (size_t b = 0; b < num_blocks; ++b) {
+    const size_t end = std::min(size, (b + 1) * kPrefixBlockSize);
+    double sum = 0.0;
+    for (size_t i = b * kPrefixBlockSize; i < end; ++i) {
+      sum += (weights ? (*weights)[i] : 1.0f) * dists[i] * dists[i];
+      (*sums)[i] = sum;
+    }
+    block_sums[b + 1] = sum;
+  }
+  for (size_t b = 0; b < num_blocks; ++b) {
+    block_sums[b + 1] += block_sums[b];
+  }
+  #pragma omp parallel for
+  for (size_t b = 1; b < num_blocks; ++b) {
+    const size_t end = std::min(size, (b + 1) * kPrefixBlockSize);
+    for (size_t i = b * kPrefixBlockSize; i < end; ++i) {
+      (*sums)[i] += block_sums[b];
+    }
+  }
+}
+
+// Returns the index of the first range containing the picked value, given the
+// prefix sums of the range sizes. Empty ranges are never picked.
+static size_t Sample(const vector<double>& sums, const double value) {
+  const size_t index = std::upper_bound(sums.begin(), sums.end(), value) -
+                       sums.begin();
+  return std::min(index, sums.size() - 1);
+}
+
+// Returns the sum of the squared values. Fixed blocks are summed in parallel
+// with double precision and the block sums are added in order, the sum is
+// independent of the number of threads.
+static float SumSquares(const vector<float>& values) {
+  const size_t size = values.size();
+  const size_t num_blocks = (size + kPrefixBlockSize - 1) / kPrefixBlockSize;
+  vector<double> block_sums(num_blocks, 0.0);
+  #pragma omp parallel for
+  for (size_t b = 0; b < num_blocks; ++b) {
+    const size_t end = std::min(size, (b + 1) * kPrefixBlockSize);
+    double sum = 0.0;
+    for (size_t i = b * kPrefixBlockSize; i < end; ++i) {
+      sum += static_cast<double>(values[i]) * values[i];
+    }
+    block_sums[b] = sum;
+  }
+  double sum = 0.0;
+  for (const double block_sum: block_sums) {
+    sum += block_sum;
+  }
+  return sum;
+}
+
+// Returns the distance between given record vector and the vector scattered
+// into the dense scores. Equals the sparse Distance, the products of matching
+// dimensions are summed in the same order.
+static float GatherDistance(const KMeansClustering::Row& vec,
+                            const float* scores) {
+  float dist = 0.0f;
+  for (size_t i = 0; i < vec.size; ++i) {
+    dist += vec.scores[i] * scores[vec.ids[i]];
+  }
+  return 1.0f - dist;
+}
+
+// Writes the scores of given vector into the dense scores.
+static void Scatter(const vector<KMeansClustering::IdScore>& vec,
+                    float* scores) {
+  for (const KMeansClustering::IdScore& idsc: vec) {
+    scores[idsc.id] = idsc.score;
+  }
+}
+
+// Resets the scores of given vector within the dense scores to zero.
+static void Clear(const vector<KMeansClustering::IdScore>& vec,
+                  float* scores) {
+  for (const KMeansClustering::IdScore& idsc: vec) {
+    scores[idsc.id] = 0.0f;
+  }
+}
+
+// Returns whether given vector is normalized.
+template<typename Vector>
+static bool IsUnit(const Vector& vec) {
+  float norm = 0.0f;
+  for (const KMeansClustering::IdScore& idsc: vec) {
+    norm += idsc.score * idsc.score;
+  }
+  return std::abs(norm - 1.0f) < kMaxNormError;
+}
+
+// Returns the 64-bit mix of given value, the finalizer of SplitMix64.
+static inline uint64_t Mix(uint64_t value) {
+  value += 0x9e3779b97f4a7c15ull;
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+  return value ^ (value >> 31);
+}
+
+// Writes the SimHash signature of kSignatureWords words of given vector. The
+// coordinates of the hyperplane normals are +-1 derived from the keyword ids,
+// bit b is set if the score sum of the dimensions with positive coordinate
+// exceeds the one with negative coordinate.
+template<typename Vector>
+static void SimHash(const Vector& vec, uint64_t* signature) {
+  const size_t num_words = KMeansClustering::kSignatureWords;
+  // The positive score sums per bit.
+  vector<float> sums(num_words * 64u, 0.0f);
+  float total = 0.0f;
+  for (const KMeansClustering::IdScore& idsc: vec) {
+    for (size_t w = 0; w < num_words; ++w) {
+      const uint64_t bits = Mix(idsc.id * num_words + w);
+      float* const word_sums = &sums[w * 64u];
+      for (size_t b = 0; b < 64u; ++b) {
+        word_sums[b] += ((bits >> b) & 1u) * idsc.score;
+      }
+    }
+    total += idsc.score;
+  }
+  for (size_t w = 0; w < num_words; ++w) {
+    uint64_t word = 0u;
+    for (size_t b = 0; b < 64u; ++b) {
+      word |= static_cast<uint64_t>(2.0f * sums[w * 64u + b] > total) << b;
+    }
+    signature[w] = word;
+  }
+}
 
 KMeansClustering::KMeansClustering(const Index& index)
-    : index_(index) {}
+    : index_(index),
+      num_iters_(0u),
+      assignment_(kDefAssignment),
+      seeding_(kDefSeeding),
+      pruning_(false),
+      compact_(false),
+      shortlist_size_(0u),
+      shortlist_miss_rate_(0.0f),
+      num_distances_(0u) {}
+
+auto KMeansClustering::Row::ToVector() const -> vector<IdScore> {
+  vector<IdScore> vec;
+  vec.reserve(size);
+  for (size_t i = 0; i < size; ++i) {
+    vec.push_back({static_cast<int>(ids[i]), scores[i]});
+  }
+  return vec;
+}
 
 void KMeansClustering::Truncate(const size_t m, vector<IdScore>* vec) {
   assert(vec);
   if (vec->size() <= m) {
     return;
   }
-  std::partial_sort(vec->begin(), vec->begin() + m, vec->end(),
+  // The order is total, the selected dimensions are unique.
+  std::nth_element(vec->begin(), vec->begin() + m, vec->end(),
       [](const IdScore& lhs, const IdScore& rhs) {
     return lhs.score > rhs.score || (lhs.score == rhs.score && lhs < rhs);
   });
@@ -68,47 +303,331 @@ float KMeansClustering::Distance(const vector<IdScore>& v1,
   return 1.0f - dist;
 }
 
+float KMeansClustering::Distance(const Row& v1, const vector<IdScore>& v2) {
+  // Same as above, the products are summed in the same order.
+  size_t i1 = 0u;
+  const size_t end1 = v1.size;
+  auto it2 = v2.begin();
+  const auto end2 = v2.end();
+  float dist = 0.0f;
+  while (i1 != end1 && it2 != end2) {
+    while (i1 != end1 && static_cast<int>(v1.ids[i1]) < it2->id) {
+      ++i1;
+    }
+    if (i1 == end1) {
+      break;
+    }
+    const int id1 = v1.ids[i1];
+    while (it2 != end2 && it2->id < id1) {
+      ++it2;
+    }
+    while (i1 != end1 && it2 != end2 &&
+           static_cast<int>(v1.ids[i1]) == it2->id) {
+      dist += v1.scores[i1] * it2->score;
+      ++i1;
+      ++it2;
+    }
+  }
+  return 1.0f - dist;
+}
+
 auto KMeansClustering::Average(const vector<int>& records) const
     -> vector<IdScore> {
-  vector<IdScore> merged;
-  for (const int id: records) {
-    const vector<IdScore>& vec = RecordVector(id);
-    merged.insert(merged.end(), vec.begin(), vec.end());
-  }
-  std::sort(merged.begin(), merged.end());
   vector<IdScore> avg;
-  for (const IdScore& idsc: merged) {
-    if (avg.size() && avg.back().id == idsc.id) {
-      // Same record, increase sum.
-      avg.back().score += idsc.score;
-    } else {
-      avg.push_back(idsc);
+  Average(records, std::numeric_limits<size_t>::max(), &avg);
+  return avg;
+}
+
+void KMeansClustering::Average(const vector<int>& records, const size_t m,
+                               vector<IdScore>* avg) const {
+  // The accumulator is all zeros between calls.
+  static thread_local vector<float> _sums;
+  static thread_local vector<bool> _touched;
+
+  assert(avg);
+  _sums.resize(index_.NumKeywords(), 0.0f);
+  _touched.resize(index_.NumKeywords(), false);
+  avg->clear();
+  for (const int id: records) {
+    const Row vec = RecordVector(id);
+    for (size_t i = 0; i < vec.size; ++i) {
+      const uint32_t dim = vec.ids[i];
+      if (!_touched[dim]) {
+        _touched[dim] = true;
+        avg->push_back({static_cast<int>(dim), 0.0f});
+      }
+      _sums[dim] += vec.scores[i];
     }
   }
   const int num_records = records.size();
-  for (IdScore& idsc: avg) {
-    idsc.score /= num_records;
+  for (IdScore& idsc: *avg) {
+    idsc.score = _sums[idsc.id] / num_records;
+    _sums[idsc.id] = 0.0f;
+    _touched[idsc.id] = false;
+  }
+  if (avg->size() > m) {
+    Truncate(m, avg);
+  } else {
+    std::sort(avg->begin(), avg->end());
   }
-  return avg;
 }
 
 void KMeansClustering::ConstructMatrix() {
-  const int num_records = index_.NumRecords();
-  const int num_keywords = index_.NumKeywords();
-  record_matrix_.resize(num_records);
-  for (int k = 0; k < num_keywords; ++k) {
-    const Index::Keyword& keyword = index_.KeywordById(k);
-    for (const Index::Item& item: keyword.items) {
-      record_matrix_[item.record_id].push_back({k, item.score});
+  compact_id_offsets_.clear();
+  compact_ids_.clear();
+  compact_scores_.clear();
+  const size_t num_records = index_.NumRecords();
+  const size_t num_keywords = index_.NumKeywords();
+  size_t num_entries = 0u;
+  for (size_t k = 0; k < num_keywords; ++k) {
+    num_entries += index_.KeywordById(k).items.size();
+  }
+  // Split the keywords into chunks of about the same number of entries, each
+  // chunk is transposed by a single thread.
+  size_t num_chunks = 1u;
+#ifdef _OPENMP
+  num_chunks = omp_get_max_threads();
+#endif
+  vector<size_t> chunk_begins(num_chunks + 1, num_keywords);
+  chunk_begins[0] = 0u;
+  size_t chunk = 1u;
+  size_t chunk_entries = 0u;
+  for (size_t k = 0; k < num_keywords && chunk < num_chunks; ++k) {
+    chunk_entries += index_.KeywordById(k).items.size();
+    if (chunk_entries * num_chunks >= chunk * num_entries) {
+      chunk_begins[chunk++] = k + 1;
+    }
+  }
+  // Count the entries per chunk and record.
+  vector<vector<uint32_t> > positions(num_chunks,
+                                      vector<uint32_t>(num_records, 0u));
+  #pragma omp parallel for schedule(static, 1)
+  for (size_t c = 0; c < num_chunks; ++c) {
+    for (size_t k = chunk_begins[c]; k < chunk_begins[c + 1]; ++k) {
+      for (const Index::Item& item: index_.KeywordById(k).items) {
+        ++positions[c][item.record_id];
+      }
+    }
+  }
+  // Turn the counts into the positions of the chunks within the rows.
+  row_offsets_.assign(num_records + 1, 0u);
+  #pragma omp parallel for
+  for (size_t r = 0; r < num_records; ++r) {
+    uint32_t pos = 0u;
+    for (size_t c = 0; c < num_chunks; ++c) {
+      const uint32_t count = positions[c][r];
+      positions[c][r] = pos;
+      pos += count;
+    }
+    row_offsets_[r + 1] = pos;
+  }
+  for (size_t r = 0; r < num_records; ++r) {
+    row_offsets_[r + 1] += row_offsets_[r];
+  }
+  // Fill the rows, the keyword ids of each row are ascending.
+  row_ids_.resize(num_entries);
+  row_scores_.resize(num_entries);
+  #pragma omp parallel for schedule(static, 1)
+  for (size_t c = 0; c < num_chunks; ++c) {
+    for (size_t k = chunk_begins[c]; k < chunk_begins[c + 1]; ++k) {
+      for (const Index::Item& item: index_.KeywordById(k).items) {
+        const size_t pos = row_offsets_[item.record_id] +
+                           positions[c][item.record_id]++;
+        row_ids_[pos] = k;
+        row_scores_[pos] = item.score;
+      }
+    }
+  }
+  if (compact_) {
+    CompactMatrix();
+  }
+}
+
+void KMeansClustering::CompactMatrix() {
+  NormalizeRecords();
+  const size_t num_records = NumRecords();
+  // Count the 16-bit units of the delta-coded ids per record.
+  compact_id_offsets_.assign(num_records + 1, 0u);
+  #pragma omp parallel for schedule(dynamic, 256)
+  for (size_t r = 0; r < num_records; ++r) {
+    uint32_t prev = 0u;
+    size_t num_units = 0u;
+    for (size_t i = row_offsets_[r]; i < row_offsets_[r + 1]; ++i) {
+      num_units += row_ids_[i] - prev < kDeltaEscape ? 1u : 3u;
+      prev = row_ids_[i];
+    }
+    compact_id_offsets_[r + 1] = num_units;
+  }
+  for (size_t r = 0; r < num_records; ++r) {
+    compact_id_offsets_[r + 1] += compact_id_offsets_[r];
+  }
+  compact_ids_.resize(compact_id_offsets_[num_records]);
+  #pragma omp parallel for schedule(dynamic, 256)
+  for (size_t r = 0; r < num_records; ++r) {
+    uint16_t* units = &compact_ids_[0] + compact_id_offsets_[r];
+    uint32_t prev = 0u;
+    for (size_t i = row_offsets_[r]; i < row_offsets_[r + 1]; ++i) {
+      const uint32_t delta = row_ids_[i] - prev;
+      if (delta < kDeltaEscape) {
+        *units++ = delta;
+      } else {
+        *units++ = kDeltaEscape;
+        *units++ = delta & 0xffffu;
+        *units++ = delta >> 16;
+      }
+      prev = row_ids_[i];
+    }
+  }
+  const size_t num_entries = row_scores_.size();
+  compact_scores_.resize(num_entries);
+  #pragma omp parallel for
+  for (size_t i = 0; i < num_entries; ++i) {
+    compact_scores_[i] = ToBfloat16(row_scores_[i]);
+  }
+  vector<uint32_t>().swap(row_ids_);
+  vector<float>().swap(row_scores_);
+}
+
+bool KMeansClustering::IsCompact() const {
+  return !compact_id_offsets_.empty();
+}
+
+void KMeansClustering::NormalizeRecords() {
+  if (IsCompact()) {
+    // The compact matrix is normalized on construction.
+    return;
+  }
+  const size_t num_records = NumRecords();
+  #pragma omp parallel for schedule(dynamic, 256)
+  for (size_t r = 0; r < num_records; ++r) {
+    // Same as Normalize.
+    float* const scores = &row_scores_[0] + row_offsets_[r];
+    const size_t size = row_offsets_[r + 1] - row_offsets_[r];
+    float norm = 0.0f;
+    for (size_t i = 0; i < size; ++i) {
+      norm += scores[i] * scores[i];
+    }
+    norm = std::sqrt(norm);
+    if (norm == 0.0f) {
+      continue;
+    }
+    for (size_t i = 0; i < size; ++i) {
+      scores[i] /= norm;
+    }
+  }
+}
+
+void KMeansClustering::SetAssignment(const Assignment assignment) {
+  assignment_ = assignment;
+}
+
+void KMeansClustering::SetSeeding(const Seeding seeding) {
+  seeding_ = seeding;
+}
+
+void KMeansClustering::SetPruning(const bool pruning) {
+  pruning_ = pruning;
+}
+
+void KMeansClustering::SetCompactMatrix(const bool compact) {
+  compact_ = compact;
+}
+
+void KMeansClustering::SetShortlist(const size_t size) {
+  shortlist_size_ = size;
+}
+
+void KMeansClustering::BuildDenseCentroids() {
+  const size_t k = centroids_.size();
+  dense_dims_.assign(index_.NumKeywords(), kInvalidId);
+  size_t num_dims = 0u;
+  for (const vector<IdScore>& centroid: centroids_) {
+    for (const IdScore& idsc: centroid) {
+      if (dense_dims_[idsc.id] == kInvalidId) {
+        dense_dims_[idsc.id] = num_dims++;
+      }
+    }
+  }
+  dense_centroid_scores_.assign(num_dims * k, 0.0f);
+  for (size_t c = 0; c < k; ++c) {
+    for (const IdScore& idsc: centroids_[c]) {
+      dense_centroid_scores_[dense_dims_[idsc.id] * k + c] = idsc.score;
+    }
+  }
+}
+
+void KMeansClustering::DenseDistances(const Row& vec,
+                                      vector<float>* dists) const {
+  assert(dists && dists->size() == centroids_.size());
+  const size_t k = dists->size();
+  float* const dots = dists->data();
+  std::fill(dots, dots + k, 0.0f);
+  for (const IdScore& idsc: vec) {
+    const int dim = dense_dims_[idsc.id];
+    if (dim == kInvalidId) {
+      continue;
+    }
+    // Adds the scaled scores of all centroids, vectorized by the compiler.
+    const float* const scores = &dense_centroid_scores_[dim * k];
+    const float score = idsc.score;
+    for (size_t c = 0; c < k; ++c) {
+      dots[c] += score * scores[c];
+    }
+  }
+  for (size_t c = 0; c < k; ++c) {
+    dots[c] = 1.0f - dots[c];
+  }
+}
+
+void KMeansClustering::BuildInvertedCentroids() {
+  const size_t k = centroids_.size();
+  const size_t num_keywords = index_.NumKeywords();
+  // Count the centroids per keyword, then fill the lists in centroid order.
+  inverted_offsets_.assign(num_keywords + 1, 0u);
+  for (const vector<IdScore>& centroid: centroids_) {
+    for (const IdScore& idsc: centroid) {
+      ++inverted_offsets_[idsc.id + 1];
+    }
+  }
+  for (size_t i = 0; i < num_keywords; ++i) {
+    inverted_offsets_[i + 1] += inverted_offsets_[i];
+  }
+  inverted_centroids_.resize(inverted_offsets_[num_keywords]);
+  vector<size_t> ends(inverted_offsets_.begin(), inverted_offsets_.end() - 1);
+  for (size_t c = 0; c < k; ++c) {
+    for (const IdScore& idsc: centroids_[c]) {
+      inverted_centroids_[ends[idsc.id]++] = {static_cast<int>(c), idsc.score};
     }
   }
 }
 
+template<typename Vector>
+void KMeansClustering::InvertedDistances(const Vector& vec,
+                                         vector<float>* dists) const {
+  assert(dists && dists->size() == centroids_.size());
+  const size_t k = dists->size();
+  float* const dots = dists->data();
+  std::fill(dots, dots + k, 0.0f);
+  const IdScore* const centroids = inverted_centroids_.data();
+  for (const IdScore& idsc: vec) {
+    const size_t end = inverted_offsets_[idsc.id + 1];
+    for (size_t i = inverted_offsets_[idsc.id]; i < end; ++i) {
+      dots[centroids[i].id] += idsc.score * centroids[i].score;
+    }
+  }
+  for (size_t c = 0; c < k; ++c) {
+    dots[c] = 1.0f - dots[c];
+  }
+}
+
 int KMeansClustering::NextFarthestCentroid(
     const vector<vector<IdScore> >& centroids, vector<float>* dists) const {
-  const size_t num_records = record_matrix_.size();
-  int farthest_id = 0;
-  float farthest_dist = 0.0f;
+  const size_t num_records = NumRecords();
+  vector<float> closest_dists;
+  if (!dists) {
+    dists = &closest_dists;
+  }
+  dists->resize(num_records);
   #pragma omp parallel for
   for (size_t r = 0; r < num_records; ++r) {
     float closest_dist = std::numeric_limits<float>::max();
@@ -116,18 +635,61 @@ int KMeansClustering::NextFarthestCentroid(
       const float dist = Distance(RecordVector(r), vec);
       closest_dist = std::min(closest_dist, dist);
     }
-    if (dists) {
-      (*dists)[r] = closest_dist;
+    (*dists)[r] = closest_dist;
+  }
+  // The first record of maximum distance.
+  return std::max_element(dists->begin(), dists->end()) - dists->begin();
+}
+
+void KMeansClustering::UpdateNearest(const vector<int>& centroid_records,
+                                     const size_t beg, const size_t end,
+                                     vector<float>* dists,
+                                     vector<int>* nearest_ids) const {
+  assert(dists && dists->size() == NumRecords());
+  assert(beg <= end && end <= centroid_records.size());
+  const size_t num_centroids = end - beg;
+  const size_t num_keywords = index_.NumKeywords();
+  // The inverted index over the new centroids, see BuildInvertedCentroids.
+  vector<size_t> offsets(num_keywords + 1, 0u);
+  for (size_t c = beg; c < end; ++c) {
+    for (const IdScore& idsc: RecordVector(centroid_records[c])) {
+      ++offsets[idsc.id + 1];
+    }
+  }
+  for (size_t i = 0; i < num_keywords; ++i) {
+    offsets[i + 1] += offsets[i];
+  }
+  vector<IdScore> postings(offsets[num_keywords]);
+  vector<size_t> ends(offsets.begin(), offsets.end() - 1);
+  for (size_t c = beg; c < end; ++c) {
+    for (const IdScore& idsc: RecordVector(centroid_records[c])) {
+      postings[ends[idsc.id]++] = {static_cast<int>(c - beg), idsc.score};
     }
-    #pragma omp critical(farthestdistupdate)
-    {  // NOLINT
-      if (closest_dist > farthest_dist) {
-        farthest_id = r;
-        farthest_dist = closest_dist;
+  }
+  const size_t num_records = NumRecords();
+  #pragma omp parallel
+  {  // NOLINT
+    vector<float> dots(num_centroids);
+    #pragma omp for schedule(dynamic, 256)
+    for (size_t r = 0; r < num_records; ++r) {
+      std::fill(dots.begin(), dots.end(), 0.0f);
+      for (const IdScore& idsc: RecordVector(r)) {
+        for (size_t i = offsets[idsc.id]; i < offsets[idsc.id + 1]; ++i) {
+          dots[postings[i].id] += idsc.score * postings[i].score;
+        }
+      }
+      // Equals Distance, the products are summed in the same order.
+      for (size_t c = 0; c < num_centroids; ++c) {
+        const float dist = 1.0f - dots[c];
+        if (dist < (*dists)[r]) {
+          (*dists)[r] = dist;
+          if (nearest_ids) {
+            (*nearest_ids)[r] = beg + c;
+          }
+        }
       }
     }
   }
-  return farthest_id;
 }
 
 auto KMeansClustering::PPCentroids(const size_t k) const
@@ -135,38 +697,107 @@ auto KMeansClustering::PPCentroids(const size_t k) const
   std::mt19937 engine;
   // Just a random number.
   engine.seed(7355);
-  const size_t num_records = record_matrix_.size();
-  vector<vector<IdScore> > centroids;
-  centroids.reserve(k);
+  const size_t num_records = NumRecords();
+  vector<int> centroid_records;
+  centroid_records.reserve(k);
   const int initial_centroid = ((num_records % 73) * 253) % num_records;
-  centroids.push_back(RecordVector(initial_centroid));
-  vector<float> probs;
-  probs.reserve(num_records);
+  centroid_records.push_back(initial_centroid);
+  vector<float> dists(num_records, std::numeric_limits<float>::max());
+  vector<double> probs;
   for (size_t c = 1; c < k; ++c) {
-    vector<float> dists(num_records);
-    // Get all distances.
-    NextFarthestCentroid(centroids, &dists);
-    probs.clear();
-    for (size_t r = 0; r < num_records; ++r) {
-      // Populate the vector with range values used for the probability
-      // distribution.
-      // 9999 is better than 0.9999, because more is always better!
-      const float prob = 10000.0f * dists[r] * dists[r] +
-          (probs.size() ? probs.back() : 0.0f);
-      probs.push_back(prob);
-    }
+    // Only the distances to the last added centroid are new.
+    UpdateNearest(centroid_records, c - 1, c, &dists);
+    // The probability ranges of the records.
+    SquaredPrefixSums(dists, 0, &probs);
     // Pick the winning value.
-    const float next = std::uniform_real_distribution<float>(0,
+    const double next = std::uniform_real_distribution<double>(0,
         probs.back())(engine);
     std::cout << "\rSeeded " << c << "/" << k
               << ": " << next << "/" << probs.back()
               << "     " << std::flush;
-    // Find the winning record, whose range contains the picked value.
-    int r = 0;
-    while (probs[r] < next) {
-      ++r;
+    centroid_records.push_back(Sample(probs, next));
+  }
+  std::cout << "\r                                                    " << "\r";
+  vector<vector<IdScore> > centroids;
+  centroids.reserve(k);
+  for (const int record_id: centroid_records) {
+    centroids.push_back(RecordVector(record_id).ToVector());
+  }
+  return centroids;
+}
+
+auto KMeansClustering::ScalableCentroids(const size_t k) const
+    -> vector<vector<IdScore> > {
+  std::mt19937 engine;
+  // Just a random number.
+  engine.seed(7355);
+  const size_t num_records = NumRecords();
+  const int initial_centroid = ((num_records % 73) * 253) % num_records;
+  // The candidate record ids and the nearest candidate of each record.
+  vector<int> candidates = {initial_centroid};
+  vector<bool> is_candidate(num_records, false);
+  is_candidate[initial_centroid] = true;
+  vector<float> dists(num_records, std::numeric_limits<float>::max());
+  vector<int> nearest_ids(num_records, 0);
+  UpdateNearest(candidates, 0u, 1u, &dists, &nearest_ids);
+  const double oversampling = kScalableOversampling * k;
+  size_t num_updated = 1u;
+  for (size_t round = 0; round < kScalableNumRounds || candidates.size() < k;
+       ++round) {
+    double cost = 0.0;
+    for (const float dist: dists) {
+      cost += dist * dist;
+    }
+    if (cost == 0.0) {
+      // All records coincide with a candidate.
+      break;
+    }
+    // Sample each record independently, proportional to its squared distance.
+    for (size_t r = 0; r < num_records; ++r) {
+      const double prob = oversampling * dists[r] * dists[r] / cost;
+      if (!is_candidate[r] &&
+          std::uniform_real_distribution<double>(0, 1)(engine) < prob) {
+        candidates.push_back(r);
+        is_candidate[r] = true;
+      }
+    }
+    UpdateNearest(candidates, num_updated, candidates.size(), &dists,
+                  &nearest_ids);
+    num_updated = candidates.size();
+    std::cout << "\rSeeding round " << round + 1 << ": "
+              << candidates.size() << " candidates     " << std::flush;
+  }
+  for (size_t r = 0; candidates.size() < k && r < num_records; ++r) {
+    // Not enough distinct records, fill up with duplicates.
+    if (!is_candidate[r]) {
+      candidates.push_back(r);
+      is_candidate[r] = true;
+    }
+  }
+  // Weight the candidates by the number of records nearest to them.
+  const size_t num_candidates = candidates.size();
+  vector<float> weights(num_candidates, 0.0f);
+  for (size_t r = 0; r < num_records; ++r) {
+    weights[nearest_ids[r]] += 1.0f;
+  }
+  // Weighted k-means++ over the candidates.
+  vector<vector<IdScore> > centroids;
+  centroids.reserve(k);
+  centroids.push_back(RecordVector(candidates[0]).ToVector());
+  vector<float> candidate_dists(num_candidates,
+                                std::numeric_limits<float>::max());
+  vector<double> probs;
+  for (size_t c = 1; c < k; ++c) {
+    #pragma omp parallel for
+    for (size_t i = 0; i < num_candidates; ++i) {
+      candidate_dists[i] = std::min(candidate_dists[i],
+          Distance(RecordVector(candidates[i]), centroids.back()));
     }
-    centroids.push_back(RecordVector(r));
+    SquaredPrefixSums(candidate_dists, &weights, &probs);
+    const double next = std::uniform_real_distribution<double>(0,
+        probs.back())(engine);
+    centroids.push_back(
+        RecordVector(candidates[Sample(probs, next)]).ToVector());
   }
   std::cout << "\r                                                    " << "\r";
   return centroids;
@@ -174,14 +805,14 @@ auto KMeansClustering::PPCentroids(const size_t k) const
 
 auto KMeansClustering::FarthestCentroids(const size_t k) const
     -> vector<vector<IdScore> > {
-  const size_t num_records = record_matrix_.size();
+  const size_t num_records = NumRecords();
   vector<vector<IdScore> > centroids;
   centroids.reserve(k);
   const int initial_centroid = ((num_records % 73) * 253) % num_records;
-  centroids.push_back(RecordVector(initial_centroid));
+  centroids.push_back(RecordVector(initial_centroid).ToVector());
   for (size_t c = 1; c < k; ++c) {
     const int next_id = NextFarthestCentroid(centroids);
-    centroids.push_back(RecordVector(next_id));
+    centroids.push_back(RecordVector(next_id).ToVector());
   }
   return centroids;
 }
@@ -190,35 +821,59 @@ auto KMeansClustering::RandomCentroids(const size_t k) const
     -> vector<vector<IdScore> > {
   vector<vector<IdScore> > centroids;
   centroids.reserve(k);
-  const size_t step = record_matrix_.size() / k;
+  const size_t step = NumRecords() / k;
   for (size_t i = 0; i < k; ++i) {
     // That's random.
-    centroids.push_back(record_matrix_[i * step]);
+    centroids.push_back(RecordVector(i * step).ToVector());
   }
   return centroids;
 }
 
-float KMeansClustering::ComputeClustering(
-    const size_t k, const size_t m, const float min_roc,
-    const size_t max_num_iter) {
+void KMeansClustering::InitClustering(const size_t k, const size_t m) {
   num_iters_ = 0u;
-  for (vector<IdScore>& vec: record_matrix_) {
-    // Truncating the original vectors might degrade the final result.
-    // Truncate(m, &vec);
-    Normalize(&vec);
+  num_distances_ = 0u;
+  // Truncating the original vectors might degrade the final result.
+  NormalizeRecords();
+  prev_centroids_.clear();
+  hierarchy_.clear();
+  shortlist_miss_rate_ = 0.0f;
+  if (shortlist_size_) {
+    const size_t num_records = NumRecords();
+    record_signatures_.resize(num_records * kSignatureWords);
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (size_t r = 0; r < num_records; ++r) {
+      SimHash(RecordVector(r), &record_signatures_[r * kSignatureWords]);
+    }
+  }
+  if (pruning_) {
+    assignments_.assign(NumRecords(), 0);
+    lower_bounds_.assign(NumRecords(), 0.0f);
+    unit_records_.resize(NumRecords());
+    for (size_t r = 0; r < NumRecords(); ++r) {
+      unit_records_[r] = IsUnit(RecordVector(r));
+    }
   }
-  centroids_ = PPCentroids(k);
+  centroids_ = seeding_ == kScalableSeeding ? ScalableCentroids(k) :
+                                              PPCentroids(k);
   // centroids_ = FarthestCentroids(k);
   // centroids_ = RandomCentroids(k);
   for (vector<IdScore>& vec: centroids_) {
     Truncate(m, &vec);
     Normalize(&vec);
   }
+}
+
+float KMeansClustering::ComputeClustering(
+    const size_t k, const size_t m, const float min_roc,
+    const size_t max_num_iter) {
+  InitClustering(k, m);
   float prev_rss = std::numeric_limits<float>::max();
   while (num_iters_ < max_num_iter) {
     ++num_iters_;
     const float rss = UpdateClusters(k);
-    assert(rss <= prev_rss);
+    // The summed distances are rounded, the RSS of a converged clustering may
+    // rise by a few ulps.
+    assert(rss <= prev_rss * 1.0001f || shortlist_size_);
     if (prev_rss - rss < min_roc) {
       break;
     }
@@ -228,45 +883,664 @@ float KMeansClustering::ComputeClustering(
     UpdateCentroids(k, m);
   }
   std::cout << "\r                                                    " << "\r";
+  BuildInvertedCentroids();
   return prev_rss;
 }
 
-void KMeansClustering::UpdateCentroids(const size_t k, const size_t m) {
+float KMeansClustering::ComputeMiniBatchClustering(
+    const size_t k, const size_t m, const size_t batch_size,
+    const float min_roc, const size_t max_num_iter) {
+  assert(batch_size > 0u);
+  InitClustering(k, m);
+  const size_t num_records = NumRecords();
+  std::mt19937 engine;
+  // Just a random number.
+  engine.seed(7355);
+  std::uniform_int_distribution<int> record_dist(0, num_records - 1);
+  // Smoothing factor of the RSS estimate, averaging about two passes over the
+  // records worth of batches.
+  const float alpha = std::min(1.0f, 2.0f * batch_size / (num_records + 1));
+  vector<size_t> counts(k, 0u);
+  vector<int> batch(batch_size);
+  vector<int> batch_ids(batch_size);
+  vector<float> batch_dists(batch_size);
+  vector<vector<int> > members(k);
+  float smooth_rss = std::numeric_limits<float>::max();
+  float best_rss = std::numeric_limits<float>::max();
+  size_t num_no_improvement = 0u;
+  while (num_iters_ < max_num_iter) {
+    ++num_iters_;
+    for (int& record_id: batch) {
+      record_id = record_dist(engine);
+    }
+    BuildCentroidIndex();
+    #pragma omp parallel
+    {  // NOLINT
+      vector<float> dists(k);
+      #pragma omp for schedule(dynamic, 64)
+      for (size_t b = 0; b < batch_size; ++b) {
+        Distances(batch[b], &dists);
+        auto const best = std::min_element(dists.begin(), dists.end());
+        batch_ids[b] = best - dists.begin();
+        batch_dists[b] = *best;
+      }
+    }
+    num_distances_ += batch_size * k;
+    for (vector<int>& records: members) {
+      records.clear();
+    }
+    for (size_t b = 0; b < batch_size; ++b) {
+      members[batch_ids[b]].push_back(batch[b]);
+    }
+    const float batch_rss = SumSquares(batch_dists);
+    // Gradient steps per centroid in batch order.
+    #pragma omp parallel
+    {  // NOLINT
+      vector<IdScore> buffer;
+      #pragma omp for schedule(dynamic, 1)
+      for (size_t c = 0; c < k; ++c) {
+        if (members[c].empty()) {
+          continue;
+        }
+        for (const int record_id: members[c]) {
+          const float rate = 1.0f / ++counts[c];
+          MoveTowards(RecordVector(record_id), rate, &centroids_[c], &buffer);
+        }
+        Truncate(m, &centroids_[c]);
+        Normalize(&centroids_[c]);
+      }
+    }
+    // The RSS over all records estimated by the batch RSS.
+    const float rss = batch_rss * num_records / batch_size;
+    smooth_rss = num_iters_ == 1u ? rss :
+                 (1.0f - alpha) * smooth_rss + alpha * rss;
+    std::cout << "\rIteration: " << num_iters_
+              << "; RSS: " << smooth_rss << "    " << std::flush;
+    if (smooth_rss < best_rss - min_roc) {
+      best_rss = smooth_rss;
+      num_no_improvement = 0u;
+    } else if (++num_no_improvement >= kMaxNoImprovement) {
+      break;
+    }
+  }
+  std::cout << "\r                                                    " << "\r";
+  // Assign all records to the final centroids.
+  prev_centroids_.clear();
+  const float rss = UpdateClusters(k);
+  BuildInvertedCentroids();
+  return rss;
+}
+
+float KMeansClustering::ComputeBisectingClustering(
+    const size_t k, const size_t m, const float min_roc,
+    const size_t max_num_iter) {
+  assert(k > 0u);
+  num_iters_ = 0u;
+  num_distances_ = 0u;
+  NormalizeRecords();
+  prev_centroids_.clear();
+  std::mt19937 engine;
+  // Just a random number.
+  engine.seed(7355);
+  const size_t num_records = NumRecords();
+  // The members and the RSS per node, only kept for the leaves.
+  vector<vector<int> > members(1, vector<int>(num_records));
+  for (size_t r = 0; r < num_records; ++r) {
+    members[0][r] = r;
+  }
+  hierarchy_.assign(1, {vector<IdScore>(), kInvalidId, kInvalidId, kInvalidId,
+                        kInvalidId, num_records});
+  Average(members[0], m, &hierarchy_[0].centroid);
+  Normalize(&hierarchy_[0].centroid);
+  vector<float> dists(num_records);
+  #pragma omp parallel for
+  for (size_t r = 0; r < num_records; ++r) {
+    dists[r] = Distance(RecordVector(r), hierarchy_[0].centroid);
+  }
+  num_distances_ += num_records;
+  vector<float> node_rss(1, SumSquares(dists));
+  // Leaves which can not be split.
+  vector<bool> unsplittable(1, false);
+  size_t num_leaves = 1u;
+  while (num_leaves < k) {
+    // Split the leaf with the largest RSS.
+    int node = kInvalidId;
+    for (size_t n = 0; n < hierarchy_.size(); ++n) {
+      if (hierarchy_[n].left == kInvalidId && !unsplittable[n] &&
+          (node == kInvalidId || node_rss[n] > node_rss[node])) {
+        node = n;
+      }
+    }
+    if (node == kInvalidId) {
+      break;
+    }
+    vector<IdScore> centroids[2];
+    vector<int> clusters[2];
+    float rss[2];
+    if (members[node].size() < 2u ||
+        !Bisect(members[node], m, min_roc, max_num_iter, &engine, centroids,
+                clusters, rss)) {
+      unsplittable[node] = true;
+      continue;
+    }
+    const int left = hierarchy_.size();
+    hierarchy_[node].left = left;
+    hierarchy_[node].right = left + 1;
+    for (int i = 0; i < 2; ++i) {
+      hierarchy_.push_back({vector<IdScore>(), node, kInvalidId, kInvalidId,
+                            kInvalidId, clusters[i].size()});
+      hierarchy_.back().centroid.swap(centroids[i]);
+      members.push_back(vector<int>());
+      members.back().swap(clusters[i]);
+      node_rss.push_back(rss[i]);
+      unsplittable.push_back(false);
+    }
+    vector<int>().swap(members[node]);
+    ++num_leaves;
+    std::cout << "\rClusters: " << num_leaves << "/" << k << "     "
+              << std::flush;
+  }
+  std::cout << "\r                                                    " << "\r";
+  // The leaves in the order of creation become the clusters.
+  centroids_.clear();
+  clusters_.clear();
+  float rss = 0.0f;
+  for (size_t n = 0; n < hierarchy_.size(); ++n) {
+    if (hierarchy_[n].left == kInvalidId) {
+      hierarchy_[n].cluster = centroids_.size();
+      centroids_.push_back(hierarchy_[n].centroid);
+      clusters_.push_back(vector<int>());
+      clusters_.back().swap(members[n]);
+      rss += node_rss[n];
+    }
+  }
+  BuildInvertedCentroids();
+  return rss;
+}
+
+bool KMeansClustering::Bisect(const vector<int>& records, const size_t m,
+                              const float min_roc, const size_t max_num_iter,
+                              std::mt19937* engine, vector<IdScore>* centroids,
+                              vector<int>* clusters, float* rss) {
+  assert(engine && centroids && clusters && rss);
+  // The centroids are scattered into dense scores for fast distances, all
+  // zero between calls.
+  static thread_local vector<float> _dense;
+
+  const size_t num_keywords = index_.NumKeywords();
+  _dense.resize(2 * num_keywords, 0.0f);
+  float* const dense[2] = {&_dense[0], &_dense[num_keywords]};
+  const size_t size = records.size();
+  vector<float> dists(size);
+  // K-means++ seeding, the first centroid is picked uniformly.
+  const int first = std::uniform_int_distribution<int>(0, size - 1)(*engine);
+  centroids[0] = RecordVector(records[first]).ToVector();
+  Scatter(centroids[0], dense[0]);
   #pragma omp parallel for
+  for (size_t i = 0; i < size; ++i) {
+    dists[i] = GatherDistance(RecordVector(records[i]), dense[0]);
+  }
+  Clear(centroids[0], dense[0]);
+  num_distances_ += size;
+  vector<double> probs;
+  SquaredPrefixSums(dists, 0, &probs);
+  if (probs.back() <= 0.0) {
+    return false;
+  }
+  const double next = std::uniform_real_distribution<double>(0,
+      probs.back())(*engine);
+  centroids[1] = RecordVector(records[Sample(probs, next)]).ToVector();
+  for (int c = 0; c < 2; ++c) {
+    Truncate(m, &centroids[c]);
+    Normalize(&centroids[c]);
+  }
+  vector<uint8_t> sides(size);
+  float prev_rss = std::numeric_limits<float>::max();
+  bool split = true;
+  for (size_t iter = 0; iter < max_num_iter; ++iter) {
+    ++num_iters_;
+    Scatter(centroids[0], dense[0]);
+    Scatter(centroids[1], dense[1]);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (size_t i = 0; i < size; ++i) {
+      const Row vec = RecordVector(records[i]);
+      const float dist0 = GatherDistance(vec, dense[0]);
+      const float dist1 = GatherDistance(vec, dense[1]);
+      sides[i] = dist1 < dist0;
+      dists[i] = std::min(dist0, dist1);
+    }
+    Clear(centroids[0], dense[0]);
+    Clear(centroids[1], dense[1]);
+    num_distances_ += 2u * size;
+    // Merge in record order like UpdateClusters.
+    clusters[0].clear();
+    clusters[1].clear();
+    double side_rss[2] = {0.0, 0.0};
+    for (size_t i = 0; i < size; ++i) {
+      clusters[sides[i]].push_back(records[i]);
+      side_rss[sides[i]] += static_cast<double>(dists[i]) * dists[i];
+    }
+    rss[0] = side_rss[0];
+    rss[1] = side_rss[1];
+    if (clusters[0].empty() || clusters[1].empty()) {
+      split = false;
+      break;
+    }
+    const float total_rss = rss[0] + rss[1];
+    if (prev_rss - total_rss < min_roc) {
+      break;
+    }
+    prev_rss = total_rss;
+    for (int c = 0; c < 2; ++c) {
+      Average(clusters[c], m, &centroids[c]);
+      Normalize(&centroids[c]);
+    }
+  }
+  return split;
+}
+
+int KMeansClustering::NearestCluster(const vector<IdScore>& vec) const {
+  assert(hierarchy_.size());
+  int node = 0;
+  while (hierarchy_[node].left != kInvalidId) {
+    const Node& parent = hierarchy_[node];
+    node = Distance(vec, hierarchy_[parent.right].centroid) <
+           Distance(vec, hierarchy_[parent.left].centroid) ?
+           parent.right : parent.left;
+  }
+  return hierarchy_[node].cluster;
+}
+
+auto KMeansClustering::Vectorize(const string& content) const
+    -> vector<IdScore> {
+  static thread_local string _keyword;
+
+  vector<IdScore> vec;
+  if (content.empty()) {
+    return vec;
+  }
+  // Count the keyword frequencies.
+  for (const Index::PosSize& keyword:
+       Index::ExtractKeywords(content, 0, content.size())) {
+    _keyword.assign(content, keyword.pos, keyword.size);
+    const int id = index_.KeywordId(_keyword);
+    if (id != Index::kInvalidId) {
+      vec.push_back({id, 1.0f});
+    }
+  }
+  std::sort(vec.begin(), vec.end());
+  size_t size = 0u;
+  for (const IdScore& idsc: vec) {
+    if (size && vec[size - 1].id == idsc.id) {
+      vec[size - 1].score += 1.0f;
+    } else {
+      vec[size++] = idsc;
+    }
+  }
+  vec.resize(size);
+  for (IdScore& idsc: vec) {
+    idsc.score = index_.Score(idsc.score, content.size(),
+                              index_.KeywordById(idsc.id).items.size());
+  }
+  Normalize(&vec);
+  return vec;
+}
+
+int KMeansClustering::NearestCentroid(const vector<IdScore>& vec) const {
+  static thread_local vector<float> _dists;
+
+  assert(centroids_.size());
+  assert(inverted_offsets_.size() == index_.NumKeywords() + 1);
+  _dists.resize(centroids_.size());
+  InvertedDistances(vec, &_dists);
+  return std::min_element(_dists.begin(), _dists.end()) - _dists.begin();
+}
+
+void KMeansClustering::AssignRecords(const vector<string>& contents,
+                                     vector<int>* centroid_ids) const {
+  assert(centroid_ids);
+  const size_t num_contents = contents.size();
+  centroid_ids->resize(num_contents);
+  #pragma omp parallel for schedule(dynamic, 64)
+  for (size_t i = 0; i < num_contents; ++i) {
+    (*centroid_ids)[i] = NearestCentroid(Vectorize(contents[i]));
+  }
+}
+
+// The magic number of the centroids file format, "KMC1".
+static const uint32_t kCentroidsMagic = 0x31434d4bu;
+
+// Writes the value in binary form to the stream.
+template<typename T>
+static void WriteValue(const T& value, std::ostream* stream) {
+  stream->write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Reads the value in binary form from the stream.
+template<typename T>
+static void ReadValue(std::istream* stream, T* value) {
+  stream->read(reinterpret_cast<char*>(value), sizeof(*value));
+}
+
+bool KMeansClustering::SaveCentroids(const string& path) const {
+  // Map the used keyword ids to consecutive positions.
+  std::unordered_map<int, uint32_t> positions;
+  vector<int> keyword_ids;
+  for (const vector<IdScore>& centroid: centroids_) {
+    for (const IdScore& idsc: centroid) {
+      if (positions.insert({idsc.id, keyword_ids.size()}).second) {
+        keyword_ids.push_back(idsc.id);
+      }
+    }
+  }
+  std::ofstream stream(path.c_str(), std::ios::binary);
+  WriteValue(kCentroidsMagic, &stream);
+  WriteValue(static_cast<uint32_t>(keyword_ids.size()), &stream);
+  for (const int id: keyword_ids) {
+    const string& name = index_.KeywordById(id).name;
+    WriteValue(static_cast<uint32_t>(name.size()), &stream);
+    stream.write(name.data(), name.size());
+  }
+  WriteValue(static_cast<uint32_t>(centroids_.size()), &stream);
+  for (const vector<IdScore>& centroid: centroids_) {
+    WriteValue(static_cast<uint32_t>(centroid.size()), &stream);
+    for (const IdScore& idsc: centroid) {
+      WriteValue(positions[idsc.id], &stream);
+      WriteValue(idsc.score, &stream);
+    }
+  }
+  return stream.good();
+}
+
+bool KMeansClustering::LoadCentroids(const string& path) {
+  std::ifstream stream(path.c_str(), std::ios::binary);
+  uint32_t magic = 0u;
+  ReadValue(&stream, &magic);
+  if (!stream.good() || magic != kCentroidsMagic) {
+    return false;
+  }
+  uint32_t num_keywords = 0u;
+  ReadValue(&stream, &num_keywords);
+  vector<int> keyword_ids;
+  string name;
+  for (uint32_t i = 0; i < num_keywords && stream.good(); ++i) {
+    uint32_t size = 0u;
+    ReadValue(&stream, &size);
+    name.resize(size);
+    stream.read(&name[0], size);
+    keyword_ids.push_back(index_.KeywordId(name));
+  }
+  uint32_t num_centroids = 0u;
+  ReadValue(&stream, &num_centroids);
+  vector<vector<IdScore> > centroids;
+  for (uint32_t c = 0; c < num_centroids && stream.good(); ++c) {
+    uint32_t size = 0u;
+    ReadValue(&stream, &size);
+    centroids.push_back(vector<IdScore>());
+    for (uint32_t i = 0; i < size && stream.good(); ++i) {
+      uint32_t position = 0u;
+      float score = 0.0f;
+      ReadValue(&stream, &position);
+      ReadValue(&stream, &score);
+      if (position >= keyword_ids.size()) {
+        return false;
+      }
+      if (keyword_ids[position] != Index::kInvalidId) {
+        centroids.back().push_back({keyword_ids[position], score});
+      }
+    }
+    std::sort(centroids.back().begin(), centroids.back().end());
+    if (centroids.back().size() < size) {
+      Normalize(&centroids.back());
+    }
+  }
+  if (!stream.good()) {
+    return false;
+  }
+  centroids_.swap(centroids);
+  clusters_.assign(centroids_.size(), vector<int>());
+  hierarchy_.clear();
+  BuildInvertedCentroids();
+  return true;
+}
+
+void KMeansClustering::UpdateCentroids(const size_t k, const size_t m) {
+  // The cluster sizes vary widely.
+  #pragma omp parallel for schedule(dynamic, 1)
   for (size_t c = 0; c < k; ++c) {
     if (clusters_[c].size()) {
-      centroids_[c] = Average(clusters_[c]);
-    } else {
-      centroids_[c] = RecordVector(NextFarthestCentroid(centroids_));
+      Average(clusters_[c], m, &centroids_[c]);
+      Normalize(&centroids_[c]);
+    }
+  }
+  // Empty clusters are reseeded in order of ids, each with the record farthest
+  // from all updated centroids.
+  for (size_t c = 0; c < k; ++c) {
+    if (clusters_[c].empty()) {
+      centroids_[c] = RecordVector(NextFarthestCentroid(centroids_)).ToVector();
+      Truncate(m, &centroids_[c]);
+      Normalize(&centroids_[c]);
     }
-    Truncate(m, &centroids_[c]);
-    Normalize(&centroids_[c]);
   }
 }
 
-float KMeansClustering::UpdateClusters(const size_t k) {
-  clusters_.clear();
-  clusters_.resize(k);
-  const size_t num_records = record_matrix_.size();
-  float rss = 0.0f;
+void KMeansClustering::BuildCentroidIndex() {
+  if (assignment_ == kDenseAssignment) {
+    BuildDenseCentroids();
+  } else if (assignment_ == kInvertedAssignment) {
+    BuildInvertedCentroids();
+  }
+}
+
+float KMeansClustering::RecordDistance(const int record_id,
+                                       const int centroid_id) const {
+  if (assignment_ != kDenseAssignment) {
+    return Distance(RecordVector(record_id), centroids_[centroid_id]);
+  }
+  const size_t k = centroids_.size();
+  float dot = 0.0f;
+  for (const IdScore& idsc: RecordVector(record_id)) {
+    const int dim = dense_dims_[idsc.id];
+    if (dim != kInvalidId) {
+      dot += idsc.score * dense_centroid_scores_[dim * k + centroid_id];
+    }
+  }
+  return 1.0f - dot;
+}
+
+void KMeansClustering::Distances(const int record_id,
+                                 vector<float>* dists) const {
+  assert(dists);
+  if (assignment_ == kDenseAssignment) {
+    DenseDistances(RecordVector(record_id), dists);
+  } else if (assignment_ == kInvertedAssignment) {
+    InvertedDistances(RecordVector(record_id), dists);
+  } else {
+    const Row vec = RecordVector(record_id);
+    for (size_t c = 0; c < dists->size(); ++c) {
+      (*dists)[c] = Distance(vec, centroids_[c]);
+    }
+  }
+}
+
+bool KMeansClustering::UpdateBounds(vector<float>* half_gaps) {
+  assert(half_gaps);
+  const size_t k = centroids_.size();
+  if (prev_centroids_.size() != k) {
+    return false;
+  }
+  for (const vector<IdScore>& centroid: centroids_) {
+    if (!IsUnit(centroid)) {
+      // The bounds only hold for normalized vectors.
+      return false;
+    }
+  }
+  // The two largest drifts, the bound of a record assigned to the centroid of
+  // the largest drift decreases by the second largest.
+  vector<float> drifts(k);
+  int max_id = 0;
+  float max_drift = 0.0f;
+  float second_drift = 0.0f;
+  for (size_t c = 0; c < k; ++c) {
+    drifts[c] = Euclidean(Distance(prev_centroids_[c], centroids_[c])) +
+                kBoundMargin;
+    if (drifts[c] > max_drift) {
+      second_drift = max_drift;
+      max_drift = drifts[c];
+      max_id = c;
+    } else if (drifts[c] > second_drift) {
+      second_drift = drifts[c];
+    }
+  }
+  const size_t num_records = NumRecords();
   for (size_t r = 0; r < num_records; ++r) {
-    int best_id = 0;
-    float best_dist = std::numeric_limits<float>::max();
-    #pragma omp parallel for
-    for (size_t c = 0; c < k; ++c) {
-      const float dist = Distance(record_matrix_[r], centroids_[c]);
-      #pragma omp critical(bestdistupdate)
-      {  // NOLINT
-        if (dist < best_dist) {
-          best_dist = dist;
+    lower_bounds_[r] -= assignments_[r] == max_id ? second_drift : max_drift;
+  }
+  half_gaps->assign(k, std::numeric_limits<float>::max());
+  #pragma omp parallel for
+  for (size_t c = 0; c < k; ++c) {
+    for (size_t j = 0; j < k; ++j) {
+      if (j != c) {
+        const float gap = Euclidean(Distance(centroids_[c], centroids_[j]));
+        (*half_gaps)[c] = std::min((*half_gaps)[c], 0.5f * gap - kBoundMargin);
+      }
+    }
+  }
+  return true;
+}
+
+void KMeansClustering::BuildCentroidSignatures() {
+  const size_t k = centroids_.size();
+  centroid_signatures_.resize(k * kSignatureWords);
+  #pragma omp parallel for schedule(dynamic, 1)
+  for (size_t c = 0; c < k; ++c) {
+    SimHash(centroids_[c], &centroid_signatures_[c * kSignatureWords]);
+  }
+}
+
+int KMeansClustering::ShortlistNearest(const int record_id,
+                                       vector<uint64_t>* keys,
+                                       float* dist) const {
+  assert(keys && dist);
+  const size_t k = keys->size();
+  const uint64_t* record = &record_signatures_[record_id * kSignatureWords];
+  // The keys order the centroids by Hamming distance, ties by id.
+  for (size_t c = 0; c < k; ++c) {
+    const uint64_t* centroid = &centroid_signatures_[c * kSignatureWords];
+    uint64_t hamming = 0u;
+    for (size_t w = 0; w < kSignatureWords; ++w) {
+      hamming += __builtin_popcountll(record[w] ^ centroid[w]);
+    }
+    (*keys)[c] = hamming << 32 | c;
+  }
+  std::nth_element(keys->begin(), keys->begin() + shortlist_size_ - 1,
+                   keys->end());
+  int best_id = kInvalidId;
+  *dist = std::numeric_limits<float>::max();
+  for (size_t i = 0; i < shortlist_size_; ++i) {
+    const int c = (*keys)[i] & 0xffffffffu;
+    const float d = RecordDistance(record_id, c);
+    if (d < *dist || (d == *dist && c < best_id)) {
+      *dist = d;
+      best_id = c;
+    }
+  }
+  return best_id;
+}
+
+float KMeansClustering::UpdateClusters(const size_t k) {
+  const size_t num_records = NumRecords();
+  // Each record writes only its own entries, no synchronization is needed.
+  vector<int> best_ids(num_records);
+  vector<float> best_dists(num_records);
+  BuildCentroidIndex();
+  const bool shortlist = shortlist_size_ && shortlist_size_ < k;
+  if (shortlist) {
+    BuildCentroidSignatures();
+  }
+  vector<float> half_gaps;
+  const bool prune = !shortlist && pruning_ && UpdateBounds(&half_gaps);
+  size_t num_distances = 0u;
+  size_t num_samples = 0u;
+  size_t num_misses = 0u;
+  #pragma omp parallel reduction(+:num_distances, num_samples, num_misses)
+  {  // NOLINT
+    vector<float> dists(k);
+    vector<uint64_t> keys(shortlist ? k : 0u);
+    #pragma omp for schedule(dynamic, 64)
+    for (size_t r = 0; r < num_records; ++r) {
+      if (shortlist) {
+        best_ids[r] = ShortlistNearest(r, &keys, &best_dists[r]);
+        num_distances += shortlist_size_;
+        if (r % kShortlistSampleStep) {
+          continue;
+        }
+        ++num_samples;
+      }
+      if (prune && unit_records_[r]) {
+        // The exact distance to the assigned centroid is needed for the RSS.
+        const int id = assignments_[r];
+        const float dist = RecordDistance(r, id);
+        ++num_distances;
+        const float upper_bound = Euclidean(dist) + kBoundMargin;
+        if (upper_bound < std::max(lower_bounds_[r], half_gaps[id])) {
+          // No other centroid can be closer.
+          best_ids[r] = id;
+          best_dists[r] = dist;
+          continue;
+        }
+      }
+      Distances(r, &dists);
+      num_distances += k;
+      int best_id = 0;
+      float best_dist = std::numeric_limits<float>::max();
+      float second_dist = std::numeric_limits<float>::max();
+      for (size_t c = 0; c < k; ++c) {
+        if (dists[c] < best_dist) {
+          second_dist = best_dist;
+          best_dist = dists[c];
           best_id = c;
+        } else if (dists[c] < second_dist) {
+          second_dist = dists[c];
         }
       }
+      if (shortlist) {
+        // Compare by distance, the shortlist misses equidistant centroids.
+        num_misses += best_dist < best_dists[r];
+        continue;
+      }
+      best_ids[r] = best_id;
+      best_dists[r] = best_dist;
+      if (pruning_) {
+        lower_bounds_[r] = k > 1u ? Euclidean(second_dist) - kBoundMargin :
+                           std::numeric_limits<float>::max();
+      }
     }
-    clusters_[best_id].push_back(r);
-    rss += best_dist * best_dist;
   }
-  return rss;
+  num_distances_ += num_distances;
+  if (shortlist) {
+    shortlist_miss_rate_ = num_samples ?
+        static_cast<float>(num_misses) / num_samples : 0.0f;
+  } else if (pruning_) {
+    assignments_ = best_ids;
+    prev_centroids_ = centroids_;
+  }
+  // Merge in record order, the clusters and the RSS are independent of the
+  // number of threads.
+  clusters_.clear();
+  clusters_.resize(k);
+  for (size_t r = 0; r < num_records; ++r) {
+    clusters_[best_ids[r]].push_back(r);
+  }
+  return SumSquares(best_dists);
+}
+
+auto KMeansClustering::Hierarchy() const -> const vector<Node>& {
+  return hierarchy_;
+}
+
+size_t KMeansClustering::NumClusters() const {
+  return centroids_.size();
 }
 
 auto KMeansClustering::Centroid(const int id) const -> const vector<IdScore>& {
@@ -279,12 +1553,62 @@ auto KMeansClustering::Cluster(const int id) const -> const vector<int>& {
   return clusters_[id];
 }
 
-auto KMeansClustering::RecordVector(const int record_id) const
-    -> const vector<IdScore>& {
-  assert(record_id > -1 && record_id < static_cast<int>(record_matrix_.size()));
-  return record_matrix_[record_id];
+auto KMeansClustering::RecordVector(const int record_id) const -> Row {
+  assert(record_id > -1 && record_id < static_cast<int>(NumRecords()));
+  static thread_local vector<uint32_t> _ids;
+  static thread_local vector<float> _scores;
+
+  const size_t offset = row_offsets_[record_id];
+  const size_t size = row_offsets_[record_id + 1] - offset;
+  if (!IsCompact()) {
+    const Row row = {row_ids_.data() + offset, row_scores_.data() + offset,
+                     size};
+    return row;
+  }
+  if (_ids.size() < size) {
+    _ids.resize(size);
+    _scores.resize(size);
+  }
+  const uint16_t* units = compact_ids_.data() + compact_id_offsets_[record_id];
+  uint32_t id = 0u;
+  for (size_t i = 0; i < size; ++i) {
+    uint32_t delta = *units++;
+    if (delta == kDeltaEscape) {
+      delta = units[0] | static_cast<uint32_t>(units[1]) << 16;
+      units += 2;
+    }
+    id += delta;
+    _ids[i] = id;
+  }
+  // Widening is a shift, the loop is vectorized.
+  const uint16_t* scores = compact_scores_.data() + offset;
+  for (size_t i = 0; i < size; ++i) {
+    _scores[i] = FromBfloat16(scores[i]);
+  }
+  const Row row = {_ids.data(), _scores.data(), size};
+  return row;
+}
+
+size_t KMeansClustering::NumRecords() const {
+  return row_offsets_.empty() ? 0u : row_offsets_.size() - 1;
+}
+
+size_t KMeansClustering::MatrixSize() const {
+  return (row_offsets_.size() + compact_id_offsets_.size()) * sizeof(size_t) +
+         row_ids_.size() * sizeof(row_ids_[0]) +
+         row_scores_.size() * sizeof(row_scores_[0]) +
+         compact_ids_.size() * sizeof(compact_ids_[0]) +
+         compact_scores_.size() * sizeof(compact_scores_[0]);
 }
 
 size_t KMeansClustering::LastNumIters() const {
   return num_iters_;
 }
+
+size_t KMeansClustering::LastNumDistances() const {
+  return num_distances_;
+}
+
+float KMeansClustering::LastShortlistMissRate() const {
+  return shortlist_miss_rate_;
+}
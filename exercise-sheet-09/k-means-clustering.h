@@ -2,12 +2,15 @@
 #ifndef EXERCISE_SHEET_09_K_MEANS_CLUSTERING_H_
 #define EXERCISE_SHEET_09_K_MEANS_CLUSTERING_H_
 
+#include <cstdint>
+#include <random>
 #include <vector>
 #include <string>
 
 class Index;
 
-// K-means clustering based on given index.
+// K-means clustering based on given index. All clusterings are independent
+// of the number of threads.
 class KMeansClustering {
  public:
   // Stores a document id and score; used for sparse vector representation.
@@ -23,9 +26,102 @@ class KMeansClustering {
     }
   };
 
+  // A sparse record vector within the record-term matrix, iterated as IdScore
+  // values sorted by id.
+  struct Row {
+    class Iterator {
+     public:
+      Iterator(const uint32_t* id, const float* score)
+          : id_(id), score_(score) {}
+      IdScore operator*() const {
+        const IdScore idsc = {static_cast<int>(*id_), *score_};
+        return idsc;
+      }
+      Iterator& operator++() {
+        ++id_;
+        ++score_;
+        return *this;
+      }
+      bool operator!=(const Iterator& rhs) const {
+        return id_ != rhs.id_;
+      }
+
+     private:
+      const uint32_t* id_;
+      const float* score_;
+    };
+
+    Iterator begin() const {
+      return Iterator(ids, scores);
+    }
+    Iterator end() const {
+      return Iterator(ids + size, scores + size);
+    }
+    bool empty() const {
+      return size == 0u;
+    }
+    // Returns a copy of the row as sparse vector.
+    std::vector<IdScore> ToVector() const;
+
+    const uint32_t* ids;
+    const float* scores;
+    size_t size;
+  };
+
+  // Implementations of the assignment step, all yield identical results.
+  enum Assignment {
+    // Sparse merge of each record with each centroid, see Distance.
+    kMergeAssignment,
+    // Sparse-dense dot products with the dense centroids.
+    kDenseAssignment,
+    // Single pass over the record keywords using the inverted centroid index.
+    kInvertedAssignment,
+    kDefAssignment = kMergeAssignment
+  };
+
+  // Centroid seeding methods.
+  enum Seeding {
+    // K-means++ by Arthur and Vassilvitskii (2007).
+    kPPSeeding,
+    // K-means|| by Bahmani et al. (2012).
+    kScalableSeeding,
+    kDefSeeding = kPPSeeding
+  };
+
+  // A node of the cluster hierarchy built by bisecting k-means. The leaves are
+  // the clusters.
+  struct Node {
+    // The normalized average of the records below the node.
+    std::vector<IdScore> centroid;
+    int parent;
+    // The children ids, kInvalidId for leaves.
+    int left;
+    int right;
+    // The cluster id of leaves, kInvalidId for inner nodes.
+    int cluster;
+    // The number of records below the node.
+    size_t size;
+  };
+
   // Invalid id value.
   static const int kInvalidId;
 
+  // The number of mini-batch iterations without improvement before
+  // terminating.
+  static const size_t kMaxNoImprovement;
+
+  // The number of sampling passes and the oversampling factor relative to k
+  // of the k-means|| seeding.
+  static const size_t kScalableNumRounds;
+  static const size_t kScalableOversampling;
+
+  // The number of 64-bit words of the SimHash signatures.
+  static const size_t kSignatureWords;
+
+  // The sampling step of the records checked against the exact assignment,
+  // when using a shortlist.
+  static const size_t kShortlistSampleStep;
+
   // Truncates the given vector to m dimensions with he highest scores.
   static void Truncate(size_t m, std::vector<IdScore>* vec);
 
@@ -35,16 +131,37 @@ class KMeansClustering {
   // Returns the distance measure between given two normalized record vectors.
   static float Distance(const std::vector<IdScore>& v1,
                         const std::vector<IdScore>& v2);
+  static float Distance(const Row& v1, const std::vector<IdScore>& v2);
 
   // Initializes the clustering with given index.
   explicit KMeansClustering(const Index& index);
 
-  // Returns the vector composed by the average of the given records.
+  // Returns the vector composed by the average of the given records, sorted by
+  // id.
   std::vector<IdScore> Average(const std::vector<int>& records) const;
 
-  // Constructs the record-term matrix.
+  // Constructs the record-term matrix in parallel.
   void ConstructMatrix();
 
+  // Sets the implementation of the assignment step.
+  void SetAssignment(const Assignment assignment);
+
+  // Sets the centroid seeding method.
+  void SetSeeding(const Seeding seeding);
+
+  // Enables or disables the distance pruning by Hamerly (2010), which yields
+  // identical results. Disabled by default.
+  void SetPruning(const bool pruning);
+
+  // Enables or disables the compact record-term matrix of 16-bit id deltas and
+  // bfloat16 scores. Takes effect on the next ConstructMatrix. Disabled by
+  // default.
+  void SetCompactMatrix(const bool compact);
+
+  // Sets the size of the SimHash candidate shortlist of the assignment steps of
+  // ComputeClustering, which approximates the assignments. 0 disables it.
+  void SetShortlist(const size_t size);
+
   // Computes the k-means clustering for given numer of clusters k, maximum
   // vector dimensions m. Terminates when dropping below the given minimum rate
   // of change or reaching the given maximum number of iterations.
@@ -52,8 +169,60 @@ class KMeansClustering {
   float ComputeClustering(const size_t k, const size_t m, const float min_roc,
                           const size_t max_num_iter);
 
-  // Returns the terms vector for given record id;
-  const std::vector<IdScore>& RecordVector(const int record_id) const;
+  // Computes the mini-batch k-means clustering by Sculley (2010) with batches
+  // of given size, see ComputeClustering. Returns the final RSS value.
+  float ComputeMiniBatchClustering(const size_t k, const size_t m,
+                                   const size_t batch_size,
+                                   const float min_roc,
+                                   const size_t max_num_iter);
+
+  // Computes the bisecting k-means clustering by Steinbach et al. (2000), which
+  // splits the cluster of largest RSS by 2-means until there are k clusters.
+  // Returns the final RSS value.
+  float ComputeBisectingClustering(const size_t k, const size_t m,
+                                   const float min_roc,
+                                   const size_t max_num_iter);
+
+  // Returns the cluster hierarchy of the last bisecting clustering with the
+  // root at 0. It is empty after the other clusterings.
+  const std::vector<Node>& Hierarchy() const;
+
+  // Returns the id of the cluster for given normalized vector by descending
+  // the cluster hierarchy. Requires a bisecting clustering.
+  int NearestCluster(const std::vector<IdScore>& vec) const;
+
+  // Returns the normalized vector of a new record with given content, unknown
+  // keywords are ignored.
+  std::vector<IdScore> Vectorize(const std::string& content) const;
+
+  // Returns the id of the nearest centroid for given normalized vector.
+  int NearestCentroid(const std::vector<IdScore>& vec) const;
+
+  // Vectorizes the new records of given contents and assigns them to their
+  // nearest centroids in parallel. Writes the centroid ids to the list.
+  void AssignRecords(const std::vector<std::string>& contents,
+                     std::vector<int>* centroid_ids) const;
+
+  // Writes the centroids with their keyword names to given file. Returns false,
+  // if the file can not be written.
+  bool SaveCentroids(const std::string& path) const;
+
+  // Loads the centroids written by SaveCentroids, dropping unknown keywords.
+  // All clusters are empty. Returns false, if the file can not be read.
+  bool LoadCentroids(const std::string& path);
+
+  // Returns the terms vector for given record id. Compact rows remain valid
+  // until the next call within the same thread.
+  Row RecordVector(const int record_id) const;
+
+  // Returns the number of records within the record-term matrix.
+  size_t NumRecords() const;
+
+  // Returns the memory used by the record-term matrix in bytes.
+  size_t MatrixSize() const;
+
+  // Returns the number of clusters of the last clustering.
+  size_t NumClusters() const;
 
   // Returns the terms vector for given centroid id.
   const std::vector<IdScore>& Centroid(const int id) const;
@@ -64,13 +233,46 @@ class KMeansClustering {
   // Returns the number of iterations used during the last clustering.
   size_t LastNumIters() const;
 
+  // Returns the number of distances between records and centroids computed
+  // during the last clustering. Without pruning, there are k per record and
+  // iteration.
+  size_t LastNumDistances() const;
+
+  // Returns the fraction of the sampled records of the last assignment step,
+  // whose shortlist missed the nearest centroid, see SetShortlist.
+  float LastShortlistMissRate() const;
+
  private:
+  // Writes the average of the given records truncated to m dimensions to the
+  // vector, sorted by id.
+  void Average(const std::vector<int>& records, const size_t m,
+               std::vector<IdScore>* avg) const;
+
+  // Splits the given records by 2-means seeded with k-means++ using given
+  // engine. Writes the centroids, the members and the RSS of both clusters.
+  // Returns false, if the records can not be split, i.e. are identical.
+  bool Bisect(const std::vector<int>& records, const size_t m,
+              const float min_roc, const size_t max_num_iter,
+              std::mt19937* engine, std::vector<IdScore>* centroids,
+              std::vector<int>* clusters, float* rss);
+
   // Random centroids seeding.
   std::vector<std::vector<IdScore> > RandomCentroids(const size_t k) const;
 
-  // K-means++ probability based seeding.
+  // K-means++ probability based seeding. The distances to the nearest
+  // centroid are updated incrementally with each added centroid.
   std::vector<std::vector<IdScore> > PPCentroids(const size_t k) const;
 
+  // K-means|| seeding, see kScalableSeeding.
+  std::vector<std::vector<IdScore> > ScalableCentroids(const size_t k) const;
+
+  // Updates the distances of the records to the nearest centroid with the new
+  // centroids given by the record ids within [beg, end), and the nearest ids.
+  void UpdateNearest(const std::vector<int>& centroid_records,
+                     const size_t beg, const size_t end,
+                     std::vector<float>* dists,
+                     std::vector<int>* nearest_ids = 0) const;
+
   // Centroids seeding based on farthest vectors.
   std::vector<std::vector<IdScore> > FarthestCentroids(const size_t k) const;
 
@@ -79,17 +281,106 @@ class KMeansClustering {
       const std::vector<std::vector<IdScore> >& centroids,
       std::vector<float>* dists = 0) const;
 
+  // Normalizes all record vectors in parallel.
+  void NormalizeRecords();
+
+  // Normalizes the records and converts the matrix into the compact format,
+  // see SetCompactMatrix.
+  void CompactMatrix();
+
+  // Returns whether the matrix is stored in the compact format.
+  bool IsCompact() const;
+
+  // Normalizes the record vectors, resets the clustering state and seeds
+  // the centroids.
+  void InitClustering(const size_t k, const size_t m);
+
+  // Builds the centroid representation used by the current assignment
+  // implementation.
+  void BuildCentroidIndex();
+
   // Updates the centroids based on the clustering assignments.
   void UpdateCentroids(const size_t k, const size_t m);
 
-  // Assigns record vectors to the nearest centroid. Returns the RSS value.
+  // Builds the dense representation of the current centroids.
+  void BuildDenseCentroids();
+
+  // Writes the distances between given normalized record vector and all dense
+  // centroids to the list, which needs to hold an entry per centroid.
+  void DenseDistances(const Row& vec, std::vector<float>* dists) const;
+
+  // Builds the inverted index over the current centroids.
+  void BuildInvertedCentroids();
+
+  // Same as DenseDistances using the inverted centroid index.
+  template<typename Vector>
+  void InvertedDistances(const Vector& vec, std::vector<float>* dists) const;
+
+  // Returns the distance between the record and the centroid with given ids,
+  // using the dense centroids if available.
+  float RecordDistance(const int record_id, const int centroid_id) const;
+
+  // Writes the distances between the record with given id and all centroids
+  // to the list using the current assignment implementation.
+  void Distances(const int record_id, std::vector<float>* dists) const;
+
+  // Prepares the pruning of the next assignment step, i.e. decreases the
+  // lower bounds by the centroid drifts and computes the half distances to
+  // the nearest other centroid. Returns false, if the bounds are not valid.
+  bool UpdateBounds(std::vector<float>* half_gaps);
+
+  // Computes the signatures of the centroids, see SetShortlist.
+  void BuildCentroidSignatures();
+
+  // Returns the nearest centroid within the shortlist of the record with
+  // given id and writes its distance. The keys list is scratch space of one
+  // entry per centroid.
+  int ShortlistNearest(const int record_id, std::vector<uint64_t>* keys,
+                       float* dist) const;
+
+  // Assigns record vectors to the nearest centroid, the first one on ties.
+  // The records are processed in parallel. Returns the RSS value.
   float UpdateClusters(const size_t k);
 
   const Index& index_;
-  std::vector<std::vector<IdScore> > record_matrix_;
+  // The record-term matrix in compressed sparse row format. The entries of
+  // record i are [row_offsets_[i], row_offsets_[i + 1]).
+  std::vector<size_t> row_offsets_;
+  std::vector<uint32_t> row_ids_;
+  std::vector<float> row_scores_;
+  // The compact matrix replacing the ids and scores above. The delta-coded
+  // ids of record i start at compact_id_offsets_[i], the scores share the row
+  // offsets.
+  std::vector<size_t> compact_id_offsets_;
+  std::vector<uint16_t> compact_ids_;
+  std::vector<uint16_t> compact_scores_;
   std::vector<std::vector<IdScore> > centroids_;
   std::vector<std::vector<int> > clusters_;
+  std::vector<Node> hierarchy_;
   size_t num_iters_;
+  Assignment assignment_;
+  Seeding seeding_;
+  bool pruning_;
+  bool compact_;
+  size_t shortlist_size_;
+  float shortlist_miss_rate_;
+  size_t num_distances_;
+  // The pruning state per record and the centroids of the previous step.
+  std::vector<int> assignments_;
+  std::vector<float> lower_bounds_;
+  std::vector<std::vector<IdScore> > prev_centroids_;
+  std::vector<bool> unit_records_;
+  // The SimHash signatures of kSignatureWords words per record and centroid.
+  std::vector<uint64_t> record_signatures_;
+  std::vector<uint64_t> centroid_signatures_;
+  // Maps keyword ids to dense dimensions, kInvalidId for unused keywords.
+  std::vector<int> dense_dims_;
+  // The dense centroid scores, dimension-major with one entry per centroid.
+  std::vector<float> dense_centroid_scores_;
+  // The centroid lists of the inverted index, stored consecutively by keyword
+  // id. The list of keyword i is [offsets[i], offsets[i + 1]).
+  std::vector<size_t> inverted_offsets_;
+  std::vector<IdScore> inverted_centroids_;
 };
 
 #endif  // EXERCISE_SHEET_09_K_MEANS_CLUSTERING_H_
@@ -1,12 +1,15 @@
 // Copyright 2012 Eugen Sawin <esawin@me73.com>
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
+#include <cstdio>
 #include <fstream>
+#include <string>
 #include <vector>
 #include <set>
 #include <limits>
 #include "./query-processor.h"
 #include "./index.h"
+#include "./k-means-clustering.h"
 
 using std::vector;
 using std::set;
@@ -58,6 +61,15 @@ class QueryProcessorTest : public ::testing::Test {
   void TearDown() {
   }
 
+  // Returns the record ids of given items.
+  static set<int> Records(const vector<Index::Item>& items) {
+    set<int> records;
+    for (const Index::Item& item: items) {
+      records.insert(item.record_id);
+    }
+    return records;
+  }
+
   vector<string> urls_;
   string sentences_;
   Index index_;
@@ -169,3 +181,66 @@ TEST_F(QueryProcessorTest, longQuery) {
                                   {2, {0}, 6, 0.0f} }),
             results);
 }
+
+TEST_F(QueryProcessorTest, ClusterAnswer) {
+  KMeansClustering clustering(index_);
+  clustering.ConstructMatrix();
+  clustering.ComputeClustering(3u, 100u, 0.0f, 10u);
+  QueryProcessor full(index_);
+  QueryProcessor pruned(index_);
+  pruned.BuildClusterIndex(clustering);
+  const vector<string> queries = {"tesla", "Tesla Edison", "atoms",
+                                  "Google birthday doodle Tesla Legacy",
+                                  "Nebuchad", ""};
+  for (const string& query: queries) {
+    const vector<Index::Item> expected = full.Answer(query, num_results_);
+    const set<int> expected_records = Records(expected);
+    // Searching all clusters finds all records.
+    pruned.SetNumProbes(3u);
+    vector<Index::Item> results = pruned.Answer(query, num_results_);
+    EXPECT_EQ(expected.size(), results.size()) << query;
+    EXPECT_EQ(expected_records, Records(results)) << query;
+    EXPECT_EQ(full.LastRecordsFound(), pruned.LastRecordsFound()) << query;
+    // Searching a single cluster finds a subset.
+    pruned.SetNumProbes(1u);
+    results = pruned.Answer(query, num_results_);
+    for (const int record_id: Records(results)) {
+      EXPECT_EQ(1u, expected_records.count(record_id)) << query;
+    }
+    // The single best cluster is searched.
+    if (expected_records.size()) {
+      EXPECT_LT(0u, results.size()) << query;
+    }
+  }
+  // Disabled pruning searches the whole index.
+  pruned.SetNumProbes(0u);
+  EXPECT_EQ(full.Answer("tesla", num_results_),
+            pruned.Answer("tesla", num_results_));
+}
+
+TEST_F(QueryProcessorTest, LoadedClusterAnswer) {
+  KMeansClustering clustering(index_);
+  clustering.ConstructMatrix();
+  clustering.ComputeClustering(3u, 100u, 0.0f, 100u);
+  const string path = "QueryProcessorTest.TMP.centroids";
+  ASSERT_TRUE(clustering.SaveCentroids(path));
+  KMeansClustering loaded(index_);
+  ASSERT_TRUE(loaded.LoadCentroids(path));
+  std::remove(path.c_str());
+  // The records of the loaded clusters are assigned to their nearest
+  // centroids, which are their clusters after convergence.
+  QueryProcessor pruned(index_);
+  pruned.BuildClusterIndex(clustering);
+  QueryProcessor loaded_pruned(index_);
+  loaded_pruned.BuildClusterIndex(loaded);
+  const vector<string> queries = {"tesla", "Tesla Edison", "atoms",
+                                  "Google birthday doodle Tesla Legacy"};
+  for (const size_t num_probes: {1u, 3u}) {
+    pruned.SetNumProbes(num_probes);
+    loaded_pruned.SetNumProbes(num_probes);
+    for (const string& query: queries) {
+      EXPECT_EQ(pruned.Answer(query, num_results_),
+                loaded_pruned.Answer(query, num_results_)) << query;
+    }
+  }
+}
@@ -9,27 +9,72 @@ using std::vector;
 
 QueryProcessor::QueryProcessor(const Index& index)
     : index_(index),
+      num_probes_(0u),
       last_num_records_(0u),
       last_duration_(0u) {}
 
+void QueryProcessor::BuildClusterIndex(const KMeansClustering& clustering) {
+  const size_t num_clusters = clustering.NumClusters();
+  vector<int> record_clusters(index_.NumRecords(), Index::kInvalidId);
+  for (size_t c = 0; c < num_clusters; ++c) {
+    for (const int record_id: clustering.Cluster(c)) {
+      record_clusters[record_id] = c;
+    }
+  }
+  // Records without cluster, e.g. all records for loaded centroids, are
+  // assigned to their nearest centroids.
+  const int num_records = record_clusters.size();
+  #pragma omp parallel for schedule(dynamic, 64)
+  for (int r = 0; r < num_records; ++r) {
+    if (record_clusters[r] == Index::kInvalidId) {
+      record_clusters[r] = clustering.NearestCentroid(
+          clustering.Vectorize(index_.RecordById(r).content));
+    }
+  }
+  cluster_lists_.clear();
+  cluster_lists_.resize(num_clusters);
+  centroid_lists_.clear();
+  centroid_lists_.resize(index_.NumKeywords());
+  for (size_t k = 0; k < index_.NumKeywords(); ++k) {
+    // The sub-lists keep the record order.
+    for (const Index::Item& item: index_.KeywordById(k).items) {
+      cluster_lists_[record_clusters[item.record_id]][k].push_back(item);
+    }
+  }
+  for (size_t c = 0; c < num_clusters; ++c) {
+    for (const KMeansClustering::IdScore& idsc: clustering.Centroid(c)) {
+      centroid_lists_[idsc.id].push_back({static_cast<int>(c), idsc.score});
+    }
+  }
+}
+
+void QueryProcessor::SetNumProbes(const size_t num_probes) {
+  num_probes_ = num_probes;
+}
+
 vector<Index::Item> QueryProcessor::Answer(const string& query,
                                            const size_t max_num_records) const {
   auto const beg = Clock();
   vector<const vector<Index::Item>*> lists;
+  vector<int> keyword_ids;
   vector<string> keywords = Index::Split(query, Index::kWhitespace);
   for (auto it = keywords.cbegin(), end = keywords.cend();
        it != end; ++it) {
     const string& keyword = *it;
-    const vector<Index::Item>& items = index_.Items(keyword);
-    if (items.size()) {
+    const int keyword_id = index_.KeywordId(keyword);
+    if (keyword_id != Index::kInvalidId &&
+        index_.KeywordById(keyword_id).items.size()) {
       // Consider this keyword's items, ignore unknown keywords.
-      lists.push_back(&items);
+      lists.push_back(&index_.KeywordById(keyword_id).items);
+      keyword_ids.push_back(keyword_id);
     } else {
       // Add to ignored keywords list.
     }
   }
   // Boolean intersection.
-  vector<Index::Item> results = Intersect(lists);
+  vector<Index::Item> results = num_probes_ && cluster_lists_.size() ?
+                                ClusterIntersect(keyword_ids) :
+                                Intersect(lists);
   results = Rank(results, max_num_records, lists.size());
   last_duration_ = Clock() - beg;
   return results;
@@ -42,7 +87,7 @@ vector<Index::Item> QueryProcessor::Rank(const vector<Index::Item>& items,
 
   const size_t num_items = items.size();
   vector<ScoreIndexPair> pairs;
-  pairs.reserve(num_items / std::max(1u, num_keywords));
+  pairs.reserve(num_items / std::max<size_t>(1u, num_keywords));
   int prev_record_id = Index::kInvalidId;
   for (size_t i = 0; i < num_items; ++i) {
     const Index::Item& item = items[i];
@@ -64,7 +109,7 @@ vector<Index::Item> QueryProcessor::Rank(const vector<Index::Item>& items,
     const float score = pairs[pair_index].first;
     size_t item_index = pairs[pair_index].second;
     const int record_id = items[item_index].record_id;
-    while (items[item_index].record_id == record_id) {
+    while (item_index < num_items && items[item_index].record_id == record_id) {
       result.push_back(items[item_index++]);
       result.back().score = score;
     }
@@ -72,6 +117,72 @@ vector<Index::Item> QueryProcessor::Rank(const vector<Index::Item>& items,
   return result;
 }
 
+vector<Index::Item> QueryProcessor::ClusterIntersect(
+    const vector<int>& keyword_ids) const {
+  typedef std::pair<float, int> ScoreClusterPair;
+
+  last_num_records_ = 0u;
+  if (keyword_ids.empty()) {
+    return vector<Index::Item>();
+  }
+  // Score the clusters by the dot product of the query with their centroids,
+  // only clusters sharing a keyword with the query are touched.
+  const size_t num_clusters = cluster_lists_.size();
+  vector<float> scores(num_clusters, 0.0f);
+  vector<bool> touched(num_clusters, false);
+  vector<ScoreClusterPair> ranking;
+  for (const int keyword_id: keyword_ids) {
+    for (const KMeansClustering::IdScore& idsc: centroid_lists_[keyword_id]) {
+      if (!touched[idsc.id]) {
+        touched[idsc.id] = true;
+        ranking.push_back({0.0f, idsc.id});
+      }
+      scores[idsc.id] += idsc.score;
+    }
+  }
+  for (ScoreClusterPair& pair: ranking) {
+    pair.first = -scores[pair.second];
+  }
+  std::sort(ranking.begin(), ranking.end());
+  // Probe the best scored clusters containing all keywords, followed by the
+  // untouched clusters in the order of ids.
+  auto const contains_all = [&](const int cluster) {
+    for (const int keyword_id: keyword_ids) {
+      if (!cluster_lists_[cluster].count(keyword_id)) {
+        return false;
+      }
+    }
+    return true;
+  };
+  vector<int> probes;
+  for (size_t r = 0; r < ranking.size() && probes.size() < num_probes_; ++r) {
+    if (contains_all(ranking[r].second)) {
+      probes.push_back(ranking[r].second);
+    }
+  }
+  for (size_t c = 0; c < num_clusters && probes.size() < num_probes_; ++c) {
+    if (!touched[c] && contains_all(c)) {
+      probes.push_back(c);
+    }
+  }
+  // The clusters are disjoint, the items remain grouped by record.
+  vector<Index::Item> results;
+  size_t num_records = 0u;
+  vector<const vector<Index::Item>*> lists(keyword_ids.size());
+  for (const int cluster: probes) {
+    const auto& cluster_lists = cluster_lists_[cluster];
+    for (size_t k = 0; k < keyword_ids.size(); ++k) {
+      lists[k] = &cluster_lists.find(keyword_ids[k])->second;
+    }
+    const vector<Index::Item> cluster_results = Intersect(lists);
+    results.insert(results.end(), cluster_results.begin(),
+                   cluster_results.end());
+    num_records += last_num_records_;
+  }
+  last_num_records_ = num_records;
+  return results;
+}
+
 vector<Index::Item> QueryProcessor::Intersect(
     const vector<const vector<Index::Item>*>& lists) const {
   using std::make_pair;
@@ -3,9 +3,11 @@
 #define EXERCISE_SHEET_09_QUERY_PROCESSOR_H_
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include "./index.h"
 #include "./clock.h"
+#include "./k-means-clustering.h"
 
 // Query processor based on an inverted index.
 class QueryProcessor {
@@ -13,6 +15,20 @@ class QueryProcessor {
   // Initializes the query processor for given index.
   explicit QueryProcessor(const Index& index);
 
+  // Enables the cluster-pruned search over the clusters of given clustering,
+  // also known as selective search. Builds a posting sub-index per cluster,
+  // holding the items of its records, and an inverted index over the
+  // truncated centroids. Records without cluster, e.g. after loading the
+  // centroids, are assigned to their nearest centroids.
+  void BuildClusterIndex(const KMeansClustering& clustering);
+
+  // Sets the number of clusters searched per query. The query is scored
+  // against the centroids and only the sub-indexes of the best scored
+  // clusters, which contain all keywords, are intersected. Searching fewer
+  // clusters is faster, but may miss matches. Searches the whole index for
+  // 0, which is the default.
+  void SetNumProbes(const size_t num_probes);
+
   // Returns the best matching record ids for given query.
   // The items are sorted by score in reversed order. There is one item per
   // record for each keyword considered.
@@ -33,11 +49,22 @@ class QueryProcessor {
   Clock::Diff LastDuration() const;
 
  private:
+  // Returns the intersection of the cluster sub-indexes for given keyword ids,
+  // the items are grouped by record.
+  std::vector<Index::Item> ClusterIntersect(
+      const std::vector<int>& keyword_ids) const;
+
   // Intersects inverted lists and returns the result list.
   std::vector<Index::Item> Intersect(
       const std::vector<const std::vector<Index::Item>*>& lists) const;
 
   const Index& index_;
+  // Per cluster, the items of its records per keyword id.
+  std::vector<std::unordered_map<int, std::vector<Index::Item> > >
+      cluster_lists_;
+  // Per keyword id, the ids of the clusters and their centroid scores.
+  std::vector<std::vector<KMeansClustering::IdScore> > centroid_lists_;
+  size_t num_probes_;
   mutable size_t last_num_records_;
   mutable Clock::Diff last_duration_;
 };